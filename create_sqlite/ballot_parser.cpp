@@ -0,0 +1,284 @@
+#include "ballot_parser.h"
+
+#include <cstring>
+
+const int Ballot_parser::ATL;
+const int Ballot_parser::BTL;
+const int Ballot_parser::NO_PREF;
+
+Ballot_parser::Ballot_parser(int num_atl, int num_btl, bool has_state_field, bool quoted_prefs)
+  : _num_atl(num_atl)
+  , _num_btl(num_btl)
+  , _has_state_field(has_state_field)
+  , _quoted_prefs(quoted_prefs)
+  , _seat(nullptr)
+  , _seat_length(0)
+  , _booth(nullptr)
+  , _booth_length(0)
+  , _table(ATL)
+  , _num_valid_prefs(0)
+  , _first_duplicate(0)
+  , _first_gap(0)
+  , _num_unreadable(0)
+  , _num_marked(0)
+  , _btl_marks_ignored(false)
+  , _marks(num_atl + num_btl, NO_PREF)
+  , _counts((num_atl > num_btl ? num_atl : num_btl) + 1, 0)
+  , _prefs_ordered(num_atl > num_btl ? num_atl : num_btl, NO_PREF)
+  , _prefs_for(num_atl > num_btl ? num_atl : num_btl, NO_PREF)
+{
+}
+
+const char* Ballot_parser::next_line(const char* begin, const char* end, const char*& line_end)
+{
+  const char* nl = static_cast<const char*>(memchr(begin, '\n', end - begin));
+
+  if (nl == nullptr)
+  {
+    line_end = end;
+  }
+  else
+  {
+    line_end = nl;
+  }
+
+  if (line_end > begin && *(line_end - 1) == '\r')
+  {
+    line_end--;
+  }
+
+  return nl == nullptr ? end : nl + 1;
+}
+
+bool Ballot_parser::parse_line(const char* begin, const char* end)
+{
+  // 2019 onwards: State,Division,Vote Collection Point Name,Vote Collection Point ID,Batch No,Paper No,Preferences...
+  // 2016:         ElectorateNm,VoteCollectionPointNm,VoteCollectionPointId,BatchNo,PaperNo,"Preferences"
+  const int first_field = _has_state_field ? 1 : 0;
+
+  const char* p = begin;
+  int field     = 0;
+
+  _seat  = nullptr;
+  _booth = nullptr;
+
+  while (p <= end && field < first_field + 5)
+  {
+    const char* comma = static_cast<const char*>(memchr(p, ',', end - p));
+    const char* field_end = comma == nullptr ? end : comma;
+
+    if (field == first_field)
+    {
+      _seat        = p;
+      _seat_length = field_end - p;
+    }
+    else if (field == first_field + 1)
+    {
+      _booth        = p;
+      _booth_length = field_end - p;
+    }
+
+    field++;
+
+    if (comma == nullptr)
+    {
+      p = end + 1;
+      break;
+    }
+
+    p = comma + 1;
+  }
+
+  if (_seat == nullptr || _booth == nullptr)
+  {
+    return false;
+  }
+
+  _read_marks(p, end, _quoted_prefs);
+
+  // Check if it's a valid BTL vote: 1 to 6 must each appear exactly once
+  // below the line.
+  for (int i = 1; i <= 6; i++)
+  {
+    _counts[i] = 0;
+  }
+
+  bool any_btl_marks = false;
+
+  for (int i = _num_atl; i < _num_atl + _num_btl; i++)
+  {
+    const int v = _marks[i];
+    if (v >= 1 && v <= 6)
+    {
+      _counts[v]++;
+    }
+
+    if (v != NO_PREF)
+    {
+      any_btl_marks = true;
+    }
+  }
+
+  bool valid_btl = true;
+  for (int i = 1; i <= 6; i++)
+  {
+    if (_counts[i] != 1)
+    {
+      valid_btl = false;
+    }
+  }
+
+  _table             = valid_btl ? BTL : ATL;
+  _btl_marks_ignored = !valid_btl && any_btl_marks;
+
+  const int max_prefs   = valid_btl ? _num_btl : _num_atl;
+  const int pref_offset = valid_btl ? _num_atl : 0;
+  const int* marks      = _marks.data() + pref_offset;
+
+  // The AEC's preference files include all the numbers written in the formal
+  // votes, including cases of duplicates, sequences missing a number, etc.
+  // We want to include in the database only the valid preferences.
+  _check_sequence(marks, max_prefs);
+
+  for (int i = 0; i < max_prefs; i++)
+  {
+    _prefs_ordered[i] = NO_PREF;
+  }
+
+  // Only the squares in the valid sequence get a Pfor; any other mark,
+  // including an unreadable one (read as 0), is NO_PREF.  So the Pfor
+  // columns are exactly the inverse of the P columns.
+  for (int i = 0; i < max_prefs; i++)
+  {
+    const int v = marks[i];
+
+    if (v >= 1 && v <= _num_valid_prefs)
+    {
+      _prefs_for[i]         = v;
+      _prefs_ordered[v - 1] = i;
+    }
+    else
+    {
+      _prefs_for[i] = NO_PREF;
+    }
+  }
+
+  return true;
+}
+
+void Ballot_parser::_read_marks(const char* p, const char* end, bool quoted)
+{
+  const int num_squares = _num_atl + _num_btl;
+
+  if (quoted)
+  {
+    // 2016: the preferences are a single quoted field.
+    const char* quote = p <= end ? static_cast<const char*>(memchr(p, '"', end - p)) : nullptr;
+    p = quote == nullptr ? end + 1 : quote + 1;
+  }
+
+  for (int i = 0; i < num_squares; i++)
+  {
+    if (p > end)
+    {
+      // Fill out the rest of the unmarked preferences.
+      _marks[i] = NO_PREF;
+      continue;
+    }
+
+    bool empty   = true;
+    bool numeric = true;
+    int v        = 0;
+
+    while (p < end && *p != ',')
+    {
+      char c = *p;
+
+      // Ticks and crosses count as a 1.
+      if (c == '/' || c == '*')
+      {
+        c = '1';
+      }
+
+      if (c >= '0' && c <= '9')
+      {
+        if (v < 100000)
+        {
+          v = 10 * v + (c - '0');
+        }
+        empty = false;
+      }
+      else if (c != '"' && c != ' ')
+      {
+        numeric = false;
+        empty   = false;
+      }
+
+      p++;
+    }
+
+    _marks[i] = empty ? NO_PREF : (numeric ? v : 0);
+
+    // Step over the comma (or past the end of the line).
+    p++;
+  }
+}
+
+void Ballot_parser::_check_sequence(const int* marks, int n)
+{
+  // counts[k] is the number of squares numbered k; the valid sequence is
+  // 1, 2, ..., k for the largest k with every count in that range equal to 1.
+  for (int k = 1; k <= n; k++)
+  {
+    _counts[k] = 0;
+  }
+
+  int max_mark    = 0;
+  _num_unreadable = 0;
+  _num_marked     = 0;
+
+  for (int i = 0; i < n; i++)
+  {
+    const int v = marks[i];
+    if (v >= 1 && v <= n)
+    {
+      _counts[v]++;
+      _num_marked++;
+      max_mark = v > max_mark ? v : max_mark;
+    }
+    else if (v != NO_PREF)
+    {
+      _num_unreadable++;
+    }
+  }
+
+  _num_valid_prefs = 0;
+  _first_duplicate = 0;
+  _first_gap       = 0;
+
+  for (int k = 1; k <= max_mark; k++)
+  {
+    const int c = _counts[k];
+
+    if (c == 1)
+    {
+      if (_num_valid_prefs == k - 1)
+      {
+        _num_valid_prefs = k;
+      }
+    }
+    else if (c == 0)
+    {
+      // Not a gap unless something higher was written, which it was
+      // because k < max_mark.
+      if (_first_gap == 0)
+      {
+        _first_gap = k;
+      }
+    }
+    else if (_first_duplicate == 0)
+    {
+      _first_duplicate = k;
+    }
+  }
+}
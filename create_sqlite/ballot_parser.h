@@ -0,0 +1,97 @@
+#ifndef BALLOT_PARSER_H
+#define BALLOT_PARSER_H
+
+// Byte-level parser for one line of an AEC formal preferences file.
+//
+// The parser works directly on the bytes of the (memory-mapped) input file:
+// the seat and booth fields are returned as pointers into the line, and the
+// preferences are written into buffers that are allocated once and reused
+// for every ballot.  Validity is checked with a counting array, so each
+// ballot costs O(number of squares) rather than the old indexOf() scans.
+
+#include <vector>
+
+class Ballot_parser
+{
+public:
+  static const int ATL = 0;
+  static const int BTL = 1;
+
+  // Value stored for an unnumbered square or a preference past the valid
+  // sequence, as in the database.
+  static const int NO_PREF = 999;
+
+  Ballot_parser(int num_atl, int num_btl, bool has_state_field, bool quoted_prefs);
+
+  // Returns the start of the next line after the one starting at begin,
+  // or end if there isn't one; line_end is set to the end of the line
+  // (excluding any "\r\n" or "\n").
+  static const char* next_line(const char* begin, const char* end, const char*& line_end);
+
+  // Parses [begin, end).  Returns false if the line doesn't have the
+  // seat and booth fields.
+  bool parse_line(const char* begin, const char* end);
+
+  const char* seat() const { return _seat; }
+  int seat_length() const { return _seat_length; }
+  const char* booth() const { return _booth; }
+  int booth_length() const { return _booth_length; }
+
+  // ATL or BTL, according to whether the BTL squares hold a valid 1-6.
+  int table() const { return _table; }
+  int max_prefs() const { return _table == BTL ? _num_btl : _num_atl; }
+  int num_valid_prefs() const { return _num_valid_prefs; }
+
+  // Why the valid sequence stops where it does, found in the same pass
+  // over the counting array.  first_duplicate() is the lowest number
+  // written in more than one square, and first_gap() the lowest number
+  // missing while a higher one is written; 0 if there isn't one.
+  int first_duplicate() const { return _first_duplicate; }
+  int first_gap() const { return _first_gap; }
+
+  // Squares with a mark that isn't a usable number (0, too big, or not
+  // numeric), and squares numbered at all, in the counted section.
+  int num_unreadable() const { return _num_unreadable; }
+  int num_marked() const { return _num_marked; }
+
+  // An ATL ballot with something written below the line.
+  bool btl_marks_ignored() const { return _btl_marks_ignored; }
+
+  // P1, P2, ...: the group/candidate given each preference in turn.
+  const int* prefs_ordered() const { return _prefs_ordered.data(); }
+
+  // Pfor0, Pfor1, ...: the preference given to each group/candidate, or
+  // NO_PREF if it isn't in the valid sequence.
+  const int* prefs_for() const { return _prefs_for.data(); }
+
+private:
+  void _read_marks(const char* p, const char* end, bool quoted);
+  void _check_sequence(const int* marks, int n);
+
+  int _num_atl;
+  int _num_btl;
+  bool _has_state_field;
+  bool _quoted_prefs;
+
+  const char* _seat;
+  int _seat_length;
+  const char* _booth;
+  int _booth_length;
+
+  int _table;
+  int _num_valid_prefs;
+  int _first_duplicate;
+  int _first_gap;
+  int _num_unreadable;
+  int _num_marked;
+  bool _btl_marks_ignored;
+
+  // One entry per square, ATL squares first.  An empty square is NO_PREF;
+  // anything that isn't a number reads as 0, as QString::toInt() did.
+  std::vector<int> _marks;
+  std::vector<int> _counts;
+  std::vector<int> _prefs_ordered;
+  std::vector<int> _prefs_for;
+};
+
+#endif // BALLOT_PARSER_H
@@ -0,0 +1,171 @@
+#include "ballot_quality.h"
+
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QVariant>
+
+Ballot_quality::Ballot_quality(int num_tables)
+  : _counts(num_tables)
+{
+}
+
+void Ballot_quality::add(int booth_id, const Parsed_ballot& ballot)
+{
+  QVector<Counts>& table_counts = _counts[ballot.table];
+
+  if (booth_id >= table_counts.size())
+  {
+    table_counts.resize(booth_id + 1);
+  }
+
+  Counts& c = table_counts[booth_id];
+  const int stop = ballot.num_valid_prefs + 1;
+
+  c.ballots++;
+  c.ended_by_duplicate   += ballot.first_duplicate == stop;
+  c.ended_by_gap         += ballot.first_gap == stop;
+  c.with_duplicate       += ballot.first_duplicate > 0;
+  c.with_gap             += ballot.first_gap > 0;
+  c.with_unreadable      += ballot.num_unreadable > 0;
+  c.with_discarded_prefs += ballot.num_marked > ballot.num_valid_prefs;
+  c.btl_marks_ignored    += ballot.btl_marks_ignored;
+}
+
+bool Ballot_quality::write(QSqlDatabase& db, const QStringList& table_names, QString& error) const
+{
+  QSqlQuery query(db);
+
+  if (!query.exec("DROP TABLE IF EXISTS ballot_quality") ||
+      !query.exec("CREATE TABLE ballot_quality (booth_id INTEGER, table_name TEXT, ballots INTEGER, "
+                  "ended_by_duplicate INTEGER, ended_by_gap INTEGER, with_duplicate INTEGER, with_gap INTEGER, "
+                  "with_unreadable INTEGER, with_discarded_prefs INTEGER, btl_marks_ignored INTEGER, "
+                  "PRIMARY KEY (booth_id, table_name))"))
+  {
+    error = "Couldn't create ballot_quality table: " + query.lastError().text();
+    return false;
+  }
+
+  db.transaction();
+
+  if (!_insert(db, table_names, error))
+  {
+    db.rollback();
+    return false;
+  }
+
+  if (!db.commit())
+  {
+    error = "Couldn't commit ballot quality";
+    return false;
+  }
+
+  return true;
+}
+
+bool Ballot_quality::write_booths(QSqlDatabase& db, const QStringList& table_names, const QList<int>& booth_ids, QString& error) const
+{
+  QSqlQuery query(db);
+
+  QStringList id_list;
+  for (int booth_id : booth_ids)
+  {
+    id_list.append(QString::number(booth_id));
+  }
+
+  db.transaction();
+
+  if (!query.exec(QString("DELETE FROM ballot_quality WHERE booth_id IN (%1)").arg(id_list.join(", "))))
+  {
+    error = "Couldn't clear ballot quality: " + query.lastError().text();
+    db.rollback();
+    return false;
+  }
+
+  if (!_insert(db, table_names, error))
+  {
+    db.rollback();
+    return false;
+  }
+
+  if (!db.commit())
+  {
+    error = "Couldn't commit ballot quality";
+    return false;
+  }
+
+  return true;
+}
+
+bool Ballot_quality::_insert(QSqlDatabase& db, const QStringList& table_names, QString& error) const
+{
+  QSqlQuery query(db);
+  query.prepare("INSERT INTO ballot_quality VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+
+  for (int j = 0; j < _counts.length(); j++)
+  {
+    for (int i = 0; i < _counts.at(j).length(); i++)
+    {
+      const Counts& c = _counts.at(j).at(i);
+
+      if (c.ballots == 0)
+      {
+        continue;
+      }
+
+      query.addBindValue(i);
+      query.addBindValue(table_names.at(j));
+      query.addBindValue(c.ballots);
+      query.addBindValue(c.ended_by_duplicate);
+      query.addBindValue(c.ended_by_gap);
+      query.addBindValue(c.with_duplicate);
+      query.addBindValue(c.with_gap);
+      query.addBindValue(c.with_unreadable);
+      query.addBindValue(c.with_discarded_prefs);
+      query.addBindValue(c.btl_marks_ignored);
+
+      if (!query.exec())
+      {
+        error = "Couldn't insert ballot quality: " + query.lastError().text();
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+void Ballot_quality::save(QDataStream& out) const
+{
+  out << static_cast<qint32>(_counts.length());
+
+  for (const QVector<Counts>& table_counts : _counts)
+  {
+    out << static_cast<qint32>(table_counts.length());
+
+    for (const Counts& c : table_counts)
+    {
+      out << c.ballots << c.ended_by_duplicate << c.ended_by_gap << c.with_duplicate << c.with_gap
+          << c.with_unreadable << c.with_discarded_prefs << c.btl_marks_ignored;
+    }
+  }
+}
+
+void Ballot_quality::restore(QDataStream& in)
+{
+  qint32 num_tables;
+  in >> num_tables;
+  _counts.resize(num_tables);
+
+  for (QVector<Counts>& table_counts : _counts)
+  {
+    qint32 num_booths;
+    in >> num_booths;
+    table_counts.resize(num_booths);
+
+    for (Counts& c : table_counts)
+    {
+      in >> c.ballots >> c.ended_by_duplicate >> c.ended_by_gap >> c.with_duplicate >> c.with_gap
+         >> c.with_unreadable >> c.with_discarded_prefs >> c.btl_marks_ignored;
+    }
+  }
+}
@@ -0,0 +1,67 @@
+#ifndef BALLOT_QUALITY_H
+#define BALLOT_QUALITY_H
+
+// Per-booth counts of the ways the ballots fall short of a clean sequence,
+// from what Ballot_parser finds while counting the valid preferences:
+//
+//   CREATE TABLE ballot_quality (booth_id INTEGER, table_name TEXT, ballots INTEGER,
+//                                ended_by_duplicate INTEGER, ended_by_gap INTEGER,
+//                                with_duplicate INTEGER, with_gap INTEGER, with_unreadable INTEGER,
+//                                with_discarded_prefs INTEGER, btl_marks_ignored INTEGER,
+//                                PRIMARY KEY (booth_id, table_name))
+//
+// ended_by_* is why the valid sequence stops, with_* whether the defect is
+// anywhere on the ballot; with_discarded_prefs counts ballots with numbers
+// past the valid sequence, and btl_marks_ignored ATL ballots that also had
+// something (not a valid 1-6) written below the line.
+
+#include "ingest_pipeline.h"
+
+#include <QDataStream>
+#include <QList>
+#include <QSqlDatabase>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+class Ballot_quality
+{
+public:
+  explicit Ballot_quality(int num_tables);
+
+  void add(int booth_id, const Parsed_ballot& ballot);
+
+  // Creates (or recreates) and fills the table.  Returns false and sets
+  // error on failure.
+  bool write(QSqlDatabase& db, const QStringList& table_names, QString& error) const;
+
+  // For an update (state_update.h): replaces the rows of just these booths
+  // in the existing table.  Returns false and sets error on failure.
+  bool write_booths(QSqlDatabase& db, const QStringList& table_names, const QList<int>& booth_ids, QString& error) const;
+
+  // For ingest checkpoints.
+  void save(QDataStream& out) const;
+  void restore(QDataStream& in);
+
+private:
+  // Inserts a row for each booth with any ballots; the caller has the
+  // transaction open.
+  bool _insert(QSqlDatabase& db, const QStringList& table_names, QString& error) const;
+
+  struct Counts
+  {
+    long long ballots              = 0;
+    long long ended_by_duplicate   = 0;
+    long long ended_by_gap         = 0;
+    long long with_duplicate       = 0;
+    long long with_gap             = 0;
+    long long with_unreadable      = 0;
+    long long with_discarded_prefs = 0;
+    long long btl_marks_ignored    = 0;
+  };
+
+  // [table][booth_id]
+  QVector<QVector<Counts>> _counts;
+};
+
+#endif // BALLOT_QUALITY_H
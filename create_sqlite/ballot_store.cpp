@@ -0,0 +1,355 @@
+#include "ballot_store.h"
+#include "bitmap_index.h"
+#include "unique_ballots.h"
+
+#include <QFile>
+#include <QHash>
+#include <QVector>
+#include <QtEndian>
+
+#include <cstring>
+
+namespace
+{
+  const int HEADER_SIZE      = 16;
+  const int TABLE_ENTRY_SIZE = 64;
+  const int RANGE_SIZE       = 16;
+
+  struct Store_range
+  {
+    quint32 seat_id;
+    quint32 booth_id;
+    quint32 begin;
+    quint32 end;
+  };
+
+  struct Store_table
+  {
+    QString name;
+    QString source;
+    bool weighted;
+    int num_columns;
+    int bits;
+    quint32 num_rows;
+    QVector<Store_range> ranges;
+    quint64 ranges_offset;
+    quint64 num_prefs_offset;
+    quint64 prefs_offset;
+    quint64 weight_offset;
+    quint64 bitmaps_offset;
+    QByteArray bitmaps;
+  };
+
+  quint64 align_64(quint64 offset)
+  {
+    return (offset + 63) & ~static_cast<quint64>(63);
+  }
+
+  quint64 range_key(int seat_id, int booth_id)
+  {
+    return (static_cast<quint64>(seat_id) << 32) | static_cast<quint32>(booth_id);
+  }
+
+  // One range per (seat, booth), in seat and booth order.
+  bool count_ranges(Bulk_writer& writer, Store_table& table, QString& error)
+  {
+    Bulk_writer::Reader reader(writer, QString("SELECT seat_id, booth_id, COUNT(*) FROM %1 GROUP BY seat_id, booth_id ORDER BY seat_id, booth_id")
+                                         .arg(table.source));
+    quint32 row = 0;
+
+    while (reader.next())
+    {
+      Store_range range;
+      range.seat_id  = static_cast<quint32>(reader.value(0));
+      range.booth_id = static_cast<quint32>(reader.value(1));
+      range.begin    = row;
+      row += static_cast<quint32>(reader.value_64(2));
+      range.end      = row;
+      table.ranges.append(range);
+    }
+
+    if (!reader.error().isEmpty())
+    {
+      error = QString("Couldn't count %1 rows per booth: %2").arg(table.name, reader.error());
+      return false;
+    }
+
+    table.num_rows = row;
+    return true;
+  }
+
+  // Reads the table in id order and puts each row at the next free slot
+  // in its booth's range.
+  bool fill_columns(Bulk_writer& writer, const Store_table& table, uchar* data, QString& error)
+  {
+    const int n = table.num_columns;
+
+    QString sql = QString("SELECT seat_id, booth_id, %1, num_prefs").arg(table.weighted ? "weight" : "1");
+    for (int i = 0; i < n; i++)
+    {
+      sql += QString(", P%1").arg(i + 1);
+    }
+    sql += " FROM " + table.source + " ORDER BY id";
+
+    Bulk_writer::Reader reader(writer, sql);
+
+    QHash<quint64, quint32> next_row;
+    for (const Store_range& range : table.ranges)
+    {
+      next_row.insert(range_key(range.seat_id, range.booth_id), range.begin);
+    }
+
+    const quint64 column_bytes = Ballot_store::column_bytes(table.num_rows, table.bits);
+    uchar* num_prefs_column    = data + table.num_prefs_offset;
+    uchar* prefs_columns       = data + table.prefs_offset;
+    uchar* weight_column       = table.weighted ? data + table.weight_offset : nullptr;
+
+    bool values_ok = true;
+
+    while (values_ok && reader.next())
+    {
+      auto it = next_row.find(range_key(reader.value(0), reader.value(1)));
+      if (it == next_row.end())
+      {
+        // The table changed since the rows were counted.
+        values_ok = false;
+        break;
+      }
+
+      const quint32 row = it.value()++;
+
+      if (weight_column != nullptr)
+      {
+        qToLittleEndian<quint32>(static_cast<quint32>(reader.value_64(2)), weight_column + 4 * static_cast<quint64>(row));
+      }
+
+      values_ok = Ballot_store::write_value(num_prefs_column, table.bits, row, reader.value(3));
+
+      for (int i = 0; values_ok && i < n; i++)
+      {
+        values_ok = Ballot_store::write_value(prefs_columns + i * column_bytes, table.bits, row, reader.value(4 + i));
+      }
+    }
+
+    if (!values_ok)
+    {
+      error = QString("Unexpected value in %1 while writing the ballot store").arg(table.name);
+      return false;
+    }
+
+    if (!reader.error().isEmpty())
+    {
+      error = QString("Couldn't read %1 for the ballot store: %2").arg(table.name, reader.error());
+      return false;
+    }
+
+    return true;
+  }
+} // namespace
+
+QString Ballot_store::file_name_for(const QString& db_file)
+{
+  QString file_name = db_file;
+  if (file_name.endsWith(".sqlite"))
+  {
+    file_name.chop(7);
+  }
+
+  return file_name + ".spx";
+}
+
+int Ballot_store::bits_for(int num_columns)
+{
+  int bits = 1;
+  while ((1 << bits) < num_columns + 2)
+  {
+    bits++;
+  }
+
+  return bits;
+}
+
+quint64 Ballot_store::column_bytes(quint32 num_rows, int bits)
+{
+  // The 8 spare bytes let a value be read or written with one 64-bit load
+  // or store, however near the end of the column it is.
+  return align_64((static_cast<quint64>(num_rows) * bits + 7) / 8 + 8);
+}
+
+int Ballot_store::read_value(const uchar* column, int bits, quint32 row)
+{
+  const quint64 bit  = static_cast<quint64>(row) * bits;
+  const quint64 mask = (static_cast<quint64>(1) << bits) - 1;
+  const int value    = static_cast<int>((qFromLittleEndian<quint64>(column + bit / 8) >> (bit % 8)) & mask);
+
+  return value == static_cast<int>(mask) ? 999 : value;
+}
+
+bool Ballot_store::write_value(uchar* column, int bits, quint32 row, int value)
+{
+  const int none = (1 << bits) - 1;
+
+  if (value == 999)
+  {
+    value = none;
+  }
+  else if (value < 0 || value >= none)
+  {
+    return false;
+  }
+
+  // Every value is written once, into zeros, so it can just be or-ed in.
+  const quint64 bit = static_cast<quint64>(row) * bits;
+  uchar* p          = column + bit / 8;
+  qToLittleEndian<quint64>(qFromLittleEndian<quint64>(p) | (static_cast<quint64>(value) << (bit % 8)), p);
+
+  return true;
+}
+
+bool Ballot_store::write(Bulk_writer& writer, const QStringList& table_names, const QList<int>& table_num_columns, const QStringList& weighted_tables,
+                         const QString& file_name, QString& error)
+{
+  QVector<Store_table> tables(table_names.length());
+
+  quint64 offset = HEADER_SIZE + TABLE_ENTRY_SIZE * static_cast<quint64>(tables.length());
+
+  for (int j = 0; j < tables.length(); j++)
+  {
+    Store_table& table = tables[j];
+    table.name         = table_names.at(j);
+    table.weighted     = weighted_tables.indexOf(table.name) >= 0;
+    table.source       = table.weighted ? Unique_ballots::table_for(table.name) : table.name;
+    table.num_columns  = table_num_columns.at(j);
+    table.bits         = bits_for(table.num_columns);
+
+    if (!count_ranges(writer, table, error))
+    {
+      return false;
+    }
+
+    table.ranges_offset = offset;
+    offset += RANGE_SIZE * static_cast<quint64>(table.ranges.length());
+  }
+
+  for (Store_table& table : tables)
+  {
+    const quint64 column_bytes = Ballot_store::column_bytes(table.num_rows, table.bits);
+
+    table.num_prefs_offset = align_64(offset);
+    table.prefs_offset     = table.num_prefs_offset + column_bytes;
+    offset                 = table.prefs_offset + column_bytes * table.num_columns;
+    table.weight_offset    = 0;
+
+    if (table.weighted)
+    {
+      table.weight_offset = offset;
+      offset += align_64(4 * static_cast<quint64>(table.num_rows));
+    }
+  }
+
+  // Written under another name and renamed when it's done, so the explorer
+  // never picks up half a file.
+  const QString temp_name = file_name + ".tmp";
+  QFile file(temp_name);
+
+  if (!file.open(QIODevice::ReadWrite | QIODevice::Truncate) || !file.resize(static_cast<qint64>(offset)))
+  {
+    error = QString("Couldn't create %1: %2").arg(temp_name, file.errorString());
+    return false;
+  }
+
+  uchar* data = file.map(0, static_cast<qint64>(offset));
+  if (data == nullptr)
+  {
+    error = QString("Couldn't map %1: %2").arg(temp_name, file.errorString());
+    return false;
+  }
+
+  std::memset(data, 0, HEADER_SIZE + TABLE_ENTRY_SIZE * tables.length());
+  std::memcpy(data, "SPX", 4);
+  qToLittleEndian<quint32>(VERSION, data + 4);
+  qToLittleEndian<quint32>(static_cast<quint32>(tables.length()), data + 8);
+
+  for (int j = 0; j < tables.length(); j++)
+  {
+    const Store_table& table = tables.at(j);
+    uchar* entry             = data + HEADER_SIZE + TABLE_ENTRY_SIZE * j;
+
+    const QByteArray name = table.name.toLatin1().left(7);
+    std::memcpy(entry, name.constData(), name.size());
+    qToLittleEndian<quint32>(table.num_rows, entry + 8);
+    qToLittleEndian<quint32>(static_cast<quint32>(table.num_columns), entry + 12);
+    qToLittleEndian<quint32>(static_cast<quint32>(table.bits), entry + 16);
+    qToLittleEndian<quint32>(static_cast<quint32>(table.ranges.length()), entry + 20);
+    qToLittleEndian<quint64>(table.ranges_offset, entry + 24);
+    qToLittleEndian<quint64>(table.num_prefs_offset, entry + 32);
+    qToLittleEndian<quint64>(table.prefs_offset, entry + 40);
+    qToLittleEndian<quint64>(table.weight_offset, entry + 48);
+
+    uchar* range_data = data + table.ranges_offset;
+    for (const Store_range& range : table.ranges)
+    {
+      qToLittleEndian<quint32>(range.seat_id, range_data);
+      qToLittleEndian<quint32>(range.booth_id, range_data + 4);
+      qToLittleEndian<quint32>(range.begin, range_data + 8);
+      qToLittleEndian<quint32>(range.end, range_data + 12);
+      range_data += RANGE_SIZE;
+    }
+
+    if (!fill_columns(writer, table, data, error))
+    {
+      file.unmap(data);
+      file.remove();
+      return false;
+    }
+  }
+
+  // The bitmap indexes go after everything else, since their size is only
+  // known once the columns have been filled in.
+  quint64 end_offset = offset;
+
+  for (int j = 0; j < tables.length(); j++)
+  {
+    Store_table& table         = tables[j];
+    const quint64 column_bytes = Ballot_store::column_bytes(table.num_rows, table.bits);
+
+    table.bitmaps_offset = align_64(end_offset);
+    table.bitmaps        = Bitmap_index::build(data + table.num_prefs_offset, data + table.prefs_offset, column_bytes, table.bits, table.num_rows,
+                                               table.num_columns, table.bitmaps_offset);
+    end_offset           = table.bitmaps_offset + static_cast<quint64>(table.bitmaps.size());
+
+    qToLittleEndian<quint64>(table.bitmaps_offset, data + HEADER_SIZE + TABLE_ENTRY_SIZE * j + 56);
+  }
+
+  file.unmap(data);
+
+  bool bitmaps_ok = file.resize(static_cast<qint64>(end_offset));
+  for (int j = 0; bitmaps_ok && j < tables.length(); j++)
+  {
+    const Store_table& table = tables.at(j);
+    bitmaps_ok = file.seek(static_cast<qint64>(table.bitmaps_offset)) && file.write(table.bitmaps) == table.bitmaps.size();
+  }
+
+  if (!bitmaps_ok)
+  {
+    error = QString("Couldn't write the bitmap index to %1: %2").arg(temp_name, file.errorString());
+    file.remove();
+    return false;
+  }
+
+  file.close();
+
+  if (QFile::exists(file_name) && !QFile::remove(file_name))
+  {
+    error = QString("Couldn't replace %1").arg(file_name);
+    return false;
+  }
+
+  if (!QFile::rename(temp_name, file_name))
+  {
+    error = QString("Couldn't rename %1 to %2").arg(temp_name, file_name);
+    return false;
+  }
+
+  return true;
+}
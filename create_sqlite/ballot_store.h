@@ -0,0 +1,73 @@
+#ifndef BALLOT_STORE_H
+#define BALLOT_STORE_H
+
+// Writes <year>_<state>.spx, a columnar copy of the atl and btl tables that
+// the explorer memory-maps and scans directly (explorer/ballot_store.h reads
+// it; the two have to agree on the layout below).  All integers are
+// little-endian:
+//
+//   Header (16 bytes):
+//     char[4] "SPX\0", quint32 version, quint32 num_tables, quint32 0
+//
+//   Table directory (64 bytes per table):
+//     char[8] name (zero-padded), quint32 num_rows, quint32 num_columns,
+//     quint32 bits, quint32 num_ranges, quint64 ranges_offset,
+//     quint64 num_prefs_offset, quint64 prefs_offset, quint64 weight_offset,
+//     quint64 bitmaps_offset
+//
+//   Ranges (16 bytes each), sorted by seat and then booth:
+//     quint32 seat_id, quint32 booth_id, quint32 begin_row, quint32 end_row
+//
+//   Columns, each num_rows values of bits bits, packed from the lowest bit
+//   of each byte up, and stored one after another with at least 8 spare
+//   bytes at the end of each, padded to a multiple of 64 bytes:
+//     num_prefs; P1, ..., P<num_columns>
+//   bits is just enough for 0, ..., num_columns and the value with every
+//   bit set, which stands for 999, the "no preference" value of the ballot
+//   tables: 5 bits for 25 groups, 8 for 150 candidates.  There are no Pfor
+//   columns: they're the inverse of the P columns, so the explorer rebuilds
+//   them as it scans.
+//
+//   A table may be copied from its weighted <table>_unique table
+//   (unique_ballots.h), with a weight column of quint32 after the others;
+//   otherwise weight_offset is 0 and every row is one ballot.
+//
+//   Each table has a bitmap index of its rows by preference and by
+//   num_prefs at bitmaps_offset, after all the columns (bitmap_index.h).
+//
+// The rows are ordered by seat and booth, so that every booth (and seat) is
+// one range of rows.  Within a booth they're in id order.
+
+#include "bulk_writer.h"
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+namespace Ballot_store
+{
+  const int VERSION = 1;
+
+  // <year>_<state>.sqlite -> <year>_<state>.spx
+  QString file_name_for(const QString& db_file);
+
+  // The bits per value for a table with num_columns columns, and the bytes
+  // a column takes in the file.
+  int bits_for(int num_columns);
+  quint64 column_bytes(quint32 num_rows, int bits);
+
+  // A value in a packed column, with 999 for no preference.  write_value()
+  // expects the value's bits to be zero, and returns false if it doesn't
+  // fit.
+  int read_value(const uchar* column, int bits, quint32 row);
+  bool write_value(uchar* column, int bits, quint32 row, int value);
+
+  // Reads the ballot tables back through the writer (Bulk_writer::Reader)
+  // and writes the store to a temporary file, which replaces file_name
+  // once it's complete.  The tables in weighted_tables are read from
+  // <table>_unique.  Returns false and sets error on failure.
+  bool write(Bulk_writer& writer, const QStringList& table_names, const QList<int>& table_num_columns, const QStringList& weighted_tables,
+             const QString& file_name, QString& error);
+} // namespace Ballot_store
+
+#endif // BALLOT_STORE_H
@@ -0,0 +1,125 @@
+#include "bitmap_index.h"
+#include "ballot_store.h"
+
+#include <QVector>
+#include <QtEndian>
+
+namespace
+{
+  struct Encoded_bitmap
+  {
+    quint32 num_containers = 0;
+    QByteArray headers;
+    QByteArray data;
+  };
+
+  template <typename T>
+  void append_le(QByteArray& bytes, T value)
+  {
+    uchar buffer[sizeof(T)];
+    qToLittleEndian<T>(value, buffer);
+    bytes.append(reinterpret_cast<const char*>(buffer), sizeof(T));
+  }
+
+  void add_container(Encoded_bitmap& bitmap, quint16 chunk, const QVector<quint16>& rows)
+  {
+    const bool bitset = rows.length() > Bitmap_index::ARRAY_MAX;
+
+    append_le<quint16>(bitmap.headers, chunk);
+    append_le<quint16>(bitmap.headers, bitset ? Bitmap_index::BITSET : Bitmap_index::ARRAY);
+    append_le<quint32>(bitmap.headers, static_cast<quint32>(rows.length()));
+    bitmap.num_containers++;
+
+    if (!bitset)
+    {
+      for (quint16 row : rows)
+      {
+        append_le<quint16>(bitmap.data, row);
+      }
+      return;
+    }
+
+    QVector<quint64> words(Bitmap_index::CHUNK_ROWS / 64, 0);
+    for (quint16 row : rows)
+    {
+      words[row >> 6] |= static_cast<quint64>(1) << (row & 63);
+    }
+
+    for (quint64 word : words)
+    {
+      append_le<quint64>(bitmap.data, word);
+    }
+  }
+} // namespace
+
+namespace Bitmap_index
+{
+  QByteArray build(const uchar* num_prefs_column, const uchar* prefs_columns, quint64 column_bytes, int bits, quint32 num_rows, int num_columns,
+                   quint64 base_offset)
+  {
+    const int num_prefs   = num_columns;
+    const int num_bitmaps = num_columns * num_prefs + num_columns + 1;
+
+    QVector<Encoded_bitmap> bitmaps(num_bitmaps);
+    QVector<QVector<quint16>> chunk_rows(num_bitmaps);
+
+    // One chunk at a time, so only one chunk's row lists are held at once.
+    for (quint64 chunk_begin = 0; chunk_begin < num_rows; chunk_begin += CHUNK_ROWS)
+    {
+      const quint32 chunk_end = static_cast<quint32>(qMin<quint64>(num_rows, chunk_begin + CHUNK_ROWS));
+
+      for (quint32 row = static_cast<quint32>(chunk_begin); row < chunk_end; row++)
+      {
+        const quint16 low = static_cast<quint16>(row - chunk_begin);
+        const int n       = Ballot_store::read_value(num_prefs_column, bits, row);
+
+        if (n < 0 || n > num_columns)
+        {
+          continue;
+        }
+
+        chunk_rows[num_columns * num_prefs + n].append(low);
+
+        for (int k = 0; k < n; k++)
+        {
+          const int group = Ballot_store::read_value(prefs_columns + k * column_bytes, bits, row);
+          if (group >= 0 && group < num_columns)
+          {
+            chunk_rows[num_prefs * group + k].append(low);
+          }
+        }
+      }
+
+      const quint16 chunk = static_cast<quint16>(chunk_begin / CHUNK_ROWS);
+      for (int i = 0; i < num_bitmaps; i++)
+      {
+        if (!chunk_rows.at(i).isEmpty())
+        {
+          add_container(bitmaps[i], chunk, chunk_rows.at(i));
+          chunk_rows[i].clear();
+        }
+      }
+    }
+
+    QByteArray section;
+    append_le<quint32>(section, static_cast<quint32>(num_prefs));
+    append_le<quint32>(section, static_cast<quint32>(num_bitmaps));
+    section.append(QByteArray(8 * num_bitmaps, '\0'));
+
+    for (int i = 0; i < num_bitmaps; i++)
+    {
+      const Encoded_bitmap& bitmap = bitmaps.at(i);
+      if (bitmap.num_containers == 0)
+      {
+        continue;
+      }
+
+      qToLittleEndian<quint64>(base_offset + section.size(), reinterpret_cast<uchar*>(section.data()) + 8 + 8 * i);
+      append_le<quint32>(section, bitmap.num_containers);
+      section.append(bitmap.headers);
+      section.append(bitmap.data);
+    }
+
+    return section;
+  }
+} // namespace Bitmap_index
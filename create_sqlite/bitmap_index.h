@@ -0,0 +1,50 @@
+#ifndef BITMAP_INDEX_H
+#define BITMAP_INDEX_H
+
+// Compressed bitmaps of the rows of a ballot store table, written into the
+// .spx file (ballot_store.h), so the explorer can work out which ballots
+// pass a filter like Pfor3 <= 6 AND Pfor7 <= 6 before it reads any of them.
+// There is a bitmap for every (group, preference) pair, i.e. the rows where
+// P<pref> = group, and one for every value of num_prefs.
+//
+// Each bitmap is in the style of a roaring bitmap: the rows are split into
+// chunks of 65536, and each chunk that has any rows in it is a container,
+// either an array of the (16-bit) row numbers in the chunk, or a bitset of
+// 65536 bits once there are more than ARRAY_MAX of them.  The section is:
+//
+//   quint32 num_prefs (the preferences indexed, one per column),
+//   quint32 num_bitmaps (num_columns * num_prefs + num_columns + 1),
+//   quint64 offset[num_bitmaps] (from the start of the file; 0 if empty)
+//
+// and then the bitmaps.  Bitmap num_prefs * group + pref - 1 is for
+// P<pref> = group, and bitmap num_columns * num_prefs + n for num_prefs = n.
+// Each bitmap is:
+//
+//   quint32 num_containers,
+//   (quint16 chunk, quint16 kind, quint32 cardinality) per container,
+//
+// then each container's data in the same order: cardinality quint16s for
+// an array (kind 0), or 1024 quint64 words for a bitset (kind 1).
+
+#include <QByteArray>
+#include <QtGlobal>
+
+namespace Bitmap_index
+{
+  const int CHUNK_ROWS = 65536;
+  const int ARRAY_MAX  = 4096;
+
+  enum Container_kind
+  {
+    ARRAY  = 0,
+    BITSET = 1
+  };
+
+  // Builds the section for a table whose columns (as laid out in the store)
+  // start at num_prefs_column and prefs_columns; base_offset is where the
+  // section will go in the file.
+  QByteArray build(const uchar* num_prefs_column, const uchar* prefs_columns, quint64 column_bytes, int bits, quint32 num_rows, int num_columns,
+                   quint64 base_offset);
+} // namespace Bitmap_index
+
+#endif // BITMAP_INDEX_H
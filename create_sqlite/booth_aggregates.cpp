@@ -0,0 +1,144 @@
+#include "booth_aggregates.h"
+
+#include <QMap>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QVariant>
+
+Booth_aggregates::Booth_aggregates(int num_tables)
+  : _counts(num_tables)
+{
+}
+
+bool Booth_aggregates::write(QSqlDatabase& db, const QStringList& table_names, QString& error) const
+{
+  QSqlQuery query(db);
+
+  for (int j = 0; j < table_names.length(); j++)
+  {
+    const QString& table = table_names.at(j);
+
+    if (!query.exec(QString("DROP TABLE IF EXISTS %1_booth_p1").arg(table)) ||
+        !query.exec(QString("DROP TABLE IF EXISTS %1_booth_p1_p2").arg(table)) ||
+        !query.exec(QString("CREATE TABLE %1_booth_p1 (booth_id INTEGER, P1 INTEGER, votes INTEGER, PRIMARY KEY (booth_id, P1))").arg(table)) ||
+        !query.exec(QString("CREATE TABLE %1_booth_p1_p2 (booth_id INTEGER, P1 INTEGER, P2 INTEGER, votes INTEGER, PRIMARY KEY (booth_id, P1, P2))").arg(table)))
+    {
+      error = QString("Couldn't create %1 booth aggregate tables: %2").arg(table, query.lastError().text());
+      return false;
+    }
+
+    db.transaction();
+
+    if (!_insert(db, j, table, error))
+    {
+      db.rollback();
+      return false;
+    }
+
+    if (!db.commit())
+    {
+      error = "Couldn't commit booth aggregates";
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool Booth_aggregates::write_booths(QSqlDatabase& db, const QStringList& table_names, const QList<int>& booth_ids, QString& error) const
+{
+  QSqlQuery query(db);
+
+  QStringList id_list;
+  for (int booth_id : booth_ids)
+  {
+    id_list.append(QString::number(booth_id));
+  }
+
+  for (int j = 0; j < table_names.length(); j++)
+  {
+    const QString& table = table_names.at(j);
+
+    db.transaction();
+
+    if (!query.exec(QString("DELETE FROM %1_booth_p1 WHERE booth_id IN (%2)").arg(table, id_list.join(", "))) ||
+        !query.exec(QString("DELETE FROM %1_booth_p1_p2 WHERE booth_id IN (%2)").arg(table, id_list.join(", "))))
+    {
+      error = QString("Couldn't clear %1 booth aggregates: %2").arg(table, query.lastError().text());
+      db.rollback();
+      return false;
+    }
+
+    if (!_insert(db, j, table, error))
+    {
+      db.rollback();
+      return false;
+    }
+
+    if (!db.commit())
+    {
+      error = "Couldn't commit booth aggregates";
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool Booth_aggregates::_insert(QSqlDatabase& db, int j, const QString& table, QString& error) const
+{
+  QSqlQuery query(db);
+
+  // Sorted, so that the rows go in in primary key order.
+  QMap<quint64, long long> p1_p2_counts;
+  QMap<quint64, long long> p1_counts;
+
+  for (auto it = _counts.at(j).constBegin(); it != _counts.at(j).constEnd(); ++it)
+  {
+    p1_p2_counts.insert(it.key(), it.value());
+    p1_counts[it.key() & ~static_cast<quint64>(0xffff)] += it.value();
+  }
+
+  query.prepare(QString("INSERT INTO %1_booth_p1_p2 VALUES(?, ?, ?, ?)").arg(table));
+
+  for (auto it = p1_p2_counts.constBegin(); it != p1_p2_counts.constEnd(); ++it)
+  {
+    query.addBindValue(static_cast<int>(it.key() >> 32));
+    query.addBindValue(static_cast<int>((it.key() >> 16) & 0xffff));
+    query.addBindValue(static_cast<int>(it.key() & 0xffff));
+    query.addBindValue(it.value());
+
+    if (!query.exec())
+    {
+      error = "Couldn't insert booth P1 P2 count: " + query.lastError().text();
+      return false;
+    }
+  }
+
+  query.prepare(QString("INSERT INTO %1_booth_p1 VALUES(?, ?, ?)").arg(table));
+
+  for (auto it = p1_counts.constBegin(); it != p1_counts.constEnd(); ++it)
+  {
+    query.addBindValue(static_cast<int>(it.key() >> 32));
+    query.addBindValue(static_cast<int>((it.key() >> 16) & 0xffff));
+    query.addBindValue(it.value());
+
+    if (!query.exec())
+    {
+      error = "Couldn't insert booth P1 count: " + query.lastError().text();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void Booth_aggregates::save(QDataStream& out) const
+{
+  out << _counts;
+}
+
+void Booth_aggregates::restore(QDataStream& in)
+{
+  in >> _counts;
+}
@@ -0,0 +1,59 @@
+#ifndef BOOTH_AGGREGATES_H
+#define BOOTH_AGGREGATES_H
+
+// Per-booth counts of first preferences, and of first and second
+// preferences together, tallied while the ballots are written and stored as
+//
+//   CREATE TABLE <table>_booth_p1 (booth_id INTEGER, P1 INTEGER, votes INTEGER, PRIMARY KEY (booth_id, P1))
+//   CREATE TABLE <table>_booth_p1_p2 (booth_id INTEGER, P1 INTEGER, P2 INTEGER, votes INTEGER, PRIMARY KEY (booth_id, P1, P2))
+//
+// for atl and btl.  These are the answers to the explorer's first two
+// Step-forward columns, which would otherwise be a GROUP BY over every
+// ballot.  P2 is 999 for a ballot with only one preference, as in the
+// ballot tables.
+
+#include <QDataStream>
+#include <QHash>
+#include <QList>
+#include <QSqlDatabase>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+class Booth_aggregates
+{
+public:
+  explicit Booth_aggregates(int num_tables);
+
+  void add(int table, int booth_id, int p1, int p2)
+  {
+    _counts[table][_key(booth_id, p1, p2)] += 1;
+  }
+
+  // Creates (or recreates) and fills the tables.  Returns false and sets
+  // error on failure.
+  bool write(QSqlDatabase& db, const QStringList& table_names, QString& error) const;
+
+  // For an update (state_update.h): replaces the rows of just these booths
+  // in the existing tables with what has been tallied, which should only be
+  // for these booths.  Returns false and sets error on failure.
+  bool write_booths(QSqlDatabase& db, const QStringList& table_names, const QList<int>& booth_ids, QString& error) const;
+
+  // For ingest checkpoints.
+  void save(QDataStream& out) const;
+  void restore(QDataStream& in);
+
+private:
+  // Inserts table j's rows; the caller has the transaction open.
+  bool _insert(QSqlDatabase& db, int j, const QString& table, QString& error) const;
+
+  static quint64 _key(int booth_id, int p1, int p2)
+  {
+    return (static_cast<quint64>(booth_id) << 32) | (static_cast<quint64>(p1) << 16) | static_cast<quint64>(p2);
+  }
+
+  // Keyed by (booth_id, P1, P2); the P1 counts are summed from these.
+  QVector<QHash<quint64, long long>> _counts;
+};
+
+#endif // BOOTH_AGGREGATES_H
@@ -0,0 +1,148 @@
+#include "booth_clustering.h"
+
+#include <QRegularExpression>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QVariant>
+
+namespace Booth_clustering
+{
+  QString ranges_table_for(const QString& table)
+  {
+    return table + "_booth_rows";
+  }
+
+  // Rewrites table with its rows in order_by order and ids from 0.
+  static bool rewrite(QSqlDatabase& db, const QString& table, const QString& order_by, QString& error)
+  {
+    QSqlQuery query(db);
+    const QString rewritten = table + "_rewritten";
+
+    // The new table is created from the old one's own CREATE statement,
+    // so the two can't drift apart.
+    if (!query.exec(QString("SELECT sql FROM sqlite_master WHERE type = 'table' AND name = '%1'").arg(table)) || !query.next())
+    {
+      error = QString("Couldn't find the schema of %1").arg(table);
+      return false;
+    }
+
+    QString create = query.value(0).toString();
+    create.replace(QRegularExpression(QString("^CREATE TABLE (IF NOT EXISTS )?%1\\b").arg(table)), "CREATE TABLE " + rewritten);
+
+    QStringList columns;
+    if (!query.exec(QString("PRAGMA table_info(%1)").arg(table)))
+    {
+      error = QString("Couldn't read the columns of %1: %2").arg(table, query.lastError().text());
+      return false;
+    }
+
+    while (query.next())
+    {
+      const QString column = query.value(1).toString();
+      if (column != "id")
+      {
+        columns.append(column);
+      }
+    }
+
+    const QString column_list = columns.join(", ");
+
+    db.transaction();
+
+    if (!query.exec(QString("DROP TABLE IF EXISTS %1").arg(rewritten)) || !query.exec(create) ||
+        !query.exec(QString("INSERT INTO %1 (id, %2) SELECT ROW_NUMBER() OVER (ORDER BY %4) - 1, %2 FROM %3 ORDER BY %4")
+                      .arg(rewritten, column_list, table, order_by)) ||
+        !query.exec(QString("DROP TABLE %1").arg(table)) || !query.exec(QString("ALTER TABLE %1 RENAME TO %2").arg(rewritten, table)))
+    {
+      error = QString("Couldn't rewrite %1: %2").arg(table, query.lastError().text());
+      db.rollback();
+      return false;
+    }
+
+    if (!db.commit())
+    {
+      error = QString("Couldn't commit the rewritten %1").arg(table);
+      return false;
+    }
+
+    return true;
+  }
+
+  bool cluster(QSqlDatabase& db, const QStringList& table_names, QString& error)
+  {
+    for (const QString& table : table_names)
+    {
+      if (!rewrite(db, table, "seat_id, booth_id, id", error))
+      {
+        error = QString("Couldn't put %1 in booth order: %2").arg(table, error);
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  bool renumber(QSqlDatabase& db, const QStringList& table_names, QString& error)
+  {
+    for (const QString& table : table_names)
+    {
+      if (!rewrite(db, table, "id", error))
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  bool write_ranges(QSqlDatabase& db, const QStringList& table_names, QString& error)
+  {
+    QSqlQuery query(db);
+
+    for (const QString& table : table_names)
+    {
+      const QString ranges_table = ranges_table_for(table);
+
+      db.transaction();
+
+      if (!query.exec(QString("DROP TABLE IF EXISTS %1").arg(ranges_table)) ||
+          !query.exec(QString("CREATE TABLE %1 (booth_id INTEGER PRIMARY KEY, seat_id INTEGER, first_id INTEGER, last_id INTEGER)").arg(ranges_table)) ||
+          !query.exec(QString("INSERT INTO %1 SELECT booth_id, MIN(seat_id), MIN(id), MAX(id) FROM %2 GROUP BY booth_id").arg(ranges_table, table)))
+      {
+        error = QString("Couldn't write %1: %2").arg(ranges_table, query.lastError().text());
+        db.rollback();
+        return false;
+      }
+
+      if (!db.commit())
+      {
+        error = QString("Couldn't commit %1").arg(ranges_table);
+        return false;
+      }
+
+      // If the booths' ranges don't overlap, they add up to the number of
+      // rows (the ids have no gaps, being written in one go).
+      qint64 range_rows = -1;
+      qint64 num_rows   = 0;
+
+      if (query.exec(QString("SELECT SUM(last_id - first_id + 1) FROM %1").arg(ranges_table)) && query.next())
+      {
+        range_rows = query.value(0).toLongLong();
+      }
+
+      if (query.exec(QString("SELECT COUNT(*) FROM %1").arg(table)) && query.next())
+      {
+        num_rows = query.value(0).toLongLong();
+      }
+
+      if (range_rows != num_rows)
+      {
+        error = QString("%1 isn't in booth order").arg(table);
+        query.exec(QString("DROP TABLE %1").arg(ranges_table));
+        return false;
+      }
+    }
+
+    return true;
+  }
+} // namespace Booth_clustering
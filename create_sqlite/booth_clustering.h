@@ -0,0 +1,40 @@
+#ifndef BOOTH_CLUSTERING_H
+#define BOOTH_CLUSTERING_H
+
+// The ballots are written in the order of the AEC's file.  With
+// --cluster-booths, each ballot table is rewritten in seat and booth order
+// afterwards, so every booth's ballots (and every seat's) have consecutive
+// ids, and the id ranges are recorded in
+//
+//   CREATE TABLE <table>_booth_rows (booth_id INTEGER PRIMARY KEY, seat_id INTEGER, first_id INTEGER, last_id INTEGER)
+//
+// The explorer then reads one booth at a time, and turns a query for one
+// division into a scan of an id range.  The <table>_unique tables are
+// written in booth order anyway, so they always get one.
+
+#include <QSqlDatabase>
+#include <QString>
+#include <QStringList>
+
+namespace Booth_clustering
+{
+  // "atl" -> "atl_booth_rows"
+  QString ranges_table_for(const QString& table);
+
+  // Rewrites each table with its rows ordered by seat_id and booth_id, and
+  // by id within a booth.  The ids are renumbered from 0, since the
+  // explorer shares queries out between threads over ids 0 to rows - 1.
+  // Returns false and sets error on failure.
+  bool cluster(QSqlDatabase& db, const QStringList& table_names, QString& error);
+
+  // Rewrites each table in id order with the ids renumbered from 0, for a
+  // table that has gaps in its ids or doesn't start at 0 (after --update).
+  // Returns false and sets error on failure.
+  bool renumber(QSqlDatabase& db, const QStringList& table_names, QString& error);
+
+  // Writes <table>_booth_rows for each table, which has to be in booth
+  // order already.  Returns false and sets error if it isn't, or on failure.
+  bool write_ranges(QSqlDatabase& db, const QStringList& table_names, QString& error);
+} // namespace Booth_clustering
+
+#endif // BOOTH_CLUSTERING_H
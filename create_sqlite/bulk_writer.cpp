@@ -0,0 +1,336 @@
+#include "bulk_writer.h"
+
+#include <QFileInfo>
+#include <QSqlDriver>
+#include <QSqlError>
+#include <QVariant>
+
+#include <sqlite3.h>
+
+#ifdef Q_OS_UNIX
+#include <dlfcn.h>
+#endif
+
+Bulk_writer::Bulk_writer(QSqlDatabase& db)
+  : _db(db)
+  , _handle(nullptr)
+{
+  _statements[0] = nullptr;
+  _statements[1] = nullptr;
+
+  // https://doc.qt.io/qt-5/qsqldriver.html#handle
+  QVariant v = db.driver()->handle();
+  if (v.isValid() && qstrcmp(v.typeName(), "sqlite3*") == 0)
+  {
+    _handle = *static_cast<sqlite3**>(v.data());
+  }
+
+  if (_handle != nullptr && !_same_sqlite())
+  {
+    _handle = nullptr;
+  }
+
+  for (QSqlQuery& query : _queries)
+  {
+    query = QSqlQuery(_db);
+  }
+}
+
+Bulk_writer::~Bulk_writer()
+{
+  _finalize_statements();
+}
+
+bool Bulk_writer::_same_sqlite() const
+{
+#if defined(BULK_WRITER_SYSTEM_SQLITE)
+  // Built for a Qt whose plugin is known to use the system SQLite.
+  const bool same_library = true;
+#elif defined(Q_OS_UNIX)
+  // A bundled copy can be the very same release as the system one, so the
+  // versions prove nothing: the plugin has to resolve sqlite3_libversion
+  // to the same function as this program does.  The driver's vtable
+  // pointer (its first word) lies inside the plugin, which gives dladdr()
+  // the plugin's file.  A bundled copy's symbols are usually hidden, so
+  // dlsym() finds nothing and the handle isn't used.
+  bool same_library = false;
+
+  Dl_info info;
+  if (dladdr(*reinterpret_cast<void* const*>(_db.driver()), &info) != 0 && info.dli_fname != nullptr)
+  {
+    void* plugin = dlopen(info.dli_fname, RTLD_LAZY | RTLD_NOLOAD);
+    if (plugin != nullptr)
+    {
+      same_library = dlsym(plugin, "sqlite3_libversion") == reinterpret_cast<void*>(&sqlite3_libversion);
+      dlclose(plugin);
+    }
+  }
+#else
+  const bool same_library = false;
+#endif
+
+  // Nothing is called on the handle until it's known to be ours.
+  if (!same_library)
+  {
+    return false;
+  }
+
+  const char* handle_file = sqlite3_db_filename(_handle, "main");
+  if (handle_file == nullptr)
+  {
+    return false;
+  }
+
+  const QFileInfo handle_info(QString::fromUtf8(handle_file));
+  const QFileInfo db_info(_db.databaseName());
+
+  return handle_info.canonicalFilePath().isEmpty() ? handle_info.absoluteFilePath() == db_info.absoluteFilePath()
+                                                   : handle_info.canonicalFilePath() == db_info.canonicalFilePath();
+}
+
+bool Bulk_writer::is_native() const
+{
+  return _handle != nullptr;
+}
+
+bool Bulk_writer::begin_build()
+{
+  return exec(QString("PRAGMA page_size = %1").arg(PAGE_SIZE))
+      && exec("PRAGMA journal_mode = WAL")
+      && exec("PRAGMA synchronous = OFF")
+      && exec("PRAGMA temp_store = MEMORY")
+      && exec(QString("PRAGMA cache_size = -%1").arg(CACHE_SIZE_KB));
+}
+
+bool Bulk_writer::finish_build()
+{
+  _finalize_statements();
+
+  // VACUUM rewrites the whole file, so it also packs the pages that were
+  // filled out of order during the load.
+  return exec("PRAGMA journal_mode = DELETE")
+      && exec("PRAGMA synchronous = FULL")
+      && exec("PRAGMA cache_size = -2000")
+      && exec("VACUUM");
+}
+
+bool Bulk_writer::prepare_insert(int table, const QString& sql)
+{
+  if (_handle == nullptr)
+  {
+    if (!_queries[table].prepare(sql))
+    {
+      _last_error = _queries[table].lastError().text();
+      return false;
+    }
+
+    return true;
+  }
+
+  if (_statements[table] != nullptr)
+  {
+    sqlite3_finalize(_statements[table]);
+    _statements[table] = nullptr;
+  }
+
+  const QByteArray utf8 = sql.toUtf8();
+  if (sqlite3_prepare_v2(_handle, utf8.constData(), utf8.size(), &_statements[table], nullptr) != SQLITE_OK)
+  {
+    _last_error = QString::fromUtf8(sqlite3_errmsg(_handle));
+    return false;
+  }
+
+  return true;
+}
+
+bool Bulk_writer::insert_ballot(int table, long long id, int seat_id, int booth_id, int num_prefs, const int* prefs_ordered, const int* prefs_for, int max_prefs)
+{
+  if (_handle == nullptr)
+  {
+    QSqlQuery& query = _queries[table];
+
+    query.addBindValue(id);
+    query.addBindValue(seat_id);
+    query.addBindValue(booth_id);
+    query.addBindValue(num_prefs);
+
+    for (int i = 0; i < max_prefs; i++)
+    {
+      query.addBindValue(prefs_ordered[i]);
+    }
+
+    for (int i = 0; i < max_prefs; i++)
+    {
+      query.addBindValue(prefs_for[i]);
+    }
+
+    if (!query.exec())
+    {
+      _last_error = query.lastError().text();
+      return false;
+    }
+
+    return true;
+  }
+
+  sqlite3_stmt* stmt = _statements[table];
+
+  sqlite3_bind_int64(stmt, 1, id);
+  sqlite3_bind_int(stmt, 2, seat_id);
+  sqlite3_bind_int(stmt, 3, booth_id);
+  sqlite3_bind_int(stmt, 4, num_prefs);
+
+  // P1, ..., PN are columns 5 to 4 + N; Pfor0, ... follow.
+  for (int i = 0; i < max_prefs; i++)
+  {
+    sqlite3_bind_int(stmt, 5 + i, prefs_ordered[i]);
+  }
+
+  for (int i = 0; i < max_prefs; i++)
+  {
+    sqlite3_bind_int(stmt, 5 + max_prefs + i, prefs_for[i]);
+  }
+
+  const int rc = sqlite3_step(stmt);
+  sqlite3_reset(stmt);
+
+  if (rc != SQLITE_DONE)
+  {
+    _last_error = QString::fromUtf8(sqlite3_errmsg(_handle));
+    return false;
+  }
+
+  return true;
+}
+
+bool Bulk_writer::begin_transaction()
+{
+  return exec("BEGIN");
+}
+
+bool Bulk_writer::commit()
+{
+  return exec("COMMIT");
+}
+
+bool Bulk_writer::exec(const QString& sql)
+{
+  if (_handle == nullptr)
+  {
+    QSqlQuery query(_db);
+    if (!query.exec(sql))
+    {
+      _last_error = QString("%1: %2").arg(sql, query.lastError().text());
+      return false;
+    }
+
+    return true;
+  }
+
+  char* error = nullptr;
+  if (sqlite3_exec(_handle, sql.toUtf8().constData(), nullptr, nullptr, &error) != SQLITE_OK)
+  {
+    _last_error = QString("%1: %2").arg(sql, QString::fromUtf8(error == nullptr ? "" : error));
+    sqlite3_free(error);
+    return false;
+  }
+
+  return true;
+}
+
+QString Bulk_writer::last_error() const
+{
+  return _last_error;
+}
+
+void Bulk_writer::_finalize_statements()
+{
+  for (QSqlQuery& query : _queries)
+  {
+    query.clear();
+  }
+
+  for (int i = 0; i < 2; i++)
+  {
+    if (_statements[i] != nullptr)
+    {
+      sqlite3_finalize(_statements[i]);
+      _statements[i] = nullptr;
+    }
+  }
+}
+
+Bulk_writer::Reader::Reader(Bulk_writer& writer, const QString& sql)
+  : _handle(writer._handle)
+  , _stmt(nullptr)
+  , _query(writer._db)
+{
+  if (_handle == nullptr)
+  {
+    _query.setForwardOnly(true);
+    if (!_query.exec(sql))
+    {
+      _error = QString("Couldn't run %1: %2").arg(sql, _query.lastError().text());
+    }
+    return;
+  }
+
+  const QByteArray utf8 = sql.toUtf8();
+  if (sqlite3_prepare_v2(_handle, utf8.constData(), utf8.size(), &_stmt, nullptr) != SQLITE_OK)
+  {
+    _error = QString("Couldn't prepare %1: %2").arg(sql, QString::fromUtf8(sqlite3_errmsg(_handle)));
+    _stmt  = nullptr;
+  }
+}
+
+Bulk_writer::Reader::~Reader()
+{
+  if (_stmt != nullptr)
+  {
+    sqlite3_finalize(_stmt);
+  }
+}
+
+bool Bulk_writer::Reader::next()
+{
+  if (!_error.isEmpty())
+  {
+    return false;
+  }
+
+  if (_handle == nullptr)
+  {
+    if (_query.next())
+    {
+      return true;
+    }
+
+    if (_query.lastError().isValid())
+    {
+      _error = _query.lastError().text();
+    }
+    return false;
+  }
+
+  const int rc = sqlite3_step(_stmt);
+  if (rc == SQLITE_ROW)
+  {
+    return true;
+  }
+
+  if (rc != SQLITE_DONE)
+  {
+    _error = QString::fromUtf8(sqlite3_errmsg(_handle));
+  }
+  return false;
+}
+
+int Bulk_writer::Reader::value(int column) const
+{
+  return _handle == nullptr ? _query.value(column).toInt() : sqlite3_column_int(_stmt, column);
+}
+
+long long Bulk_writer::Reader::value_64(int column) const
+{
+  return _handle == nullptr ? _query.value(column).toLongLong() : sqlite3_column_int64(_stmt, column);
+}
@@ -0,0 +1,95 @@
+#ifndef BULK_WRITER_H
+#define BULK_WRITER_H
+
+// Writes the ballot rows through the SQLite C API, using the sqlite3 handle
+// underneath the QSQLITE connection.  Each table has one prepared statement
+// that is bound and stepped for every row, so there's no QVariant boxing and
+// no re-preparing.
+//
+// The handle is only used if the QSQLITE plugin is running the very same
+// SQLite library as this program is linked against (Qt's stock plugin
+// bundles its own copy, and calling one copy's functions on the other's
+// handle is undefined behaviour): on Unix, the plugin's sqlite3_libversion
+// has to be the linked one, found with dladdr() and dlsym(), and the
+// handle's file name the database's.  Elsewhere, it's only used if built
+// with BULK_WRITER_SYSTEM_SQLITE.  Otherwise everything goes through
+// QSqlQuery instead, which gives the same tables, only more slowly.
+//
+// begin_build() switches the connection to bulk-load settings (a write-ahead
+// log with no syncing, a big page cache and larger pages); finish_build()
+// puts the safe settings back and VACUUMs.  In between, a killed process
+// loses nothing that was committed, so an ingest can be resumed from its
+// last checkpoint, but a power cut can still lose recent commits.
+
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QString>
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+class Bulk_writer
+{
+public:
+  static const int PAGE_SIZE     = 32768;
+  static const int CACHE_SIZE_KB = 512 * 1024;
+
+  explicit Bulk_writer(QSqlDatabase& db);
+  ~Bulk_writer();
+
+  // Whether rows go through the sqlite3 handle, rather than QSqlQuery.
+  bool is_native() const;
+
+  // Must be called before any tables are created, for the page size to apply.
+  bool begin_build();
+  bool finish_build();
+
+  bool prepare_insert(int table, const QString& sql);
+  bool insert_ballot(int table, long long id, int seat_id, int booth_id, int num_prefs, const int* prefs_ordered, const int* prefs_for, int max_prefs);
+
+  bool begin_transaction();
+  bool commit();
+
+  bool exec(const QString& sql);
+  QString last_error() const;
+
+  // Steps through the rows of a SELECT, the same way as the writer
+  // writes (see ballot_store.h):
+  //
+  //   Bulk_writer::Reader reader(writer, sql);
+  //   while (reader.next()) { ... reader.value(0) ... }
+  //   if (!reader.error().isEmpty()) { ... }
+  class Reader
+  {
+  public:
+    Reader(Bulk_writer& writer, const QString& sql);
+    ~Reader();
+
+    // False at the end of the rows, or on an error.
+    bool next();
+
+    int value(int column) const;
+    long long value_64(int column) const;
+
+    // Empty unless preparing or stepping failed.
+    const QString& error() const { return _error; }
+
+  private:
+    sqlite3* _handle;
+    sqlite3_stmt* _stmt;
+    QSqlQuery _query;
+    QString _error;
+  };
+
+private:
+  bool _same_sqlite() const;
+  void _finalize_statements();
+
+  QSqlDatabase _db;
+  sqlite3* _handle;
+  sqlite3_stmt* _statements[2];
+  QSqlQuery _queries[2];
+  QString _last_error;
+};
+
+#endif // BULK_WRITER_H
@@ -16,7 +16,59 @@ DEFINES += QT_DEPRECATED_WARNINGS
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
-        main.cpp
+        ballot_parser.cpp \
+        ballot_quality.cpp \
+        ballot_store.cpp \
+        bitmap_index.cpp \
+        booth_aggregates.cpp \
+        booth_clustering.cpp \
+        bulk_writer.cpp \
+        election_archive.cpp \
+        ingest_checkpoint.cpp \
+        ingest_dictionary.cpp \
+        ingest_log.cpp \
+        ingest_pipeline.cpp \
+        main.cpp \
+        metadata_blob.cpp \
+        national_data.cpp \
+        prefs_source.cpp \
+        schema_indexes.cpp \
+        state_ingest.cpp \
+        state_update.cpp \
+        unique_ballots.cpp
+
+HEADERS += \
+        ballot_parser.h \
+        ballot_quality.h \
+        ballot_store.h \
+        bitmap_index.h \
+        booth_aggregates.h \
+        booth_clustering.h \
+        bulk_writer.h \
+        election_archive.h \
+        ingest_checkpoint.h \
+        ingest_dictionary.h \
+        ingest_log.h \
+        ingest_pipeline.h \
+        metadata_blob.h \
+        national_data.h \
+        prefs_source.h \
+        schema_indexes.h \
+        state_ingest.h \
+        state_update.h \
+        unique_ballots.h
+
+# The ballot rows are written through the SQLite C API on the QSQLITE
+# connection's own handle when Qt's SQLite plugin is built against the
+# system SQLite (-system-sqlite).  On Unix, Bulk_writer checks that the
+# plugin resolves to the same library at run time, and uses QSqlQuery if
+# it doesn't; elsewhere, add DEFINES += BULK_WRITER_SYSTEM_SQLITE for a Qt
+# known to use the system SQLite.
+LIBS += -lsqlite3
+unix: LIBS += -ldl
+
+# Zipped and gzipped prefs files are read with zlib.
+LIBS += -lz
 
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
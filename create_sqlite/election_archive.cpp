@@ -0,0 +1,249 @@
+#include "election_archive.h"
+#include "ballot_store.h"
+#include "metadata_blob.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QVariant>
+#include <QVector>
+#include <QtEndian>
+
+#include <cstring>
+
+namespace
+{
+  const int HEADER_SIZE   = 32;
+  const int ENTRY_SIZE    = 64;
+  const qint64 COPY_CHUNK = 4 << 20;
+
+  struct Archive_entry
+  {
+    quint32 year            = 0;
+    quint32 state           = 0;
+    quint32 db_file         = 0;
+    quint64 metadata_offset = 0;
+    quint64 metadata_size   = 0;
+    quint64 store_offset    = 0;
+    quint64 store_size      = 0;
+    quint32 content_id      = 0;
+    quint32 atl_ids         = 0;
+    quint32 btl_ids         = 0;
+    quint32 atl_votes       = 0;
+    quint32 btl_votes       = 0;
+  };
+
+  quint64 align_64(quint64 offset)
+  {
+    return (offset + 63) & ~static_cast<quint64>(63);
+  }
+
+  bool write_bytes(QFile& file, const QByteArray& bytes, QString& error)
+  {
+    if (file.write(bytes) != bytes.size())
+    {
+      error = QString("Couldn't write to %1").arg(file.fileName());
+      return false;
+    }
+
+    return true;
+  }
+
+  // Pads with zeros up to the next 64-byte boundary.
+  bool pad_64(QFile& file, QString& error)
+  {
+    const qint64 pos = file.pos();
+    return write_bytes(file, QByteArray(static_cast<int>(align_64(pos) - pos), '\0'), error);
+  }
+
+  // What the explorer checks the .sqlite file against (see
+  // election_archive.h).
+  bool read_identity(QSqlDatabase& db, Archive_entry& entry, QString& error)
+  {
+    QSqlQuery query(db);
+
+    if (!query.exec("PRAGMA user_version") || !query.next())
+    {
+      error = QString("Couldn't read the content id of %1: %2").arg(db.databaseName(), query.lastError().text());
+      return false;
+    }
+
+    entry.content_id = query.value(0).toUInt();
+
+    if (!query.exec("SELECT (SELECT COALESCE(MAX(id), -1) + 1 FROM atl), (SELECT COALESCE(MAX(id), -1) + 1 FROM btl), atl_votes, btl_votes "
+                    "FROM basic_info WHERE id = 0") ||
+        !query.next())
+    {
+      error = QString("Couldn't read the totals of %1: %2").arg(db.databaseName(), query.lastError().text());
+      return false;
+    }
+
+    entry.atl_ids   = query.value(0).toUInt();
+    entry.btl_ids   = query.value(1).toUInt();
+    entry.atl_votes = query.value(2).toUInt();
+    entry.btl_votes = query.value(3).toUInt();
+    return true;
+  }
+
+  bool read_metadata(const QString& db_file, Metadata_blob::Contents& contents, Archive_entry& entry, QString& error)
+  {
+    const QString connection_name = QString("archive_%1").arg(db_file);
+    bool ok                       = false;
+
+    {
+      QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connection_name);
+      db.setDatabaseName(db_file);
+
+      if (!db.open())
+      {
+        error = QString("Couldn't open %1").arg(db_file);
+      }
+      else
+      {
+        ok = Metadata_blob::read(db, contents, error) && read_identity(db, entry, error);
+        db.close();
+      }
+    }
+
+    QSqlDatabase::removeDatabase(connection_name);
+    return ok;
+  }
+
+  bool copy_store(const QString& store_file, QFile& out, Archive_entry& entry, QString& error)
+  {
+    QFile in(store_file);
+    if (!in.open(QIODevice::ReadOnly))
+    {
+      error = QString("Couldn't open %1").arg(store_file);
+      return false;
+    }
+
+    if (!pad_64(out, error))
+    {
+      return false;
+    }
+
+    entry.store_offset = static_cast<quint64>(out.pos());
+
+    while (!in.atEnd())
+    {
+      const QByteArray chunk = in.read(COPY_CHUNK);
+      if (chunk.isEmpty() || !write_bytes(out, chunk, error))
+      {
+        error = error.isEmpty() ? QString("Couldn't read %1").arg(store_file) : error;
+        return false;
+      }
+    }
+
+    entry.store_size = static_cast<quint64>(out.pos()) - entry.store_offset;
+    return true;
+  }
+} // namespace
+
+namespace Election_archive
+{
+  bool write(const QStringList& db_files, const QString& archive_file, QString& error)
+  {
+    QFile out(archive_file);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+      error = QString("Couldn't open %1 for writing").arg(archive_file);
+      return false;
+    }
+
+    // The header and directory go in last, once the offsets are known.
+    if (!write_bytes(out, QByteArray(HEADER_SIZE + ENTRY_SIZE * db_files.length(), '\0'), error))
+    {
+      return false;
+    }
+
+    const QDir archive_dir = QFileInfo(archive_file).absoluteDir();
+    Metadata_blob::String_table strings;
+    QVector<Archive_entry> entries;
+
+    for (const QString& db_file : db_files)
+    {
+      Metadata_blob::Contents contents;
+      Archive_entry entry;
+      if (!read_metadata(db_file, contents, entry, error))
+      {
+        return false;
+      }
+
+      entry.year    = static_cast<quint32>(contents.year);
+      entry.state   = static_cast<quint32>(strings.id(contents.state));
+      entry.db_file = static_cast<quint32>(strings.id(archive_dir.relativeFilePath(QFileInfo(db_file).absoluteFilePath())));
+
+      const QByteArray metadata = qCompress(Metadata_blob::encode_body(contents, strings));
+      entry.metadata_offset     = static_cast<quint64>(out.pos());
+      entry.metadata_size       = static_cast<quint64>(metadata.size());
+
+      if (!write_bytes(out, metadata, error))
+      {
+        return false;
+      }
+
+      const QString store_file = Ballot_store::file_name_for(db_file);
+      if (QFileInfo(store_file).exists() && !copy_store(store_file, out, entry, error))
+      {
+        return false;
+      }
+
+      entries.append(entry);
+    }
+
+    // ~~~~~ Strings ~~~~~
+    QByteArray string_data;
+    QDataStream string_out(&string_data, QIODevice::WriteOnly);
+    string_out.setVersion(QDataStream::Qt_5_6);
+    string_out << strings.strings();
+    string_data = qCompress(string_data);
+
+    const quint64 strings_offset = static_cast<quint64>(out.pos());
+    if (!write_bytes(out, string_data, error))
+    {
+      return false;
+    }
+
+    // ~~~~~ Header and directory ~~~~~
+    QByteArray head(HEADER_SIZE + ENTRY_SIZE * entries.length(), '\0');
+    uchar* data = reinterpret_cast<uchar*>(head.data());
+
+    std::memcpy(data, "SPA", 4);
+    qToLittleEndian<quint32>(VERSION, data + 4);
+    qToLittleEndian<quint32>(static_cast<quint32>(entries.length()), data + 8);
+    qToLittleEndian<quint64>(strings_offset, data + 16);
+    qToLittleEndian<quint64>(static_cast<quint64>(string_data.size()), data + 24);
+
+    for (int i = 0; i < entries.length(); i++)
+    {
+      const Archive_entry& entry = entries.at(i);
+      uchar* p                   = data + HEADER_SIZE + ENTRY_SIZE * i;
+
+      qToLittleEndian<quint32>(entry.year, p);
+      qToLittleEndian<quint32>(entry.state, p + 4);
+      qToLittleEndian<quint32>(entry.db_file, p + 8);
+      qToLittleEndian<quint32>(entry.content_id, p + 12);
+      qToLittleEndian<quint64>(entry.metadata_offset, p + 16);
+      qToLittleEndian<quint64>(entry.metadata_size, p + 24);
+      qToLittleEndian<quint64>(entry.store_offset, p + 32);
+      qToLittleEndian<quint64>(entry.store_size, p + 40);
+      qToLittleEndian<quint32>(entry.atl_ids, p + 48);
+      qToLittleEndian<quint32>(entry.btl_ids, p + 52);
+      qToLittleEndian<quint32>(entry.atl_votes, p + 56);
+      qToLittleEndian<quint32>(entry.btl_votes, p + 60);
+    }
+
+    if (!out.seek(0) || !write_bytes(out, head, error))
+    {
+      error = error.isEmpty() ? QString("Couldn't write the directory of %1").arg(archive_file) : error;
+      return false;
+    }
+
+    return true;
+  }
+} // namespace Election_archive
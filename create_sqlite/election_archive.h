@@ -0,0 +1,50 @@
+#ifndef ELECTION_ARCHIVE_H
+#define ELECTION_ARCHIVE_H
+
+// Many elections' metadata and ballot stores in one file (.spa), so the
+// explorer can keep a single file mapped and switch between elections
+// without opening anything but the election's .sqlite file, which it
+// still needs for its SQL queries.
+//
+// All integers are little-endian.  The file starts with a 32-byte header:
+//
+//   char magic[4] = "SPA\0"; quint32 version; quint32 num_elections; 0
+//   quint64 strings_offset; quint64 strings_size
+//
+// followed by a 64-byte directory entry for each election:
+//
+//   quint32 year; quint32 state (a string); quint32 db_file (a string,
+//   relative to the archive's folder); quint32 content_id
+//   quint64 metadata_offset, metadata_size
+//   quint64 store_offset, store_size (0, 0 if the file had no store)
+//   quint32 atl_ids, btl_ids, atl_votes, btl_votes
+//
+// content_id is the .sqlite file's user_version, which every ingest and
+// update sets to a new random value (state_ingest.h); atl_ids and btl_ids
+// are MAX(id) + 1 of the ballot tables, and the votes are from basic_info.
+// The explorer compares them with the .sqlite file before it uses an
+// election's metadata and store, since its SQL queries still read the
+// file: one that has been updated or built again since is loaded from the
+// file itself instead.
+//
+// The strings are a qCompress()ed QDataStream (Qt_5_6) of one QStringList,
+// shared by all the elections.  Each election's metadata is a qCompress()ed
+// metadata_blob body (see metadata_blob.h), with its strings given as
+// indexes in the shared list.  Each store is the election's .spx file
+// (ballot_store.h) copied in whole, at a 64-byte boundary, so its own
+// offsets are from store_offset.
+
+#include <QString>
+#include <QStringList>
+
+namespace Election_archive
+{
+  const int VERSION = 1;
+
+  // Reads each .sqlite file's metadata_blob (schema version 2)
+  // and copies its .spx file, if it has one, into archive_file.  Returns
+  // false and sets error on failure.
+  bool write(const QStringList& db_files, const QString& archive_file, QString& error);
+} // namespace Election_archive
+
+#endif // ELECTION_ARCHIVE_H
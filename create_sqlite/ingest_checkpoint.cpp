@@ -0,0 +1,98 @@
+#include "ingest_checkpoint.h"
+#include "schema_indexes.h"
+
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QStringList>
+#include <QVariant>
+
+bool Ingest_checkpoint::create_table(QSqlDatabase& db, QString& error)
+{
+  QSqlQuery query(db);
+
+  if (!query.exec("CREATE TABLE IF NOT EXISTS ingest_progress (id INTEGER PRIMARY KEY, input_file TEXT, input_size INTEGER, "
+                  "input_offset INTEGER, atl_rows INTEGER, btl_rows INTEGER, state BLOB)"))
+  {
+    error = "Couldn't create ingest_progress table: " + query.lastError().text();
+    return false;
+  }
+
+  return true;
+}
+
+bool Ingest_checkpoint::drop_table(QSqlDatabase& db, QString& error)
+{
+  QSqlQuery query(db);
+
+  if (!query.exec("DROP TABLE IF EXISTS ingest_progress"))
+  {
+    error = "Couldn't drop ingest_progress table: " + query.lastError().text();
+    return false;
+  }
+
+  return true;
+}
+
+bool Ingest_checkpoint::exists(QSqlDatabase& db)
+{
+  return db.tables().indexOf("ingest_progress") >= 0;
+}
+
+bool Ingest_checkpoint::is_complete(QSqlDatabase& db)
+{
+  if (exists(db))
+  {
+    return false;
+  }
+
+  QSqlQuery query(db);
+  return query.exec("SELECT version FROM schema_version WHERE id = 0") && query.next() &&
+         query.value(0).toInt() == Schema_indexes::SCHEMA_VERSION;
+}
+
+bool Ingest_checkpoint::save(QSqlDatabase& db, QString& error) const
+{
+  QSqlQuery query(db);
+  query.prepare("INSERT OR REPLACE INTO ingest_progress VALUES(0, ?, ?, ?, ?, ?, ?)");
+  query.addBindValue(input_file);
+  query.addBindValue(input_size);
+  query.addBindValue(input_offset);
+  query.addBindValue(atl_rows);
+  query.addBindValue(btl_rows);
+  query.addBindValue(state);
+
+  if (!query.exec())
+  {
+    error = "Couldn't save checkpoint: " + query.lastError().text();
+    return false;
+  }
+
+  return true;
+}
+
+bool Ingest_checkpoint::load(QSqlDatabase& db, QString& error)
+{
+  QSqlQuery query(db);
+
+  if (!query.exec("SELECT input_file, input_size, input_offset, atl_rows, btl_rows, state FROM ingest_progress WHERE id = 0"))
+  {
+    error = "Couldn't read checkpoint: " + query.lastError().text();
+    return false;
+  }
+
+  if (!query.next())
+  {
+    // The table is there but the first checkpoint wasn't reached:
+    // start from the beginning of the prefs file.
+    *this = Ingest_checkpoint();
+    return true;
+  }
+
+  input_file   = query.value(0).toString();
+  input_size   = query.value(1).toLongLong();
+  input_offset = query.value(2).toLongLong();
+  atl_rows     = query.value(3).toLongLong();
+  btl_rows     = query.value(4).toLongLong();
+  state        = query.value(5).toByteArray();
+  return true;
+}
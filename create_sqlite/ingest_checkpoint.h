@@ -0,0 +1,42 @@
+#ifndef INGEST_CHECKPOINT_H
+#define INGEST_CHECKPOINT_H
+
+// How far an ingest has got, stored in the file being built so that an
+// interrupted ingest can be picked up again with --resume:
+//
+//   CREATE TABLE ingest_progress (id INTEGER PRIMARY KEY, input_file TEXT, input_size INTEGER,
+//                                 input_offset INTEGER, atl_rows INTEGER, btl_rows INTEGER, state BLOB)
+//
+// The row is written in the same transaction as the ballots before
+// input_offset, so the two always agree.  state holds whatever the writer
+// was tallying (the booth dictionary, vote counts, aggregates).  The table
+// is created before anything else in a new file, and dropped when the
+// ingest finishes.  A file is complete if it has no ingest_progress table
+// and has schema_version at the current version (schema_indexes.h), which
+// is written at the end; a file with neither was cut off before it had a
+// checkpoint table, or isn't from this program, and can't be resumed.
+
+#include <QByteArray>
+#include <QSqlDatabase>
+#include <QString>
+
+struct Ingest_checkpoint
+{
+  QString input_file;
+  qint64 input_size   = 0;
+  qint64 input_offset = 0;
+  long long atl_rows  = 0;
+  long long btl_rows  = 0;
+  QByteArray state;
+
+  // Each returns false and sets error on failure.
+  static bool create_table(QSqlDatabase& db, QString& error);
+  static bool drop_table(QSqlDatabase& db, QString& error);
+  static bool exists(QSqlDatabase& db);
+  static bool is_complete(QSqlDatabase& db);
+
+  bool save(QSqlDatabase& db, QString& error) const;
+  bool load(QSqlDatabase& db, QString& error);
+};
+
+#endif // INGEST_CHECKPOINT_H
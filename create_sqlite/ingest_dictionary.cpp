@@ -0,0 +1,255 @@
+#include "ingest_dictionary.h"
+
+#include <cstring>
+
+namespace
+{
+  bool same_bytes(const QByteArray& a, const char* b, int length)
+  {
+    return a.size() == length && memcmp(a.constData(), b, length) == 0;
+  }
+} // namespace
+
+Ingest_dictionary::Ingest_dictionary()
+  : _num_listed_booths(0)
+  , _last_seat_id(-1)
+  , _last_booth_seat_id(-1)
+  , _last_booth_id(-1)
+{
+}
+
+QString Ingest_dictionary::normalise_booth(const QString& raw_booth)
+{
+  // All the declaration-vote collection points in a seat are lumped together.
+  if (raw_booth.startsWith("PRE_POLL"))    { return QString("PRE_POLL"); }
+  if (raw_booth.startsWith("PROVISIONAL")) { return QString("PROVISIONAL"); }
+  if (raw_booth.startsWith("POSTAL"))      { return QString("POSTAL"); }
+  if (raw_booth.startsWith("ABSENT"))      { return QString("ABSENT"); }
+  return raw_booth;
+}
+
+int Ingest_dictionary::add_seat(const QString& seat)
+{
+  const int existing = seat_id(seat);
+  if (existing >= 0)
+  {
+    return existing;
+  }
+
+  const int id = _seats.length();
+  _seats.append(seat);
+  _seat_ids.insert(seat, id);
+  _raw_booth_ids.append(QHash<QByteArray, int>());
+  return id;
+}
+
+int Ingest_dictionary::seat_id(const QString& seat) const
+{
+  return _seat_ids.value(seat, -1);
+}
+
+int Ingest_dictionary::seat_id(const char* raw_seat, int length)
+{
+  if (_last_seat_id >= 0 && same_bytes(_last_raw_seat, raw_seat, length))
+  {
+    return _last_seat_id;
+  }
+
+  // fromRawData() doesn't copy, so a hit costs nothing but the hash.
+  int id = _raw_seat_ids.value(QByteArray::fromRawData(raw_seat, length), -1);
+
+  if (id < 0)
+  {
+    id = seat_id(QString::fromUtf8(raw_seat, length));
+    if (id < 0)
+    {
+      return -1;
+    }
+    _raw_seat_ids.insert(QByteArray(raw_seat, length), id);
+  }
+
+  _last_raw_seat = QByteArray(raw_seat, length);
+  _last_seat_id  = id;
+  return id;
+}
+
+int Ingest_dictionary::num_seats() const
+{
+  return _seats.length();
+}
+
+const QString& Ingest_dictionary::seat_name(int id) const
+{
+  return _seats.at(id);
+}
+
+int Ingest_dictionary::add_listed_booth(int seat_id, const QString& booth)
+{
+  const QString seat_booth(_seats.at(seat_id) + "_" + booth);
+  const int id = _seat_booths.length();
+
+  _seat_booths.append(seat_booth);
+  _booth_seat_ids.append(seat_id);
+
+  // If booths.csv lists the same booth twice, the first one wins.
+  if (!_seat_booth_ids.contains(seat_booth))
+  {
+    _seat_booth_ids.insert(seat_booth, id);
+  }
+
+  _num_listed_booths = _seat_booths.length();
+  return id;
+}
+
+int Ingest_dictionary::add_existing_booth(int seat_id, const QString& seat_booth)
+{
+  const int id = _seat_booths.length();
+
+  _seat_booths.append(seat_booth);
+  _booth_seat_ids.append(seat_id);
+
+  if (!_seat_booth_ids.contains(seat_booth))
+  {
+    _seat_booth_ids.insert(seat_booth, id);
+  }
+
+  _num_listed_booths = _seat_booths.length();
+  return id;
+}
+
+int Ingest_dictionary::booth_id(int seat_id, const char* raw_booth, int length)
+{
+  if (seat_id == _last_booth_seat_id && same_bytes(_last_raw_booth, raw_booth, length))
+  {
+    return _last_booth_id;
+  }
+
+  QHash<QByteArray, int>& raw_ids = _raw_booth_ids[seat_id];
+  const QByteArray raw_key        = QByteArray::fromRawData(raw_booth, length);
+
+  int id = raw_ids.value(raw_key, -1);
+  if (id < 0)
+  {
+    id = _intern_booth(seat_id, QByteArray(raw_booth, length));
+  }
+
+  _last_raw_booth     = QByteArray(raw_booth, length);
+  _last_booth_seat_id = seat_id;
+  _last_booth_id      = id;
+  return id;
+}
+
+int Ingest_dictionary::_intern_booth(int seat_id, const QByteArray& raw_booth)
+{
+  // Only reached the first time a raw booth string is seen in a seat.
+  if (!_normalised_booths.contains(raw_booth))
+  {
+    _normalised_booths.insert(raw_booth, normalise_booth(QString::fromUtf8(raw_booth)));
+  }
+
+  const QString seat_booth(_seats.at(seat_id) + "_" + _normalised_booths.value(raw_booth));
+  int id = _seat_booth_ids.value(seat_booth, -1);
+
+  if (id < 0)
+  {
+    id = _seat_booths.length();
+    _seat_booths.append(seat_booth);
+    _booth_seat_ids.append(seat_id);
+    _seat_booth_ids.insert(seat_booth, id);
+  }
+
+  _raw_booth_ids[seat_id].insert(raw_booth, id);
+  return id;
+}
+
+int Ingest_dictionary::num_booths() const
+{
+  return _seat_booths.length();
+}
+
+int Ingest_dictionary::num_listed_booths() const
+{
+  return _num_listed_booths;
+}
+
+const QString& Ingest_dictionary::booth_name(int id) const
+{
+  return _seat_booths.at(id);
+}
+
+int Ingest_dictionary::booth_seat_id(int id) const
+{
+  return _booth_seat_ids.at(id);
+}
+
+void Ingest_dictionary::add_party(const QString& abbrev, const QString& name, const QString& registered_name)
+{
+  const int i = _party_abbrevs.length();
+  _party_abbrevs.append(abbrev);
+
+  if (!_party_by_name.contains(name))
+  {
+    _party_by_name.insert(name, i);
+  }
+
+  if (!_party_by_registered_name.contains(registered_name))
+  {
+    _party_by_registered_name.insert(registered_name, i);
+  }
+}
+
+int Ingest_dictionary::party_index(const QString& name) const
+{
+  const int i = _party_by_name.value(name, -1);
+  if (i >= 0)
+  {
+    return i;
+  }
+  return _party_by_registered_name.value(name, -1);
+}
+
+const QString& Ingest_dictionary::party_abbrev(int i) const
+{
+  return _party_abbrevs.at(i);
+}
+
+void Ingest_dictionary::save_unlisted_booths(QDataStream& out) const
+{
+  out << static_cast<qint32>(_seat_booths.length() - _num_listed_booths);
+
+  for (int i = _num_listed_booths; i < _seat_booths.length(); i++)
+  {
+    out << static_cast<qint32>(_booth_seat_ids.at(i)) << _seat_booths.at(i);
+  }
+}
+
+bool Ingest_dictionary::restore_unlisted_booths(QDataStream& in)
+{
+  if (_seat_booths.length() != _num_listed_booths)
+  {
+    return false;
+  }
+
+  qint32 num_unlisted;
+  in >> num_unlisted;
+
+  for (int i = 0; i < num_unlisted; i++)
+  {
+    qint32 seat_id;
+    QString seat_booth;
+    in >> seat_id >> seat_booth;
+
+    if (in.status() != QDataStream::Ok || seat_id < 0 || seat_id >= _seats.length())
+    {
+      return false;
+    }
+
+    // The raw-bytes caches fill up again as the prefs file is read, and
+    // _intern_booth() finds these by name.
+    _seat_booth_ids.insert(seat_booth, _seat_booths.length());
+    _seat_booths.append(seat_booth);
+    _booth_seat_ids.append(seat_id);
+  }
+
+  return true;
+}
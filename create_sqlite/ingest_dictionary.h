@@ -0,0 +1,88 @@
+#ifndef INGEST_DICTIONARY_H
+#define INGEST_DICTIONARY_H
+
+// Interns the seat, booth and party strings that the ingest needs to look up
+// over and over again.  Seats and booths get the same ids that are written to
+// the seats and booths tables; lookups are hashed, so the per-ballot cost no
+// longer grows with the number of booths in the state.
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+class Ingest_dictionary
+{
+public:
+  Ingest_dictionary();
+
+  static QString normalise_booth(const QString& raw_booth);
+
+  // ~~~~~~ Seats ~~~~~~
+  int add_seat(const QString& seat);
+  int seat_id(const QString& seat) const;
+  int seat_id(const char* raw_seat, int length);
+  int num_seats() const;
+  const QString& seat_name(int id) const;
+
+  // ~~~~~~ Booths ~~~~~~
+  // Booths are named seat_booth, as in the booths table.  Listed booths come
+  // from booths.csv and are always given a new id (matching the table rows);
+  // booth_id() takes the raw bytes from the prefs file and interns anything
+  // that wasn't listed.
+  int add_listed_booth(int seat_id, const QString& booth);
+
+  // A booth already in the booths table of an earlier ingest, given by its
+  // seat_booth name and added in id order; these count as listed.
+  int add_existing_booth(int seat_id, const QString& seat_booth);
+  int booth_id(int seat_id, const char* raw_booth, int length);
+  int num_booths() const;
+  int num_listed_booths() const;
+  const QString& booth_name(int id) const;
+  int booth_seat_id(int id) const;
+
+  // The booths interned from the prefs file so far, for an ingest
+  // checkpoint; restoring gives them back the same ids.
+  void save_unlisted_booths(QDataStream& out) const;
+  bool restore_unlisted_booths(QDataStream& in);
+
+  // ~~~~~~ Parties ~~~~~~
+  // A party can be found either by its PartyNm or its RegisteredPartyAb;
+  // PartyNm matches take precedence, as they did with the old indexOf() pair.
+  void add_party(const QString& abbrev, const QString& name, const QString& registered_name);
+  int party_index(const QString& name) const;
+  const QString& party_abbrev(int i) const;
+
+private:
+  int _intern_booth(int seat_id, const QByteArray& raw_booth);
+
+  QStringList _seats;
+  QHash<QString, int> _seat_ids;
+  QHash<QByteArray, int> _raw_seat_ids;
+
+  QStringList _seat_booths;
+  QVector<int> _booth_seat_ids;
+  QHash<QString, int> _seat_booth_ids;
+  int _num_listed_booths;
+
+  // Per-seat cache of raw booth bytes (as written in the prefs file)
+  // to booth id, and a cache of the normalisation of each raw booth.
+  QVector<QHash<QByteArray, int>> _raw_booth_ids;
+  QHash<QByteArray, QString> _normalised_booths;
+
+  // The prefs file is sorted by seat and booth, so most lookups are
+  // for the same seat and booth as the previous ballot.
+  QByteArray _last_raw_seat;
+  int _last_seat_id;
+  QByteArray _last_raw_booth;
+  int _last_booth_seat_id;
+  int _last_booth_id;
+
+  QStringList _party_abbrevs;
+  QHash<QString, int> _party_by_name;
+  QHash<QString, int> _party_by_registered_name;
+};
+
+#endif // INGEST_DICTIONARY_H
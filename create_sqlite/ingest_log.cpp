@@ -0,0 +1,79 @@
+#include "ingest_log.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+
+namespace
+{
+  QMutex stdout_mutex;
+}
+
+Ingest_log::Ingest_log(const QString& prefix)
+  : _prefix(prefix)
+  , _stream(&_line)
+{
+}
+
+Ingest_log::~Ingest_log()
+{
+  _stream.flush();
+  if (!_line.isEmpty())
+  {
+    _write_line();
+  }
+}
+
+Ingest_log& Ingest_log::operator<<(QTextStream& (*manipulator)(QTextStream&))
+{
+  Q_UNUSED(manipulator);
+  _stream.flush();
+  _write_line();
+  return *this;
+}
+
+void Ingest_log::_write_line()
+{
+  QMutexLocker locker(&stdout_mutex);
+  QTextStream out(stdout);
+  out << "[" << _prefix << "] " << _line;
+  if (!_line.endsWith("\n"))
+  {
+    out << "\n";
+  }
+  out.flush();
+  _line.clear();
+}
+
+Progress_meter::Progress_meter(qint64 input_size, qint64 start_position, qint64 start_offset, long long start_rows)
+  : _input_size(input_size)
+  , _start_position(start_position)
+  , _start_offset(start_offset)
+  , _start_rows(start_rows)
+{
+  _timer.start();
+}
+
+QString Progress_meter::report(long long rows, qint64 offset, qint64 input_position) const
+{
+  const double seconds = qMax<qint64>(1, _timer.elapsed()) / 1000.;
+  const double rows_per_second = (rows - _start_rows) / seconds;
+  const double mb_per_second   = (offset - _start_offset) / (1024. * 1024. * seconds);
+
+  QString line = QString("%1 rows, %2 rows/s, %3 MB/s")
+                   .arg(rows)
+                   .arg(rows_per_second, 0, 'f', 0)
+                   .arg(mb_per_second, 0, 'f', 1);
+
+  if (_input_size > 0 && input_position > _start_position)
+  {
+    const double fraction = static_cast<double>(input_position) / _input_size;
+    const int eta = qRound(seconds * (_input_size - input_position) / (input_position - _start_position));
+
+    line += QString(", %1% read, ETA %2:%3")
+              .arg(100. * fraction, 0, 'f', 0)
+              .arg(eta / 60)
+              .arg(eta % 60, 2, 10, QChar('0'));
+  }
+
+  return line;
+}
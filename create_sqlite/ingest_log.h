@@ -0,0 +1,55 @@
+#ifndef INGEST_LOG_H
+#define INGEST_LOG_H
+
+// Line-buffered console output for one state's ingest.  Several states can
+// be ingested at once, so each completed line is written to stdout in one
+// go (under a lock) and prefixed with the year and state.
+
+#include <QElapsedTimer>
+#include <QString>
+#include <QTextStream>
+
+class Ingest_log
+{
+public:
+  explicit Ingest_log(const QString& prefix);
+  ~Ingest_log();
+
+  template <typename T>
+  Ingest_log& operator<<(const T& value)
+  {
+    _stream << value;
+    return *this;
+  }
+
+  // endl (or flush) writes out the current line.
+  Ingest_log& operator<<(QTextStream& (*manipulator)(QTextStream&));
+
+private:
+  void _write_line();
+
+  QString _prefix;
+  QString _line;
+  QTextStream _stream;
+};
+
+// Throughput for the progress lines: rows/s and MB/s of (decompressed)
+// prefs file since the pass started, and an ETA from how far through the
+// file on disk the reader is.  A resumed ingest only counts what it has
+// done itself.
+class Progress_meter
+{
+public:
+  Progress_meter(qint64 input_size, qint64 start_position, qint64 start_offset, long long start_rows);
+
+  QString report(long long rows, qint64 offset, qint64 input_position) const;
+
+private:
+  QElapsedTimer _timer;
+  qint64 _input_size;
+  qint64 _start_position;
+  qint64 _start_offset;
+  long long _start_rows;
+};
+
+#endif // INGEST_LOG_H
@@ -0,0 +1,210 @@
+#include "ingest_pipeline.h"
+#include "ballot_parser.h"
+#include "prefs_source.h"
+
+Ballot_batch_queue::Ballot_batch_queue(int capacity)
+  : _next_seq(0)
+  , _num_batches(-1)
+  , _capacity(capacity)
+  , _aborted(false)
+{
+}
+
+bool Ballot_batch_queue::push(Ballot_batch* batch)
+{
+  QMutexLocker locker(&_mutex);
+
+  // The thread holding the batch the writer is waiting for never waits
+  // here, so the pipeline can't deadlock.
+  while (!_aborted && batch->seq >= _next_seq + _capacity)
+  {
+    _space_ready.wait(&_mutex);
+  }
+
+  if (_aborted)
+  {
+    delete batch;
+    return false;
+  }
+
+  _pending.insert(batch->seq, batch);
+  _batch_ready.wakeAll();
+  return true;
+}
+
+Ballot_batch* Ballot_batch_queue::pop_next()
+{
+  QMutexLocker locker(&_mutex);
+
+  while (!_aborted && !_pending.contains(_next_seq))
+  {
+    if (_num_batches >= 0 && _next_seq >= _num_batches)
+    {
+      return nullptr;
+    }
+
+    _batch_ready.wait(&_mutex);
+  }
+
+  if (_aborted)
+  {
+    return nullptr;
+  }
+
+  Ballot_batch* batch = _pending.take(_next_seq);
+  _next_seq++;
+  _space_ready.wakeAll();
+  return batch;
+}
+
+void Ballot_batch_queue::set_num_batches(int num_batches)
+{
+  QMutexLocker locker(&_mutex);
+  _num_batches = num_batches;
+  _batch_ready.wakeAll();
+}
+
+void Ballot_batch_queue::abort()
+{
+  QMutexLocker locker(&_mutex);
+  _aborted = true;
+
+  for (Ballot_batch* batch : _pending)
+  {
+    delete batch;
+  }
+  _pending.clear();
+
+  _batch_ready.wakeAll();
+  _space_ready.wakeAll();
+}
+
+bool Ballot_batch_queue::is_aborted()
+{
+  QMutexLocker locker(&_mutex);
+  return _aborted;
+}
+
+Chunk_feed::Chunk_feed(Prefs_source& source, int chunk_size)
+  : _source(source)
+  , _chunk_size(chunk_size)
+  , _next_seq(0)
+{
+}
+
+bool Chunk_feed::next(Ingest_chunk& chunk, int& seq)
+{
+  QMutexLocker locker(&_mutex);
+
+  if (!_source.next_chunk(chunk, _chunk_size))
+  {
+    return false;
+  }
+
+  seq = _next_seq++;
+  return true;
+}
+
+int Chunk_feed::num_chunks()
+{
+  QMutexLocker locker(&_mutex);
+  return _next_seq;
+}
+
+qint64 Chunk_feed::input_position()
+{
+  QMutexLocker locker(&_mutex);
+  return _source.input_position();
+}
+
+Parse_thread::Parse_thread(Chunk_feed& feed,
+                           Ballot_batch_queue& queue,
+                           int num_atl,
+                           int num_btl,
+                           bool has_state_field,
+                           bool quoted_prefs)
+  : _feed(feed)
+  , _queue(queue)
+  , _num_atl(num_atl)
+  , _num_btl(num_btl)
+  , _has_state_field(has_state_field)
+  , _quoted_prefs(quoted_prefs)
+{
+}
+
+void Parse_thread::run()
+{
+  Ballot_parser parser(_num_atl, _num_btl, _has_state_field, _quoted_prefs);
+  Ingest_chunk chunk;
+  int seq;
+
+  while (!_queue.is_aborted())
+  {
+    if (!_feed.next(chunk, seq))
+    {
+      // Every thread gets here at the end; they all agree on the count.
+      _queue.set_num_batches(_feed.num_chunks());
+      return;
+    }
+
+    Ballot_batch* batch = new Ballot_batch;
+    batch->seq          = seq;
+    batch->buffer       = chunk.buffer;
+    batch->end_offset   = chunk.end_offset;
+
+    const char* line_end;
+    const char* p = chunk.begin;
+
+    while (p < chunk.end)
+    {
+      const char* line_begin = p;
+      p                      = Ballot_parser::next_line(line_begin, chunk.end, line_end);
+
+      if (line_end == line_begin)
+      {
+        continue;
+      }
+
+      if (!parser.parse_line(line_begin, line_end))
+      {
+        batch->parse_error = true;
+        batch->error_line  = QByteArray(line_begin, line_end - line_begin);
+        break;
+      }
+
+      const int max_prefs = parser.max_prefs();
+
+      Parsed_ballot ballot;
+      ballot.seat              = parser.seat();
+      ballot.seat_length       = parser.seat_length();
+      ballot.booth             = parser.booth();
+      ballot.booth_length      = parser.booth_length();
+      ballot.table             = parser.table();
+      ballot.num_valid_prefs   = parser.num_valid_prefs();
+      ballot.first_duplicate   = parser.first_duplicate();
+      ballot.first_gap         = parser.first_gap();
+      ballot.num_unreadable    = parser.num_unreadable();
+      ballot.num_marked        = parser.num_marked();
+      ballot.btl_marks_ignored = parser.btl_marks_ignored();
+      ballot.prefs_offset      = batch->prefs.size();
+
+      batch->prefs.insert(batch->prefs.end(), parser.prefs_ordered(), parser.prefs_ordered() + max_prefs);
+      batch->prefs.insert(batch->prefs.end(), parser.prefs_for(), parser.prefs_for() + max_prefs);
+      batch->ballots.push_back(ballot);
+    }
+
+    if (!_queue.push(batch))
+    {
+      return;
+    }
+  }
+}
+
+namespace Ingest_pipeline
+{
+  int default_num_threads()
+  {
+    // Leave a core for the writer.
+    return qMax(1, QThread::idealThreadCount() - 1);
+  }
+} // namespace Ingest_pipeline
@@ -0,0 +1,152 @@
+#ifndef INGEST_PIPELINE_H
+#define INGEST_PIPELINE_H
+
+// Parallel parsing of the prefs file.
+//
+// The prefs file is cut into newline-aligned chunks (see Prefs_source),
+// which a pool of Parse_thread's turn into Ballot_batch'es.  The batches are handed back
+// through a Ballot_batch_queue strictly in file order, so the single writer
+// (which owns the SQLite connection and the transaction) sees the ballots in
+// exactly the order a serial pass would, and assigns the same row ids and
+// booth ids.
+
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+#include <QByteArray>
+#include <QMap>
+#include <vector>
+
+class Prefs_source;
+
+struct Ingest_chunk
+{
+  const char* begin;
+  const char* end;
+
+  // Holds the bytes when they've been decompressed rather than mapped.
+  QByteArray buffer;
+
+  // Offset in the (decompressed) prefs file just past the chunk, which is
+  // where a resumed ingest starts again.
+  qint64 end_offset;
+};
+
+struct Parsed_ballot
+{
+  const char* seat;
+  int seat_length;
+  const char* booth;
+  int booth_length;
+  int table;
+  int num_valid_prefs;
+
+  // See Ballot_parser::first_duplicate() etc.
+  int first_duplicate;
+  int first_gap;
+  int num_unreadable;
+  int num_marked;
+  bool btl_marks_ignored;
+
+  // Offset into Ballot_batch::prefs of max_prefs P values followed by
+  // max_prefs Pfor values.
+  int prefs_offset;
+};
+
+struct Ballot_batch
+{
+  int seq = -1;
+
+  // Keeps the chunk's bytes alive while the ballots point into them.
+  QByteArray buffer;
+  qint64 end_offset = 0;
+
+  std::vector<Parsed_ballot> ballots;
+  std::vector<int> prefs;
+  bool parse_error = false;
+  QByteArray error_line;
+};
+
+class Ballot_batch_queue
+{
+public:
+  explicit Ballot_batch_queue(int capacity);
+
+  // Blocks while the batch is more than capacity ahead of the writer.
+  // Returns false if the queue has been aborted.
+  bool push(Ballot_batch* batch);
+
+  // Blocks until the next batch in file order is ready.  Returns nullptr
+  // once every batch has been taken, or if the queue has been aborted.
+  Ballot_batch* pop_next();
+
+  // Called once the number of batches is known, i.e. when the source has
+  // run out of chunks.
+  void set_num_batches(int num_batches);
+
+  void abort();
+  bool is_aborted();
+
+private:
+  QMutex _mutex;
+  QWaitCondition _batch_ready;
+  QWaitCondition _space_ready;
+  QMap<int, Ballot_batch*> _pending;
+  int _next_seq;
+  int _num_batches;
+  int _capacity;
+  bool _aborted;
+};
+
+// Hands the source's chunks out to the parse threads, numbered in file
+// order.  Reading (and decompressing) is done under the lock, one chunk at
+// a time.
+class Chunk_feed
+{
+public:
+  Chunk_feed(Prefs_source& source, int chunk_size);
+
+  // Returns false once the source is exhausted or has failed.
+  bool next(Ingest_chunk& chunk, int& seq);
+
+  // The number of chunks handed out so far.
+  int num_chunks();
+
+  // See Prefs_source::input_position().
+  qint64 input_position();
+
+private:
+  QMutex _mutex;
+  Prefs_source& _source;
+  int _chunk_size;
+  int _next_seq;
+};
+
+class Parse_thread : public QThread
+{
+public:
+  Parse_thread(Chunk_feed& feed,
+               Ballot_batch_queue& queue,
+               int num_atl,
+               int num_btl,
+               bool has_state_field,
+               bool quoted_prefs);
+
+protected:
+  void run() override;
+
+private:
+  Chunk_feed& _feed;
+  Ballot_batch_queue& _queue;
+  int _num_atl;
+  int _num_btl;
+  bool _has_state_field;
+  bool _quoted_prefs;
+};
+
+namespace Ingest_pipeline
+{
+  int default_num_threads();
+} // namespace Ingest_pipeline
+
+#endif // INGEST_PIPELINE_H
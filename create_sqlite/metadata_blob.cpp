@@ -0,0 +1,366 @@
+#include "metadata_blob.h"
+
+#include <QDataStream>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QVariant>
+
+namespace
+{
+  // Reads a string index and looks it up; an index out of range sets the
+  // stream's status, like any other bad read.
+  QString read_string(QDataStream& in, const QStringList& strings)
+  {
+    qint32 id = -1;
+    in >> id;
+
+    if (id < 0 || id >= strings.length())
+    {
+      in.setStatus(QDataStream::ReadCorruptData);
+      return QString();
+    }
+
+    return strings.at(id);
+  }
+
+  // A count, which can't be more than there are bytes left.
+  qint32 read_count(QDataStream& in, int size)
+  {
+    qint32 n = -1;
+    in >> n;
+
+    if (n < 0 || n > size)
+    {
+      in.setStatus(QDataStream::ReadCorruptData);
+      return 0;
+    }
+
+    return n;
+  }
+} // namespace
+
+namespace Metadata_blob
+{
+  qint32 String_table::id(const QString& s)
+  {
+    auto it = _ids.constFind(s);
+    if (it != _ids.constEnd())
+    {
+      return it.value();
+    }
+
+    const qint32 id = _strings.length();
+    _ids.insert(s, id);
+    _strings.append(s);
+    return id;
+  }
+
+  Booth_type booth_type(const QString& booth)
+  {
+    if (booth.contains("PPVC") || booth.contains("PREPOLL", Qt::CaseInsensitive))
+    {
+      return PRE_POLL;
+    }
+
+    if (booth.contains("Sydney (") || booth.contains("Adelaide (") || booth.contains("Perth (") || booth.contains("Brisbane City (") ||
+        booth.contains("Hobart (") || booth.contains("Melbourne ("))
+    {
+      return OTHER;
+    }
+
+    return ELECTION_DAY;
+  }
+
+  bool read_tables(QSqlDatabase& db, Contents& contents, QString& error)
+  {
+    QSqlQuery query(db);
+    contents = Contents();
+
+    // ~~~~~ State and totals ~~~~~
+    if (!query.exec("SELECT state, state_full, year, formal_votes, atl_votes, btl_votes FROM basic_info WHERE id = 0") || !query.next())
+    {
+      error = QString("Couldn't read basic_info for the metadata: %1").arg(query.lastError().text());
+      return false;
+    }
+
+    contents.state        = query.value(0).toString();
+    contents.state_full   = query.value(1).toString();
+    contents.year         = query.value(2).toInt();
+    contents.formal_votes = query.value(3).toInt();
+    contents.atl_votes    = query.value(4).toInt();
+    contents.btl_votes    = query.value(5).toInt();
+
+    // ~~~~~ Groups ~~~~~
+    if (!query.exec("SELECT party, party_ab FROM groups ORDER BY id"))
+    {
+      error = QString("Couldn't read groups for the metadata: %1").arg(query.lastError().text());
+      return false;
+    }
+
+    while (query.next())
+    {
+      contents.groups.append(query.value(0).toString());
+      contents.groups_short.append(query.value(1).toString());
+    }
+
+    // ~~~~~ Candidates ~~~~~
+    if (!query.exec("SELECT party_ab, group_letter, group_pos, candidate FROM candidates ORDER BY id"))
+    {
+      error = QString("Couldn't read candidates for the metadata: %1").arg(query.lastError().text());
+      return false;
+    }
+
+    qint32 group = -1;
+
+    while (query.next())
+    {
+      const QString party = query.value(1).toString() == "UG" ? QString("UG") : query.value(0).toString();
+      const int group_pos = query.value(2).toInt();
+
+      // "SURNAME, Given Names" goes over two lines in the explorer's headers.
+      QString name        = query.value(3).toString();
+      const int comma_pos = name.indexOf(",");
+      if (comma_pos >= 0)
+      {
+        name.replace(comma_pos, comma_pos == name.indexOf(", ") ? 2 : 1, ",\n");
+      }
+
+      if (group_pos == 1)
+      {
+        group++;
+      }
+
+      contents.candidates.append(name);
+      contents.candidates_short.append(QString("%1_%2").arg(party).arg(group_pos));
+      contents.group_of_candidate.append(group);
+    }
+
+    // ~~~~~ Divisions ~~~~~
+    if (!query.exec("SELECT seat, formal_votes FROM seats ORDER BY id"))
+    {
+      error = QString("Couldn't read seats for the metadata: %1").arg(query.lastError().text());
+      return false;
+    }
+
+    while (query.next())
+    {
+      contents.divisions.append(query.value(0).toString());
+      contents.division_votes.append(query.value(1).toInt());
+
+      // Set so that the division's first booth replaces them.
+      contents.bboxes << 180. << 0. << 0. << -80.;
+    }
+
+    // ~~~~~ Booths, and the divisions' bounding boxes ~~~~~
+    if (!query.exec("SELECT id, seat, booth, lon, lat, formal_votes FROM booths ORDER BY id"))
+    {
+      error = QString("Couldn't read booths for the metadata: %1").arg(query.lastError().text());
+      return false;
+    }
+
+    while (query.next())
+    {
+      Booth booth;
+      booth.booth        = query.value(2).toString();
+      booth.division     = contents.divisions.indexOf(query.value(1).toString());
+      booth.longitude    = query.value(3).toDouble();
+      booth.latitude     = query.value(4).toDouble();
+      booth.formal_votes = query.value(5).toInt();
+      booth.type         = booth_type(booth.booth);
+
+      if (query.value(0).toInt() != contents.booths.length() || booth.division < 0)
+      {
+        error = QString("Couldn't write the metadata: booth %1 (%2) is out of order or has no division").arg(contents.booths.length()).arg(booth.booth);
+        return false;
+      }
+
+      if (booth.type == ELECTION_DAY && booth.latitude < -1. && booth.longitude > 1. && booth.formal_votes > 0)
+      {
+        double* bbox = contents.bboxes.data() + 4 * booth.division;
+        bbox[0]      = qMin(bbox[0], booth.longitude);
+        bbox[1]      = qMax(bbox[1], booth.longitude);
+        bbox[2]      = qMin(bbox[2], booth.latitude);
+        bbox[3]      = qMax(bbox[3], booth.latitude);
+      }
+
+      contents.booths.append(booth);
+    }
+
+    return true;
+  }
+
+  QByteArray encode_body(const Contents& contents, String_table& strings)
+  {
+    QByteArray body;
+    QDataStream out(&body, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_6);
+
+    out << strings.id(contents.state) << strings.id(contents.state_full);
+    out << contents.year << contents.formal_votes << contents.atl_votes << contents.btl_votes;
+
+    out << static_cast<qint32>(contents.groups.length());
+    for (int i = 0; i < contents.groups.length(); i++)
+    {
+      out << strings.id(contents.groups.at(i)) << strings.id(contents.groups_short.at(i));
+    }
+
+    out << static_cast<qint32>(contents.candidates.length());
+    for (int i = 0; i < contents.candidates.length(); i++)
+    {
+      out << strings.id(contents.candidates.at(i)) << strings.id(contents.candidates_short.at(i)) << contents.group_of_candidate.at(i);
+    }
+
+    out << static_cast<qint32>(contents.divisions.length());
+    for (int i = 0; i < contents.divisions.length(); i++)
+    {
+      out << strings.id(contents.divisions.at(i)) << contents.division_votes.at(i);
+      for (int j = 0; j < 4; j++)
+      {
+        out << contents.bboxes.at(4 * i + j);
+      }
+    }
+
+    out << static_cast<qint32>(contents.booths.length());
+    for (const Booth& booth : contents.booths)
+    {
+      out << strings.id(booth.booth) << booth.division << booth.longitude << booth.latitude << booth.formal_votes << booth.type;
+    }
+
+    return body;
+  }
+
+  bool decode_body(const QByteArray& body, const QStringList& strings, Contents& contents)
+  {
+    QDataStream in(body);
+    in.setVersion(QDataStream::Qt_5_6);
+    contents = Contents();
+
+    contents.state      = read_string(in, strings);
+    contents.state_full = read_string(in, strings);
+    in >> contents.year >> contents.formal_votes >> contents.atl_votes >> contents.btl_votes;
+
+    const qint32 num_groups = read_count(in, body.size());
+    for (qint32 i = 0; i < num_groups && in.status() == QDataStream::Ok; i++)
+    {
+      contents.groups.append(read_string(in, strings));
+      contents.groups_short.append(read_string(in, strings));
+    }
+
+    const qint32 num_candidates = read_count(in, body.size());
+    for (qint32 i = 0; i < num_candidates && in.status() == QDataStream::Ok; i++)
+    {
+      qint32 group = -1;
+      contents.candidates.append(read_string(in, strings));
+      contents.candidates_short.append(read_string(in, strings));
+      in >> group;
+      contents.group_of_candidate.append(group);
+    }
+
+    const qint32 num_divisions = read_count(in, body.size());
+    for (qint32 i = 0; i < num_divisions && in.status() == QDataStream::Ok; i++)
+    {
+      qint32 votes = 0;
+      contents.divisions.append(read_string(in, strings));
+      in >> votes;
+      contents.division_votes.append(votes);
+
+      for (int j = 0; j < 4; j++)
+      {
+        double x = 0.;
+        in >> x;
+        contents.bboxes.append(x);
+      }
+    }
+
+    const qint32 num_booths = read_count(in, body.size());
+    for (qint32 i = 0; i < num_booths && in.status() == QDataStream::Ok; i++)
+    {
+      Booth booth;
+      booth.booth = read_string(in, strings);
+      in >> booth.division >> booth.longitude >> booth.latitude >> booth.formal_votes >> booth.type;
+      contents.booths.append(booth);
+    }
+
+    return in.status() == QDataStream::Ok;
+  }
+
+  bool write(QSqlDatabase& db, QString& error)
+  {
+    Contents contents;
+    if (!read_tables(db, contents, error))
+    {
+      return false;
+    }
+
+    String_table strings;
+    const QByteArray body = encode_body(contents, strings);
+
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_6);
+    out << strings.strings() << body;
+
+    if (out.status() != QDataStream::Ok)
+    {
+      error = "Couldn't serialise the metadata";
+      return false;
+    }
+
+    QSqlQuery query(db);
+    db.transaction();
+
+    if (!query.exec("DROP TABLE IF EXISTS metadata_blob") ||
+        !query.exec("CREATE TABLE metadata_blob (id INTEGER PRIMARY KEY, version INTEGER, data BLOB)") ||
+        !query.prepare("INSERT INTO metadata_blob VALUES (0, ?, ?)"))
+    {
+      error = QString("Couldn't create metadata_blob: %1").arg(query.lastError().text());
+      db.rollback();
+      return false;
+    }
+
+    query.addBindValue(VERSION);
+    query.addBindValue(qCompress(data));
+
+    if (!query.exec())
+    {
+      error = QString("Couldn't write metadata_blob: %1").arg(query.lastError().text());
+      db.rollback();
+      return false;
+    }
+
+    if (!db.commit())
+    {
+      error = "Couldn't commit metadata_blob";
+      return false;
+    }
+
+    return true;
+  }
+
+  bool read(QSqlDatabase& db, Contents& contents, QString& error)
+  {
+    QSqlQuery query(db);
+
+    if (!query.exec("SELECT version, data FROM metadata_blob WHERE id = 0") || !query.next() || query.value(0).toInt() != VERSION)
+    {
+      error = QString("%1 has no metadata_blob of version %2").arg(db.databaseName()).arg(VERSION);
+      return false;
+    }
+
+    const QByteArray data = qUncompress(query.value(1).toByteArray());
+    QDataStream in(data);
+    in.setVersion(QDataStream::Qt_5_6);
+
+    QStringList strings;
+    QByteArray body;
+    in >> strings >> body;
+
+    if (in.status() != QDataStream::Ok || !decode_body(body, strings, contents))
+    {
+      error = QString("The metadata_blob in %1 is corrupt").arg(db.databaseName());
+      return false;
+    }
+
+    return true;
+  }
+} // namespace Metadata_blob
@@ -0,0 +1,114 @@
+#ifndef METADATA_BLOB_H
+#define METADATA_BLOB_H
+
+// Everything the explorer needs when it opens a file, apart from the
+// ballots themselves: the state and vote totals, the group and candidate
+// names, the divisions and their bounding boxes, and the booths.  It's
+// read back from the tables already written and stored as a single blob,
+//
+//   CREATE TABLE metadata_blob (id INTEGER PRIMARY KEY, version INTEGER, data BLOB)
+//
+// so the explorer can fetch it with one query and unpack it on its loading
+// thread, instead of querying each table and reworking the names and
+// booth coordinates itself.  The data is qCompress()ed, and inside it is a
+// QDataStream (Qt_5_6) of QStringList strings and QByteArray body, where
+// the body is another QDataStream of the fields below, with each string
+// given as its qint32 index in strings:
+//
+//   string state, state_full; qint32 year, formal_votes, atl_votes, btl_votes
+//   qint32 num_groups, then each group's name and short name ("ALP")
+//   qint32 num_candidates, then each candidate's name, as displayed
+//     ("SURNAME,\nGiven Names"), short name ("ALP_1") and qint32 group
+//   qint32 num_divisions, then each division's name, qint32 formal votes,
+//     and double bounding box from its election-day booths: min and max
+//     longitude, then min and max latitude
+//   qint32 num_booths, then for each booth (in id order):
+//     string booth; qint32 division; double longitude, latitude;
+//     qint32 formal_votes; quint8 Booth_type
+//
+// The strings are kept apart from the body so that an election archive
+// (election_archive.h) can share one table of strings between all the
+// elections in it, since the same parties, divisions and booths come up
+// again and again.
+
+#include <QByteArray>
+#include <QHash>
+#include <QSqlDatabase>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+namespace Metadata_blob
+{
+  const int VERSION = 1;
+
+  enum Booth_type
+  {
+    ELECTION_DAY = 0,
+    PRE_POLL     = 1,
+    OTHER        = 2 // e.g. the divisional offices' collections
+  };
+
+  struct Booth
+  {
+    QString booth;
+    qint32 division     = 0;
+    double longitude    = 0.;
+    double latitude     = 0.;
+    qint32 formal_votes = 0;
+    quint8 type         = ELECTION_DAY;
+  };
+
+  struct Contents
+  {
+    QString state;
+    QString state_full;
+    qint32 year         = 0;
+    qint32 formal_votes = 0;
+    qint32 atl_votes    = 0;
+    qint32 btl_votes    = 0;
+    QStringList groups;
+    QStringList groups_short;
+    QStringList candidates;
+    QStringList candidates_short;
+    QVector<qint32> group_of_candidate;
+    QStringList divisions;
+    QVector<qint32> division_votes;
+    QVector<double> bboxes; // Four per division
+    QVector<Booth> booths;
+  };
+
+  // Gives each distinct string an index, in order of first use.
+  class String_table
+  {
+  public:
+    qint32 id(const QString& s);
+    const QStringList& strings() const { return _strings; }
+
+  private:
+    QHash<QString, qint32> _ids;
+    QStringList _strings;
+  };
+
+  // Booth_type from the booth's name.
+  Booth_type booth_type(const QString& booth);
+
+  // Reads basic_info, groups, candidates, seats and booths.  Returns false
+  // and sets error on failure.
+  bool read_tables(QSqlDatabase& db, Contents& contents, QString& error);
+
+  // The body, adding its strings to strings; and back.  decode_body()
+  // returns false if the body is corrupt.
+  QByteArray encode_body(const Contents& contents, String_table& strings);
+  bool decode_body(const QByteArray& body, const QStringList& strings, Contents& contents);
+
+  // Reads the tables and (re)writes metadata_blob from them.  Returns false
+  // and sets error on failure.
+  bool write(QSqlDatabase& db, QString& error);
+
+  // Reads metadata_blob back.  Returns false and sets error if the file
+  // doesn't have one of this version.
+  bool read(QSqlDatabase& db, Contents& contents, QString& error);
+} // namespace Metadata_blob
+
+#endif // METADATA_BLOB_H
@@ -0,0 +1,144 @@
+#include "national_data.h"
+
+#include <QDir>
+#include <QFile>
+#include <QTextStream>
+
+bool National_data::load(const QString& aec_dir, const QString& year_, QString& error)
+{
+  year = year_;
+  booths_by_state.clear();
+  parties.clear();
+  primaries_by_state.clear();
+
+  const QDir dir(aec_dir);
+
+  QFile in_booths(dir.filePath(year + "_booths.csv"));
+
+  if (in_booths.open(QIODevice::ReadOnly))
+  {
+    QTextStream in(&in_booths);
+    in.readLine();
+    in.readLine();
+
+    while (!in.atEnd())
+    {
+      QString line = in.readLine();
+      QStringList cells = line.split(",");
+
+      if (cells.length() < 6)
+      {
+        continue;
+      }
+
+      booths_by_state[cells.at(0).toLower()].append(cells);
+    }
+
+    in_booths.close();
+  }
+  else
+  {
+    error = QString("Couldn't open booths file %1").arg(in_booths.fileName());
+    return false;
+  }
+
+  // The official list of party abbreviations.  This one is optional: groups
+  // without a matching party just get "Group X" names.
+  QFile in_parties(dir.filePath(year + "_parties.csv"));
+
+  if (in_parties.open(QIODevice::ReadOnly))
+  {
+    QTextStream in(&in_parties);
+    in.readLine();
+    in.readLine();
+
+    while (!in.atEnd())
+    {
+      QString line = in.readLine();
+      QStringList cells = line.split(",");
+
+      if (line.indexOf("\"") >= 0)
+      {
+        cells = split_ignoring_quotes(line);
+      }
+
+      if (cells.length() < 4)
+      {
+        continue;
+      }
+
+      parties.append(cells);
+    }
+
+    if (year == "2019")
+    {
+      parties.append(QStringList() << "" << "LPNP" << "Liberal & Nationals" << "Liberal & Nationals");
+      parties.append(QStringList() << "" << "ALP" << "Labor/Country Labor" << "Labor/Country Labor");
+    }
+
+    in_parties.close();
+  }
+
+  QFile in_primaries(dir.filePath(year + "_primaries.csv"));
+
+  if (in_primaries.open(QIODevice::ReadOnly))
+  {
+    QTextStream in(&in_primaries);
+    in.readLine();
+    in.readLine();
+
+    while (!in.atEnd())
+    {
+      QString line = in.readLine();
+      QStringList cells = split_ignoring_quotes(line);
+
+      if (cells.length() < 6)
+      {
+        continue;
+      }
+
+      primaries_by_state[cells.at(0).toLower()].append(cells);
+    }
+
+    in_primaries.close();
+  }
+  else
+  {
+    error = QString("Couldn't open primaries file %1").arg(in_primaries.fileName());
+    return false;
+  }
+
+  return true;
+}
+
+QStringList split_ignoring_quotes(QString text)
+{
+  // At least in my version of Qt, regexes with ?s don't 
+  // work properly, so I wrote this slow splitter to handle
+  // quotation marks.
+  
+  int num_chars = text.length();
+  bool in_quotes = false;
+  QStringList cells;
+  int start = 0;
+  
+  for (int i = 0; i < num_chars; i++)
+  {
+    QString this_char = text.mid(i, 1);
+    if (this_char == "\"")
+    {
+      in_quotes = !in_quotes;
+    }
+    else
+    {
+      if (!in_quotes && this_char == ",")
+      {
+        cells.append(text.mid(start, i - start).replace('"', ""));
+        start = i + 1;
+      }
+    }
+  }
+  
+  cells.append(text.mid(start, num_chars - start).replace('"', ""));
+  return cells;
+}
@@ -0,0 +1,34 @@
+#ifndef NATIONAL_DATA_H
+#define NATIONAL_DATA_H
+
+// The AEC's national files for one election year (booths, parties and
+// primaries), read once and shared by every state ingested for that year.
+// Rows are kept as the split cells of each line, grouped by lower-case
+// state abbreviation.
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+struct National_data
+{
+  QString year;
+
+  // booths.csv, split on commas.
+  QHash<QString, QVector<QStringList>> booths_by_state;
+
+  // parties.csv, split ignoring quotes: PartyAb is cell 1, RegisteredPartyAb
+  // cell 2, PartyNm cell 3.
+  QVector<QStringList> parties;
+
+  // primaries.csv, split ignoring quotes.
+  QHash<QString, QVector<QStringList>> primaries_by_state;
+
+  // Returns false and sets error if a required file can't be read.
+  bool load(const QString& aec_dir, const QString& year, QString& error);
+};
+
+QStringList split_ignoring_quotes(QString text);
+
+#endif // NATIONAL_DATA_H
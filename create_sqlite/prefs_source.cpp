@@ -0,0 +1,502 @@
+#include "prefs_source.h"
+#include "ballot_parser.h"
+
+#include <QFileInfo>
+#include <QtEndian>
+
+#include <cstring>
+#include <zlib.h>
+
+Prefs_source* Prefs_source::open(const QString& path, QString& error)
+{
+  Prefs_source* source;
+
+  if (path.endsWith(".gz", Qt::CaseInsensitive))
+  {
+    source = new Gzip_prefs_source(path);
+  }
+  else if (path.endsWith(".zip", Qt::CaseInsensitive))
+  {
+    source = new Zip_prefs_source(path);
+  }
+  else
+  {
+    source = new Mapped_prefs_source(path);
+  }
+
+  if (source->has_error())
+  {
+    error = source->error();
+    delete source;
+    return nullptr;
+  }
+
+  return source;
+}
+
+QStringList Prefs_source::file_names(const QString& base_name)
+{
+  return QStringList() << base_name + ".csv" << base_name + ".csv.gz" << base_name + ".zip";
+}
+
+Prefs_source::Prefs_source()
+  : _input_size(0)
+  , _header_lines(0)
+  , _offset(0)
+{
+}
+
+Prefs_source::~Prefs_source()
+{
+}
+
+void Prefs_source::set_header_lines(int num_lines)
+{
+  _header_lines = num_lines;
+}
+
+bool Prefs_source::next_chunk(Ingest_chunk& chunk, int chunk_size)
+{
+  if (!_error.isEmpty() || !_read_chunk(chunk, chunk_size))
+  {
+    return false;
+  }
+
+  _offset         += chunk.end - chunk.begin;
+  chunk.end_offset = _offset;
+
+  // The header lines are always in the first chunk.
+  const char* line_end;
+  for (; _header_lines > 0 && chunk.begin < chunk.end; _header_lines--)
+  {
+    chunk.begin = Ballot_parser::next_line(chunk.begin, chunk.end, line_end);
+  }
+
+  return true;
+}
+
+bool Prefs_source::skip_to(qint64 offset)
+{
+  _header_lines = 0;
+
+  if (!_skip(offset - _offset))
+  {
+    _set_error(QString("Couldn't skip to offset %1 in the prefs file").arg(offset));
+    return false;
+  }
+
+  _offset = offset;
+  return true;
+}
+
+qint64 Prefs_source::input_size() const
+{
+  return _input_size;
+}
+
+bool Prefs_source::has_error() const
+{
+  return !_error.isEmpty();
+}
+
+QString Prefs_source::error() const
+{
+  return _error;
+}
+
+void Prefs_source::_set_error(const QString& error)
+{
+  if (_error.isEmpty())
+  {
+    _error = error;
+  }
+}
+
+
+Mapped_prefs_source::Mapped_prefs_source(const QString& path)
+  : _file(path)
+  , _mapped(nullptr)
+  , _p(nullptr)
+  , _end(nullptr)
+{
+  if (!_file.open(QIODevice::ReadOnly))
+  {
+    _set_error("Couldn't open prefs file " + path);
+    return;
+  }
+
+  const qint64 file_size = _file.size();
+  _mapped = file_size > 0 ? _file.map(0, file_size) : nullptr;
+
+  if (_mapped == nullptr)
+  {
+    _set_error("Couldn't map prefs file " + path);
+    return;
+  }
+
+  _p          = reinterpret_cast<const char*>(_mapped);
+  _end        = _p + file_size;
+  _input_size = file_size;
+}
+
+Mapped_prefs_source::~Mapped_prefs_source()
+{
+  if (_mapped != nullptr)
+  {
+    _file.unmap(_mapped);
+  }
+}
+
+qint64 Mapped_prefs_source::input_position() const
+{
+  return _p - reinterpret_cast<const char*>(_mapped);
+}
+
+bool Mapped_prefs_source::_skip(qint64 length)
+{
+  if (length < 0 || length > _end - _p)
+  {
+    return false;
+  }
+
+  _p += length;
+  return true;
+}
+
+bool Mapped_prefs_source::_read_chunk(Ingest_chunk& chunk, int chunk_size)
+{
+  if (_p >= _end)
+  {
+    return false;
+  }
+
+  const char* chunk_end = (_end - _p > chunk_size) ? _p + chunk_size : _end;
+
+  if (chunk_end < _end)
+  {
+    const char* nl = static_cast<const char*>(memchr(chunk_end, '\n', _end - chunk_end));
+    chunk_end      = nl == nullptr ? _end : nl + 1;
+  }
+
+  chunk.begin  = _p;
+  chunk.end    = chunk_end;
+  chunk.buffer = QByteArray();
+
+  _p = chunk_end;
+  return true;
+}
+
+
+Stream_prefs_source::Stream_prefs_source()
+  : _at_end(false)
+{
+}
+
+bool Stream_prefs_source::_read_chunk(Ingest_chunk& chunk, int chunk_size)
+{
+  if (_at_end && _carry.isEmpty())
+  {
+    return false;
+  }
+
+  // Each chunk gets its own buffer, since the parsed ballots point into it
+  // until the writer is done with them.
+  QByteArray buffer;
+  buffer.resize(_carry.size() + chunk_size);
+  memcpy(buffer.data(), _carry.constData(), _carry.size());
+
+  int filled       = _carry.size();
+  int search_from  = filled;
+  int chunk_length = -1;
+
+  while (chunk_length < 0)
+  {
+    while (!_at_end && filled < buffer.size())
+    {
+      const int n = _read(buffer.data() + filled, buffer.size() - filled);
+
+      if (n < 0)
+      {
+        return false;
+      }
+
+      if (n == 0)
+      {
+        _at_end = true;
+      }
+
+      filled += n;
+    }
+
+    if (_at_end)
+    {
+      chunk_length = filled;
+    }
+    else
+    {
+      // Cut after the last newline; a line longer than the whole buffer
+      // just makes the buffer bigger.
+      for (int i = filled - 1; i >= search_from; i--)
+      {
+        if (buffer.at(i) == '\n')
+        {
+          chunk_length = i + 1;
+          break;
+        }
+      }
+
+      if (chunk_length < 0)
+      {
+        search_from = filled;
+        buffer.resize(buffer.size() + chunk_size);
+      }
+    }
+  }
+
+  _carry = QByteArray(buffer.constData() + chunk_length, filled - chunk_length);
+  buffer.resize(chunk_length);
+
+  if (chunk_length == 0)
+  {
+    return false;
+  }
+
+  chunk.buffer = buffer;
+  chunk.begin  = chunk.buffer.constData();
+  chunk.end    = chunk.begin + chunk_length;
+  return true;
+}
+
+
+bool Stream_prefs_source::_skip(qint64 length)
+{
+  if (length < 0 || !_carry.isEmpty())
+  {
+    return false;
+  }
+
+  QByteArray scratch;
+  scratch.resize(1024 * 1024);
+
+  while (length > 0)
+  {
+    const int n = _read(scratch.data(), static_cast<int>(qMin<qint64>(length, scratch.size())));
+
+    if (n <= 0)
+    {
+      return false;
+    }
+
+    length -= n;
+  }
+
+  return true;
+}
+
+
+Gzip_prefs_source::Gzip_prefs_source(const QString& path)
+  : _gz(nullptr)
+{
+  _gz = gzopen(QFile::encodeName(path).constData(), "rb");
+
+  if (_gz == nullptr)
+  {
+    _set_error("Couldn't open prefs file " + path);
+    return;
+  }
+
+  gzbuffer(_gz, 1024 * 1024);
+  _input_size = QFileInfo(path).size();
+}
+
+Gzip_prefs_source::~Gzip_prefs_source()
+{
+  if (_gz != nullptr)
+  {
+    gzclose(_gz);
+  }
+}
+
+qint64 Gzip_prefs_source::input_position() const
+{
+  return gzoffset(_gz);
+}
+
+int Gzip_prefs_source::_read(char* out, int max_length)
+{
+  const int n = gzread(_gz, out, static_cast<unsigned>(max_length));
+
+  if (n < 0)
+  {
+    int errnum;
+    _set_error(QString("Couldn't decompress prefs file: %1").arg(gzerror(_gz, &errnum)));
+    return -1;
+  }
+
+  return n;
+}
+
+
+Zip_prefs_source::Zip_prefs_source(const QString& path)
+  : _file(path)
+  , _stream(nullptr)
+  , _deflated(false)
+  , _stream_end(false)
+  , _stored_remaining(0)
+{
+  if (!_file.open(QIODevice::ReadOnly))
+  {
+    _set_error("Couldn't open prefs file " + path);
+    return;
+  }
+
+  _input_size = _file.size();
+
+  if (!_read_local_header())
+  {
+    return;
+  }
+
+  if (_deflated)
+  {
+    _stream = new z_stream;
+    memset(_stream, 0, sizeof(z_stream));
+
+    // Negative window bits: raw deflate data, with no zlib header.
+    if (inflateInit2(_stream, -MAX_WBITS) != Z_OK)
+    {
+      delete _stream;
+      _stream = nullptr;
+      _set_error("Couldn't start inflating " + path);
+    }
+  }
+}
+
+Zip_prefs_source::~Zip_prefs_source()
+{
+  if (_stream != nullptr)
+  {
+    inflateEnd(_stream);
+    delete _stream;
+  }
+}
+
+qint64 Zip_prefs_source::input_position() const
+{
+  return _file.pos();
+}
+
+bool Zip_prefs_source::_read_local_header()
+{
+  // https://pkware.cachefly.net/webdocs/casestudies/APPNOTE.TXT, 4.3.7
+  const QByteArray header = _file.read(30);
+
+  if (header.size() < 30 || qFromLittleEndian<quint32>(header.constData()) != 0x04034b50)
+  {
+    _set_error("Not a zip file: " + _file.fileName());
+    return false;
+  }
+
+  const quint16 flags        = qFromLittleEndian<quint16>(header.constData() + 6);
+  const quint16 method       = qFromLittleEndian<quint16>(header.constData() + 8);
+  qint64 compressed_size     = qFromLittleEndian<quint32>(header.constData() + 18);
+  const quint16 name_length  = qFromLittleEndian<quint16>(header.constData() + 26);
+  const quint16 extra_length = qFromLittleEndian<quint16>(header.constData() + 28);
+
+  _file.read(name_length);
+  const QByteArray extra = _file.read(extra_length);
+
+  if (flags & 1)
+  {
+    _set_error("Encrypted zip files aren't supported: " + _file.fileName());
+    return false;
+  }
+
+  // Zip64 sizes live in the extra field (4.5.3).
+  for (int i = 0; i + 4 <= extra.size();)
+  {
+    const quint16 id   = qFromLittleEndian<quint16>(extra.constData() + i);
+    const quint16 size = qFromLittleEndian<quint16>(extra.constData() + i + 2);
+
+    if (id == 0x0001 && size >= 16 && i + 4 + size <= extra.size())
+    {
+      compressed_size = qFromLittleEndian<qint64>(extra.constData() + i + 12);
+    }
+
+    i += 4 + size;
+  }
+
+  if (method == 8)
+  {
+    // Deflate marks its own end, so the sizes (which may only be in a data
+    // descriptor after the data) aren't needed.
+    _deflated = true;
+  }
+  else if (method == 0 && !(flags & 8))
+  {
+    _stored_remaining = compressed_size;
+  }
+  else
+  {
+    _set_error(QString("Unsupported zip compression method %1: %2").arg(method).arg(_file.fileName()));
+    return false;
+  }
+
+  return true;
+}
+
+int Zip_prefs_source::_read(char* out, int max_length)
+{
+  if (!_deflated)
+  {
+    const qint64 n = _file.read(out, qMin<qint64>(max_length, _stored_remaining));
+
+    if (n < 0)
+    {
+      _set_error("Couldn't read " + _file.fileName());
+      return -1;
+    }
+
+    _stored_remaining -= n;
+    return static_cast<int>(n);
+  }
+
+  if (_stream_end)
+  {
+    return 0;
+  }
+
+  _stream->next_out  = reinterpret_cast<Bytef*>(out);
+  _stream->avail_out = static_cast<uInt>(max_length);
+
+  while (_stream->avail_out > 0 && !_stream_end)
+  {
+    if (_stream->avail_in == 0)
+    {
+      _in = _file.read(256 * 1024);
+
+      if (_in.isEmpty())
+      {
+        _set_error("Zip file ends in the middle of the data: " + _file.fileName());
+        return -1;
+      }
+
+      _stream->next_in  = reinterpret_cast<Bytef*>(_in.data());
+      _stream->avail_in = static_cast<uInt>(_in.size());
+    }
+
+    const int ret = inflate(_stream, Z_NO_FLUSH);
+
+    if (ret == Z_STREAM_END)
+    {
+      _stream_end = true;
+    }
+    else if (ret != Z_OK && ret != Z_BUF_ERROR)
+    {
+      _set_error(QString("Couldn't inflate %1: %2").arg(_file.fileName(), _stream->msg == nullptr ? "" : _stream->msg));
+      return -1;
+    }
+  }
+
+  return max_length - static_cast<int>(_stream->avail_out);
+}
@@ -0,0 +1,149 @@
+#ifndef PREFS_SOURCE_H
+#define PREFS_SOURCE_H
+
+// Where the bytes of a prefs file come from.
+//
+// A plain .csv is mapped and handed out in place; a .csv.gz or .zip (as the
+// AEC distributes them) is inflated on the fly into a fresh buffer per chunk,
+// so the CSV never has to be unpacked to disk.  Either way the parse threads
+// see the same newline-aligned Ingest_chunk's.
+
+#include "ingest_pipeline.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <QStringList>
+
+struct gzFile_s;
+struct z_stream_s;
+
+// Opening errors are reported through has_error() once constructed.
+class Prefs_source
+{
+public:
+  // Picks the source from the file's suffix.  Returns nullptr, with error
+  // set, if the file can't be opened or isn't in a format we can read.
+  // The caller owns the source.
+  static Prefs_source* open(const QString& path, QString& error);
+
+  // The candidates tried, in order, for <year>_prefs_<state>.
+  static QStringList file_names(const QString& base_name);
+
+  virtual ~Prefs_source();
+
+  // Lines at the start of the file that aren't ballots.
+  void set_header_lines(int num_lines);
+
+  // Next chunk of about chunk_size bytes, ending just after a newline (or
+  // at the end of the file).  Returns false at the end, or on error.
+  bool next_chunk(Ingest_chunk& chunk, int chunk_size);
+
+  // Moves to offset in the (decompressed) file, which must be the
+  // end_offset of an earlier chunk, before the first next_chunk().  The
+  // header lines are taken to be behind it.
+  bool skip_to(qint64 offset);
+
+  // How far through the file on disk reading has got, and its size, for
+  // progress reports.  For the compressed sources these are compressed bytes.
+  virtual qint64 input_position() const = 0;
+  qint64 input_size() const;
+
+  bool has_error() const;
+  QString error() const;
+
+protected:
+  Prefs_source();
+
+  virtual bool _read_chunk(Ingest_chunk& chunk, int chunk_size) = 0;
+  virtual bool _skip(qint64 length) = 0;
+  void _set_error(const QString& error);
+
+  qint64 _input_size;
+
+private:
+  int _header_lines;
+  qint64 _offset;
+  QString _error;
+};
+
+// Plain .csv, parsed in place.
+class Mapped_prefs_source : public Prefs_source
+{
+public:
+  explicit Mapped_prefs_source(const QString& path);
+  ~Mapped_prefs_source() override;
+
+  qint64 input_position() const override;
+
+protected:
+  bool _read_chunk(Ingest_chunk& chunk, int chunk_size) override;
+  bool _skip(qint64 length) override;
+
+private:
+  QFile _file;
+  uchar* _mapped;
+  const char* _p;
+  const char* _end;
+};
+
+// Base for the compressed sources: fills buffers from _read() and carries
+// the part line at the end of each one over to the next.
+class Stream_prefs_source : public Prefs_source
+{
+protected:
+  Stream_prefs_source();
+
+  bool _read_chunk(Ingest_chunk& chunk, int chunk_size) override;
+
+  // Decompresses and throws away length bytes.
+  bool _skip(qint64 length) override;
+
+  // Decompressed bytes into out; 0 at the end of the stream, -1 on error.
+  virtual int _read(char* out, int max_length) = 0;
+
+private:
+  QByteArray _carry;
+  bool _at_end;
+};
+
+// .gz, through zlib's gzread.
+class Gzip_prefs_source : public Stream_prefs_source
+{
+public:
+  explicit Gzip_prefs_source(const QString& path);
+  ~Gzip_prefs_source() override;
+
+  qint64 input_position() const override;
+
+protected:
+  int _read(char* out, int max_length) override;
+
+private:
+  gzFile_s* _gz;
+};
+
+// .zip: the first entry in the archive, stored or deflated.
+class Zip_prefs_source : public Stream_prefs_source
+{
+public:
+  explicit Zip_prefs_source(const QString& path);
+  ~Zip_prefs_source() override;
+
+  qint64 input_position() const override;
+
+protected:
+  int _read(char* out, int max_length) override;
+
+private:
+  bool _read_local_header();
+
+  QFile _file;
+  QByteArray _in;
+  z_stream_s* _stream;
+  bool _deflated;
+  bool _stream_end;
+  qint64 _stored_remaining;
+};
+
+#endif // PREFS_SOURCE_H
@@ -0,0 +1,151 @@
+#include "schema_indexes.h"
+
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QVector>
+
+namespace Schema_indexes
+{
+  QStringList all_kinds()
+  {
+    return QStringList() << "seat" << "booth_p1" << "prefix" << "pfor";
+  }
+
+  QStringList default_kinds()
+  {
+    return QStringList() << "seat" << "booth_p1" << "prefix";
+  }
+
+  bool parse_kinds(const QString& spec, QStringList& kinds, QString& error)
+  {
+    kinds.clear();
+
+    for (const QString& s : spec.split(",", Qt::SkipEmptyParts))
+    {
+      const QString kind = s.trimmed().toLower();
+
+      if (kind == "none")
+      {
+        continue;
+      }
+
+      if (all_kinds().indexOf(kind) < 0)
+      {
+        error = QString("Unknown index: %1 (known: %2, none)").arg(s, all_kinds().join(", "));
+        return false;
+      }
+
+      if (kinds.indexOf(kind) < 0)
+      {
+        kinds.append(kind);
+      }
+    }
+
+    return true;
+  }
+
+  QVector<QStringList> index_columns(const QString& kind, int num_groups)
+  {
+    QVector<QStringList> indexes;
+
+    if (kind == "seat")
+    {
+      indexes.append(QStringList() << "seat_id");
+    }
+    else if (kind == "booth_p1")
+    {
+      indexes.append(QStringList() << "booth_id" << "P1");
+    }
+    else if (kind == "prefix")
+    {
+      QStringList columns;
+      for (int i = 1; i <= qMin(3, num_groups); i++)
+      {
+        columns << QString("P%1").arg(i);
+      }
+      indexes.append(columns << "booth_id");
+    }
+    else if (kind == "pfor")
+    {
+      for (int i = 0; i < num_groups; i++)
+      {
+        indexes.append(QStringList() << QString("Pfor%1").arg(i));
+      }
+    }
+
+    return indexes;
+  }
+
+  bool build(QSqlDatabase& db, const QStringList& kinds, const QStringList& table_names, const QList<int>& table_num_groups, QString& error)
+  {
+    QSqlQuery query(db);
+
+    // Dropped first, in case this is a resumed ingest that got this far.
+    if (!query.exec("DROP TABLE IF EXISTS schema_version") ||
+        !query.exec("DROP TABLE IF EXISTS schema_indexes") ||
+        !query.exec("CREATE TABLE schema_version (id INTEGER PRIMARY KEY, version INTEGER)") ||
+        !query.exec(QString("INSERT INTO schema_version VALUES (0, %1)").arg(SCHEMA_VERSION)))
+    {
+      error = "Couldn't create schema_version table: " + query.lastError().text();
+      return false;
+    }
+
+    if (!query.exec("CREATE TABLE schema_indexes (id INTEGER PRIMARY KEY, table_name TEXT, index_name TEXT, kind TEXT, columns TEXT)"))
+    {
+      error = "Couldn't create schema_indexes table: " + query.lastError().text();
+      return false;
+    }
+
+    QSqlQuery insert_query(db);
+    insert_query.prepare("INSERT INTO schema_indexes VALUES(?, ?, ?, ?, ?)");
+    int index_ct = 0;
+
+    for (int j = 0; j < table_names.length(); j++)
+    {
+      const QString& table = table_names.at(j);
+
+      for (const QString& kind : kinds)
+      {
+        const QVector<QStringList> indexes = index_columns(kind, table_num_groups.at(j));
+
+        for (int k = 0; k < indexes.length(); k++)
+        {
+          const QString index_name = indexes.length() == 1
+                                       ? QString("%1_%2").arg(table, kind)
+                                       : QString("%1_%2_%3").arg(table, kind).arg(k);
+          const QString columns    = indexes.at(k).join(", ");
+
+          if (!query.exec(QString("CREATE INDEX IF NOT EXISTS %1 ON %2 (%3)").arg(index_name, table, columns)))
+          {
+            error = QString("Couldn't create index %1: %2").arg(index_name, query.lastError().text());
+            return false;
+          }
+
+          insert_query.addBindValue(index_ct);
+          insert_query.addBindValue(table);
+          insert_query.addBindValue(index_name);
+          insert_query.addBindValue(kind);
+          insert_query.addBindValue(indexes.at(k).join(","));
+
+          if (!insert_query.exec())
+          {
+            error = "Couldn't record index: " + insert_query.lastError().text();
+            return false;
+          }
+
+          index_ct++;
+        }
+      }
+    }
+
+    // Writes sqlite_stat1, including for the primary keys, so the planner
+    // can weigh a covering index against a rowid range scan.
+    if (!query.exec("ANALYZE"))
+    {
+      error = "Couldn't analyze: " + query.lastError().text();
+      return false;
+    }
+
+    return true;
+  }
+} // namespace Schema_indexes
@@ -0,0 +1,44 @@
+#ifndef SCHEMA_INDEXES_H
+#define SCHEMA_INDEXES_H
+
+// The optional indexes on the atl and btl tables, and the schema_version and
+// schema_indexes tables that tell the explorer which ones a file has.
+//
+// Each kind of index is aimed at one family of the explorer's queries:
+//
+//   seat      (seat_id)                  WHERE seat_id = X
+//   booth_p1  (booth_id, P1)             GROUP BY booth_id, P1 (covering)
+//   prefix    (P1, P2, P3, booth_id)     WHERE P1 = a [AND P2 = b] ... (covering
+//                                        for the first three Step-forward columns)
+//   pfor      (Pfor<i>) for each group   WHERE Pfor<i> <= n / BETWEEN
+
+#include <QSqlDatabase>
+#include <QString>
+#include <QStringList>
+
+namespace Schema_indexes
+{
+  // 1: the original schema, with no schema_version table.
+  // 2: the schema tables, the booth aggregates (booth_aggregates.h),
+  //    ballot_quality, the <table>_unique and <table>_booth_rows tables
+  //    and metadata_blob (listed at the top of explorer/main_widget.cpp).
+  const int SCHEMA_VERSION = 2;
+
+  QStringList all_kinds();
+  QStringList default_kinds();
+
+  // Parses a comma-separated list of kinds ("none" for no indexes).
+  // Returns false and sets error on an unknown kind.
+  bool parse_kinds(const QString& spec, QStringList& kinds, QString& error);
+
+  // Index columns for one kind on a table with num_groups Pfor columns;
+  // "pfor" gives one entry per index.
+  QVector<QStringList> index_columns(const QString& kind, int num_groups);
+
+  // Creates the indexes and the schema tables, then runs ANALYZE so that
+  // sqlite_stat1 is there for the planner.  Returns false and sets error
+  // on failure.
+  bool build(QSqlDatabase& db, const QStringList& kinds, const QStringList& table_names, const QList<int>& table_num_groups, QString& error);
+} // namespace Schema_indexes
+
+#endif // SCHEMA_INDEXES_H
@@ -0,0 +1,1064 @@
+#include "state_ingest.h"
+#include "ballot_parser.h"
+#include "ballot_quality.h"
+#include "ballot_store.h"
+#include "booth_clustering.h"
+#include "booth_aggregates.h"
+#include "bulk_writer.h"
+#include "ingest_checkpoint.h"
+#include "ingest_dictionary.h"
+#include "ingest_log.h"
+#include "ingest_pipeline.h"
+#include "metadata_blob.h"
+#include "prefs_source.h"
+#include "schema_indexes.h"
+#include "unique_ballots.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRandomGenerator>
+#include <QSqlDatabase>
+#include <QSqlDriver>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QtDebug>
+
+#include <memory>
+
+// Ballots written between checkpoints.
+static const long long CHECKPOINT_ROWS = 100000;
+
+static bool check_ids(QSqlDatabase& db, const QStringList& table_names, QString& error)
+{
+  // The explorer shares a query out between threads by id ranges that
+  // cover 0 to rows - 1, so every ballot table's ids have to be exactly
+  // those, or the threads' totals come out short of SUM(weight).
+  QSqlQuery query(db);
+
+  for (const QString& table : table_names)
+  {
+    if (!query.exec(QString("SELECT COUNT(*), MIN(id), MAX(id) FROM %1").arg(table)) || !query.next())
+    {
+      error = QString("Couldn't read the ids of %1: %2").arg(table, query.lastError().text());
+      return false;
+    }
+
+    const qint64 num_rows = query.value(0).toLongLong();
+    if (num_rows > 0 && (query.value(1).toLongLong() != 0 || query.value(2).toLongLong() != num_rows - 1))
+    {
+      error = QString("%1 doesn't have ids 0 to %2").arg(table).arg(num_rows - 1);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+int write_derived_tables(QSqlDatabase& db, Bulk_writer& writer, const Ingest_options& options, const QStringList& table_names,
+                         const QList<int>& table_max_prefs, Ingest_log& out)
+{
+  // ~~~~~ Everything else the explorer reads on opening, in one blob ~~~~~
+  QString metadata_error;
+  if (!Metadata_blob::write(db, metadata_error))
+  {
+    out << metadata_error << endl;
+    return 1;
+  }
+
+  // ~~~~~ Ballot tables in booth order ~~~~~
+  QString clustering_error;
+  if (options.cluster_booths)
+  {
+    out << "Putting ballots in booth order" << endl;
+
+    if (!Booth_clustering::cluster(db, table_names, clustering_error))
+    {
+      out << clustering_error << endl;
+      return 1;
+    }
+  }
+
+  // ~~~~~ Identical ballots collapsed into weighted rows ~~~~~
+  out << "Collapsing identical ballots" << endl;
+
+  QStringList unique_tables;
+  QString unique_error;
+  if (!Unique_ballots::build(db, table_names, table_max_prefs, unique_tables, unique_error))
+  {
+    out << unique_error << endl;
+    return 1;
+  }
+
+  // Each booth's id range, for the tables that are in booth order.
+  QStringList clustered_tables = options.cluster_booths ? table_names : QStringList();
+  for (const QString& table : unique_tables)
+  {
+    clustered_tables << Unique_ballots::table_for(table);
+  }
+
+  if (!Booth_clustering::write_ranges(db, clustered_tables, clustering_error))
+  {
+    out << clustering_error << endl;
+    return 1;
+  }
+
+  // The explorer queries the weighted tables where there are any, so
+  // they get the same indexes.
+  QStringList index_tables      = table_names;
+  QList<int> index_tables_prefs = table_max_prefs;
+
+  for (const QString& table : unique_tables)
+  {
+    index_tables << Unique_ballots::table_for(table);
+    index_tables_prefs << table_max_prefs.at(table_names.indexOf(table));
+  }
+
+  QString ids_error;
+  if (!check_ids(db, index_tables, ids_error))
+  {
+    out << ids_error << endl;
+    return 1;
+  }
+
+  // ~~~~~ Indexes for the explorer's queries, and planner statistics ~~~~~
+  out << "Creating indexes: " << (options.index_kinds.isEmpty() ? QString("none") : options.index_kinds.join(", ")) << endl;
+
+  QString index_error;
+  if (!Schema_indexes::build(db, options.index_kinds, index_tables, index_tables_prefs, index_error))
+  {
+    out << index_error << endl;
+    return 1;
+  }
+
+  // ~~~~~ Columnar copy of the ballots for the explorer to map ~~~~~
+  if (options.ballot_store)
+  {
+    const QString store_file = Ballot_store::file_name_for(db.databaseName());
+    out << "Writing " << QFileInfo(store_file).fileName() << endl;
+
+    QString store_error;
+    if (!Ballot_store::write(writer, table_names, table_max_prefs, unique_tables, store_file, store_error))
+    {
+      out << store_error << endl;
+      return 1;
+    }
+  }
+
+  // ~~~~~ A new content id, which an election archive checks against ~~~~~
+  // Random rather than counted, so that a file built again from scratch
+  // doesn't repeat an old one's (see election_archive.h).
+  QSqlQuery query(db);
+  const quint32 content_id = (QRandomGenerator::global()->generate() & 0x7fffffff) | 1;
+
+  if (!query.exec(QString("PRAGMA user_version = %1").arg(content_id)))
+  {
+    out << "Couldn't set the content id: " << query.lastError().text() << endl;
+    return 1;
+  }
+
+  return 0;
+}
+
+static int ingest_into_database(QSqlDatabase& db, const Ingest_options& options, const National_data& national, const QString& state,
+                                bool resuming, Ingest_log& out)
+{
+  const QString& year = national.year;
+
+  QString state_full("");
+  if (state == "qld") { state_full = "Queensland"; }
+  if (state == "nsw") { state_full = "New South Wales"; }
+  if (state == "vic") { state_full = "Victoria"; }
+  if (state == "tas") { state_full = "Tasmania"; }
+  if (state == "sa")  { state_full = "South Australia"; }
+  if (state == "wa")  { state_full = "Western Australia"; }
+  if (state == "nt")  { state_full = "Northern Territory"; }
+  if (state == "act") { state_full = "Australian Capital Territory"; }
+
+  QSqlQuery query(db);
+
+  // The ballot rows go in through the SQLite C API, with the connection
+  // in bulk-load mode until everything has been written.
+  Bulk_writer writer(db);
+
+  if (!writer.is_native())
+  {
+    out << "Qt's SQLite isn't the one this program is linked against; writing through QSqlQuery instead" << endl;
+  }
+
+  if (!writer.begin_build())
+  {
+    out << "Couldn't set bulk-load pragmas: " << writer.last_error() << endl;
+    return 1;
+  }
+
+  // The checkpoint table goes in first (after the pragmas, which have to
+  // come before any table for the page size to apply), so that a file cut
+  // off at any point after this can be resumed.
+  QString checkpoint_error;
+  if (!Ingest_checkpoint::create_table(db, checkpoint_error))
+  {
+    out << checkpoint_error << endl;
+    return 1;
+  }
+
+  // ~~~~~~ Creation of the basic information table ~~~~~~
+  if (!query.exec("CREATE TABLE IF NOT EXISTS basic_info (id INTEGER PRIMARY KEY, state TEXT, state_full TEXT, year INTEGER, formal_votes INTEGER, atl_votes INTEGER, btl_votes INTEGER)"))
+  {
+    out << "Couldn't create info table" << endl;
+    return 1;
+  }
+
+  if (!query.exec("INSERT OR REPLACE INTO basic_info VALUES (0, '" + state.toUpper() + "', '" + state_full + "', " + year + ", 0, 0, 0)"))
+  {
+    out << "Couldn't insert basic info" << endl;
+    return 1;
+  }
+
+
+  // ~~~~~~ Creation of the tables for seats and (seat_)booths ~~~~~~
+
+  if (!query.exec("CREATE TABLE IF NOT EXISTS booths (id INTEGER PRIMARY KEY, seat TEXT, booth TEXT, lon REAL, lat REAL, formal_votes INTEGER)"))
+  {
+    out << "Couldn't create booth table" << endl;
+    return 1;
+  }
+
+  if (!query.exec("CREATE TABLE IF NOT EXISTS seats (id INTEGER PRIMARY KEY, seat TEXT, formal_votes INTEGER)"))
+  {
+    out << "Couldn't create seat table" << endl;
+    return 1;
+  }
+
+  const QVector<QStringList> booth_rows = national.booths_by_state.value(state);
+
+  if (booth_rows.isEmpty())
+  {
+    out << "No booths for " << state << " in booths file" << endl;
+    return 1;
+  }
+
+  // Seats, booths and parties are all interned in the one dictionary,
+  // so that the preferences pass can look them up by hash.
+  Ingest_dictionary dictionary;
+
+  // Two passes through the booths: one for seats, one for booths.
+
+  // Pass for seats:
+  QList<long long> seats_formal_votes;
+  int seat_ct = 0;
+
+  db.transaction();
+  query.prepare("INSERT OR REPLACE INTO seats VALUES(?, ?, ?)");
+
+  for (const QStringList& cells : booth_rows)
+  {
+    if (dictionary.seat_id(cells.at(2)) < 0)
+    {
+      query.addBindValue(seat_ct);
+      query.addBindValue(cells.at(2));
+      query.addBindValue(0);
+
+      if (!query.exec())
+      {
+        out << "Couldn't insert seat" << endl;
+        return 1;
+      }
+
+      dictionary.add_seat(cells.at(2));
+      seats_formal_votes.append(0);
+      seat_ct++;
+    }
+  }
+
+  if (!db.commit())
+  {
+    out << "Couldn't commit seats" << endl;
+    return 1;
+  }
+
+
+  // Pass through booths.csv for polling places:
+  // these will be stored in the form seat_booth.
+  QList<long long> seat_booths_formal_votes;
+  int booth_ct = 0;
+  int listed_booths;
+
+  db.transaction();
+  query.prepare("INSERT OR REPLACE INTO booths VALUES(?, ?, ?, ?, ?, ?)");
+
+  for (const QStringList& cells : booth_rows)
+  {
+    const int seat_id = dictionary.seat_id(cells.at(2));
+    dictionary.add_listed_booth(seat_id, cells.at(5));
+
+    QString seat_booth(cells.at(2) + "_" + cells.at(5));
+    query.addBindValue(booth_ct);
+    query.addBindValue(cells.at(2));
+    query.addBindValue(seat_booth);
+
+    int num_cells = cells.length();
+    double lon, lat;
+    bool valid_coord;
+    lon = cells.at(num_cells - 1).toDouble(&valid_coord);
+    lat = cells.at(num_cells - 2).toDouble(&valid_coord);
+
+    if (!valid_coord)
+    {
+      lon = 0.;
+      lat = 0.;
+    }
+
+    query.addBindValue(lon);
+    query.addBindValue(lat);
+    query.addBindValue(0);
+
+    if (!query.exec())
+    {
+      out << "Couldn't insert booth" << endl;
+      return 1;
+    }
+
+    seat_booths_formal_votes.append(0);
+    booth_ct++;
+  }
+
+  if (!db.commit())
+  {
+    out << "Couldn't commit booths" << endl;
+    return 1;
+  }
+
+  listed_booths = booth_ct;
+
+
+  // ~~~~~~ Creation of the table for groups (parties) ~~~~~~
+
+  // Start with the official list of party abbreviations.
+
+  for (const QStringList& cells : national.parties)
+  {
+    // PartyAb, PartyNm, RegisteredPartyAb
+    dictionary.add_party(cells.at(1), cells.at(3), cells.at(2));
+  }
+
+  // Read through the primaries to extract parties/groups
+
+  if (!query.exec("CREATE TABLE IF NOT EXISTS groups (id INTEGER PRIMARY KEY, group_letter TEXT, party TEXT, party_ab TEXT, primaries INTEGER)"))
+  {
+    out << "Couldn't create groups table" << endl;
+    return 1;
+  }
+
+  const QVector<QStringList> primaries_rows = national.primaries_by_state.value(state);
+
+  int group_ct = 0;
+
+  db.transaction();
+  query.prepare("INSERT OR REPLACE INTO groups VALUES(?, ?, ?, ?, ?)");
+
+  for (const QStringList& cells : primaries_rows)
+  {
+    if (cells.at(3).toInt() == 0)
+    {
+      // ATL group.
+      query.addBindValue(group_ct);
+      query.addBindValue(cells.at(1));
+
+      // *** Need to handle quotes here ***
+
+      if (cells.at(5) == "")
+      {
+        query.addBindValue("Group " + cells.at(1));
+        query.addBindValue("Gp" + cells.at(1));
+      }
+      else
+      {
+        int party_i = dictionary.party_index(cells.at(5));
+
+        if (party_i < 0)
+        {
+          query.addBindValue("Group " + cells.at(1));
+          query.addBindValue("Gp" + cells.at(1));
+        }
+        else
+        {
+          query.addBindValue(cells.at(5));
+          query.addBindValue(dictionary.party_abbrev(party_i));
+        }
+      }
+
+      query.addBindValue(0);
+
+      if (!query.exec())
+      {
+        out << "Couldn't insert group " << cells.at(5) << endl;
+        return 1;
+      }
+
+      group_ct++;
+    }
+  }
+
+  if (!db.commit())
+  {
+    out << "Couldn't commit groups" << endl;
+  }
+
+  int num_atl = group_ct;
+
+
+  // ~~~~~~ Creation of the table for candidates ~~~~~~
+
+  if (!query.exec("CREATE TABLE IF NOT EXISTS candidates (id INTEGER PRIMARY KEY, group_letter TEXT, group_pos INTEGER, party TEXT, party_ab TEXT, candidate TEXT, primaries INTEGER)"))
+  {
+    out << "Couldn't create cands table" << endl;
+    return 1;
+  }
+
+  int cand_ct = 0;
+
+  db.transaction();
+  query.prepare("INSERT OR REPLACE INTO candidates VALUES(?, ?, ?, ?, ?, ?, ?)");
+
+  for (const QStringList& cells : primaries_rows)
+  {
+    if (cells.at(3).toInt() != 0 &&
+        cells.at(3).toInt() < 100)
+    {
+      // Candidate
+      query.addBindValue(cand_ct);
+      query.addBindValue(cells.at(1));
+      query.addBindValue(cells.at(3).toInt());
+      query.addBindValue(cells.at(5));
+
+      if (cells.at(5) == "")
+      {
+        query.addBindValue(QString("Gp%1").arg(cells.at(1)));
+      }
+      else
+      {
+        int party_i = dictionary.party_index(cells.at(5));
+
+        if (party_i < 0)
+        {
+          query.addBindValue(QString("Gp%1").arg(cells.at(1)));
+        }
+        else
+        {
+          query.addBindValue(dictionary.party_abbrev(party_i));
+        }
+      }
+
+      query.addBindValue(cells.at(4));
+      query.addBindValue(0);
+
+      if (!query.exec())
+      {
+        out << "Couldn't insert candidate" << endl;
+        return 1;
+      }
+
+      cand_ct++;
+    }
+  }
+
+  if (!db.commit())
+  {
+    out << "Couldn't commit candidates" << endl;
+  }
+
+  int num_btl = cand_ct;
+
+  // ~~~~~~ Creation of the preference tables ~~~~~~
+
+  // Both the ATL and BTL tables are filled from a single pass through the
+  // preferences file: each ballot is classified once and sent to whichever
+  // table it belongs in.
+
+  QStringList table_names;
+  table_names << "atl" << "btl";
+
+  QList<int> table_max_prefs;
+  table_max_prefs << num_atl << num_btl;
+
+  for (int j = 0; j < 2; j++)
+  {
+    const int max_prefs = table_max_prefs.at(j);
+
+    QString create_text("CREATE TABLE IF NOT EXISTS " + table_names.at(j) + " (id INTEGER PRIMARY KEY, seat_id INTEGER, booth_id INTEGER, num_prefs INTEGER");
+
+    for (int i = 0; i < max_prefs; i++)
+    {
+      create_text += QString(", P") + QString().setNum(i + 1);
+    }
+
+    for (int i = 0; i < max_prefs; i++)
+    {
+      create_text += QString(", Pfor") + QString().setNum(i);
+    }
+    create_text += ")";
+
+    out << create_text << endl;
+
+    if (!query.exec(create_text))
+    {
+      out << "Couldn't create " << table_names.at(j) << " table";
+      return 1;
+    }
+
+    QString sql_prepare("INSERT INTO " + table_names.at(j) + " VALUES(?, ?, ?, ?");
+    for (int i = 0; i < max_prefs; i++)
+    {
+      sql_prepare += ", ?, ?";
+    }
+    sql_prepare += ")";
+
+    out << sql_prepare << endl;
+
+    if (!writer.prepare_insert(j, sql_prepare))
+    {
+      out << "Couldn't prepare insert for " << table_names.at(j) << ": " << writer.last_error() << endl;
+      return 1;
+    }
+  }
+
+  // The prefs file can be given as it comes from the AEC (zipped), gzipped
+  // or unpacked.
+  QString prefs_path;
+  for (const QString& file_name : Prefs_source::file_names(year + "_prefs_" + state))
+  {
+    prefs_path = QDir(options.aec_dir).filePath(file_name);
+    if (QFileInfo(prefs_path).exists())
+    {
+      break;
+    }
+  }
+
+  // A resumed ingest carries on from the last checkpoint, with everything
+  // the writer tallies put back as it was then.
+  Ingest_checkpoint checkpoint;
+
+  if (resuming && !checkpoint.load(db, checkpoint_error))
+  {
+    out << checkpoint_error << endl;
+    return 1;
+  }
+
+  QString source_error;
+  std::unique_ptr<Prefs_source> source(Prefs_source::open(prefs_path, source_error));
+
+  if (source)
+  {
+    out << "Starting pass for ATL and BTL from " << prefs_path << endl;
+
+    source->set_header_lines(year == "2016" ? 2 : 1);
+
+    long long btl_ct = 0;
+    long long atl_ct = 0;
+
+    Booth_aggregates booth_aggregates(2);
+    Ballot_quality ballot_quality(2);
+
+    auto save_state = [&]()
+    {
+      QByteArray state;
+      QDataStream stream(&state, QIODevice::WriteOnly);
+      dictionary.save_unlisted_booths(stream);
+      stream << seats_formal_votes << seat_booths_formal_votes;
+      booth_aggregates.save(stream);
+      ballot_quality.save(stream);
+      return state;
+    };
+
+    if (checkpoint.input_offset > 0)
+    {
+      if (checkpoint.input_file != QFileInfo(prefs_path).fileName() || checkpoint.input_size != source->input_size())
+      {
+        out << "ERROR: the checkpoint is for " << checkpoint.input_file << " (" << checkpoint.input_size
+            << " bytes), not " << prefs_path << "; can't resume" << endl;
+        return 1;
+      }
+
+      QDataStream stream(checkpoint.state);
+      const bool restored = dictionary.restore_unlisted_booths(stream);
+      stream >> seats_formal_votes >> seat_booths_formal_votes;
+      booth_aggregates.restore(stream);
+      ballot_quality.restore(stream);
+
+      if (!restored || stream.status() != QDataStream::Ok || seat_booths_formal_votes.length() != dictionary.num_booths())
+      {
+        out << "ERROR: couldn't read the checkpoint state; can't resume" << endl;
+        return 1;
+      }
+
+      atl_ct = checkpoint.atl_rows;
+      btl_ct = checkpoint.btl_rows;
+
+      if (!source->skip_to(checkpoint.input_offset))
+      {
+        out << "ERROR: " << source->error() << endl;
+        return 1;
+      }
+
+      out << "Resuming after " << (atl_ct + btl_ct) << " ballots, " << checkpoint.input_offset << " bytes into the prefs file" << endl;
+    }
+
+    checkpoint.input_file = QFileInfo(prefs_path).fileName();
+    checkpoint.input_size = source->input_size();
+
+    Progress_meter meter(source->input_size(), source->input_position(), checkpoint.input_offset, atl_ct + btl_ct);
+
+    // The file is parsed on a pool of threads, and the batches of parsed
+    // ballots come back here in file order; this thread is the only one
+    // that touches the database.
+    const int num_threads = options.parse_threads;
+
+    Chunk_feed chunk_feed(*source, 4 * 1024 * 1024);
+    Ballot_batch_queue batch_queue(4 * num_threads);
+    QList<Parse_thread*> parse_threads;
+
+    for (int i = 0; i < num_threads; i++)
+    {
+      // In 2019, the AEC started putting the state as the first field
+      // in the prefs file, and stopped quoting the preferences.
+      Parse_thread* thread = new Parse_thread(chunk_feed, batch_queue, num_atl, num_btl, year != "2016", year == "2016");
+      parse_threads.append(thread);
+      thread->start();
+    }
+
+    out << "Parsing on " << num_threads << " threads" << endl;
+
+    // Stops the parse threads and waits for them; used on every exit path
+    // from here on.
+    auto stop_parse_threads = [&]()
+    {
+      batch_queue.abort();
+      for (Parse_thread* thread : parse_threads)
+      {
+        thread->wait();
+        delete thread;
+      }
+      parse_threads.clear();
+    };
+
+    // The ballots, the tallies and the input offset they correspond to are
+    // committed together, at the end of a chunk.
+    auto save_checkpoint = [&](qint64 input_offset)
+    {
+      checkpoint.input_offset = input_offset;
+      checkpoint.atl_rows     = atl_ct;
+      checkpoint.btl_rows     = btl_ct;
+      checkpoint.state        = save_state();
+
+      if (!checkpoint.save(db, checkpoint_error))
+      {
+        out << checkpoint_error << endl;
+        return false;
+      }
+
+      if (!writer.commit())
+      {
+        out << "couldn't commit: " << writer.last_error() << endl;
+        return false;
+      }
+
+      return true;
+    };
+
+    if (!writer.begin_transaction())
+    {
+      out << "couldn't begin transaction: " << writer.last_error() << endl;
+      stop_parse_threads();
+      return 1;
+    }
+
+    long long rows_at_checkpoint = atl_ct + btl_ct;
+    qint64 input_offset          = checkpoint.input_offset;
+
+    while (Ballot_batch* batch = batch_queue.pop_next())
+    {
+      const int num_ballots = batch->ballots.size();
+
+      for (int k = 0; k < num_ballots; k++)
+      {
+        const Parsed_ballot& ballot = batch->ballots[k];
+
+        const bool valid_btl = ballot.table == Ballot_parser::BTL;
+        const int max_prefs = valid_btl ? num_btl : num_atl;
+
+        const int seat_id = dictionary.seat_id(ballot.seat, ballot.seat_length);
+
+        if (seat_id < 0)
+        {
+          out << "ERROR: Couldn't find seat id for " << QString::fromUtf8(ballot.seat, ballot.seat_length) << endl;
+          delete batch;
+          stop_parse_threads();
+          return 1;
+        }
+
+        seats_formal_votes[seat_id] += 1;
+
+        // Unlisted booths are interned (with the PRE_POLL etc. collection
+        // points normalised) the first time they're seen.
+        const int booth_id = dictionary.booth_id(seat_id, ballot.booth, ballot.booth_length);
+
+        if (booth_id == seat_booths_formal_votes.length())
+        {
+          seat_booths_formal_votes.append(0);
+        }
+
+        seat_booths_formal_votes[booth_id] += 1;
+
+        const int* prefs_ordered = batch->prefs.data() + ballot.prefs_offset;
+        const int* prefs_for = prefs_ordered + max_prefs;
+
+        booth_aggregates.add(ballot.table, booth_id, prefs_ordered[0], max_prefs > 1 ? prefs_ordered[1] : Ballot_parser::NO_PREF);
+        ballot_quality.add(booth_id, ballot);
+
+        // Row IDs are counted separately for each table.
+        if (!writer.insert_ballot(ballot.table, valid_btl ? btl_ct : atl_ct, seat_id, booth_id, ballot.num_valid_prefs,
+                                  prefs_ordered, prefs_for, max_prefs))
+        {
+          out << "Error at insert exec" << endl;
+          out << writer.last_error() << endl;
+          delete batch;
+          stop_parse_threads();
+          return 1;
+        }
+
+        if (valid_btl)
+        {
+          btl_ct++;
+        }
+        else
+        {
+          atl_ct++;
+        }
+      }
+
+      // A batch that failed to parse still carries the ballots before
+      // the bad line, so that the error is reported in file order.
+      if (batch->parse_error)
+      {
+        out << "ERROR: Couldn't parse line " << QString::fromUtf8(batch->error_line) << endl;
+        delete batch;
+        stop_parse_threads();
+        return 1;
+      }
+
+      input_offset = batch->end_offset;
+      delete batch;
+
+      if (atl_ct + btl_ct - rows_at_checkpoint >= CHECKPOINT_ROWS)
+      {
+        if (!save_checkpoint(input_offset) || !writer.begin_transaction())
+        {
+          stop_parse_threads();
+          return 1;
+        }
+
+        rows_at_checkpoint = atl_ct + btl_ct;
+        out << meter.report(atl_ct + btl_ct, input_offset, chunk_feed.input_position()) << endl;
+      }
+    }
+
+    stop_parse_threads();
+
+    if (source->has_error())
+    {
+      out << "ERROR: " << source->error() << endl;
+      return 1;
+    }
+
+    source.reset();
+
+    // From here on, a resumed ingest starts with no ballots left to read.
+    if (!save_checkpoint(input_offset))
+    {
+      return 1;
+    }
+
+    // Fill in the remaining booths that were not included
+    // in the booths.csv file.
+    db.transaction();
+    query.prepare("INSERT OR REPLACE INTO booths VALUES(?, ?, ?, ?, ?, ?)");
+    int num_booths = dictionary.num_booths();
+
+    for (int i = listed_booths; i < num_booths; i++)
+    {
+      query.addBindValue(i);
+      query.addBindValue(dictionary.seat_name(dictionary.booth_seat_id(i)));
+      query.addBindValue(dictionary.booth_name(i));
+      query.addBindValue(0.);
+      query.addBindValue(0.);
+      query.addBindValue(0);
+
+      if (!query.exec())
+      {
+        out << "couldn't bind new booth" << endl;
+        return 1;
+      }
+    }
+
+    listed_booths = num_booths;
+
+    if (!db.commit())
+    {
+      out << "Couldn't commit new booths" << endl;
+      return 1;
+    }
+
+    out << meter.report(atl_ct + btl_ct, input_offset, checkpoint.input_size) << endl;
+    out << "ATL: " + QString().setNum(atl_ct) + ", BTL: " + QString().setNum(btl_ct) << endl;
+
+    out << "Trying to enter primary vote totals into the groups table" << endl;
+
+    for (int j = 0; j < 2; j++)
+    {
+      if (query.exec("SELECT P1, COUNT(P1) FROM " + table_names.at(j) + " GROUP BY P1"))
+      {
+        QList<int> primaries_groups;
+        QList<long long> primaries;
+
+        while (query.next())
+        {
+          primaries_groups.append(query.value(0).toInt());
+          primaries.append(query.value(1).toLongLong());
+        }
+
+        if (!db.transaction())
+        {
+          out << "Couldn't start transaction??" << endl;
+        }
+
+        QString primaries_table = (j == 0) ? "groups" : "candidates";
+
+        if (!query.prepare("UPDATE " + primaries_table + " SET primaries = ? WHERE id = ?"))
+        {
+          out << "Couldn't prepare setting primary" << endl;
+          qDebug() << db.lastError();
+          return 1;
+        }
+
+        for (int i = 0; i < primaries.length(); i++)
+        {
+          query.addBindValue(primaries.at(i));
+          query.addBindValue(primaries_groups.at(i));
+
+          out << primaries_groups.at(i) << ": " << primaries.at(i) << endl;
+
+          if (!query.exec())
+          {
+            out << "Couldn't update primaries" << endl;
+            return 1;
+          }
+        }
+
+        if (!db.commit())
+        {
+          out << "Couldn't commit primaries" << endl;
+          return 1;
+        }
+      }
+      else
+      {
+        out << "Query to get primary votes failed." << endl;
+        return 1;
+      }
+    }
+
+    // ~~~~~ Add formal vote total to the basic_info table ~~~~~
+    if (!query.exec(QString("UPDATE basic_info SET formal_votes = %1, atl_votes = %2, btl_votes = %3 WHERE id = 0")
+                    .arg(atl_ct + btl_ct).arg(atl_ct).arg(btl_ct)))
+    {
+      out << "Couldn't update formal votes in basic_info table" << endl;
+      return 1;
+    }
+
+    // ~~~~~ Add formal vote totals to the divisions table ~~~~~
+    db.transaction();
+
+    if (!query.prepare("UPDATE seats SET formal_votes = ? WHERE id = ?"))
+    {
+      out << "Couldn't prepare setting formal votes for divisions" << endl;
+      return 1;
+    }
+
+    for (int i = 0; i < dictionary.num_seats(); i++)
+    {
+      query.addBindValue(seats_formal_votes.at(i));
+      query.addBindValue(i);
+
+      if (!query.exec())
+      {
+        out << "Couldn't update divisions formal votes" << endl;
+        return 1;
+      }
+
+    }
+
+    if (!db.commit())
+    {
+      out << "Couldn't commit divisions formal votes" << endl;
+      return 1;
+    }
+
+
+    // ~~~~~ Add formal vote totals to the booths table ~~~~~
+    db.transaction();
+
+    if (!query.prepare("UPDATE booths SET formal_votes = ? WHERE id = ?"))
+    {
+      out << "Couldn't prepare setting formal votes for booths" << endl;
+      return 1;
+    }
+
+    for (int i = 0; i < dictionary.num_booths(); i++)
+    {
+      query.addBindValue(seat_booths_formal_votes.at(i));
+      query.addBindValue(i);
+
+      if (!query.exec())
+      {
+        out << "Couldn't update booths formal votes" << endl;
+        return 1;
+      }
+
+    }
+
+    if (!db.commit())
+    {
+      out << "Couldn't commit booths formal votes" << endl;
+      return 1;
+    }
+
+    // ~~~~~ Per-booth P1 and P1 x P2 counts ~~~~~
+    QString aggregates_error;
+    if (!booth_aggregates.write(db, table_names, aggregates_error))
+    {
+      out << aggregates_error << endl;
+      return 1;
+    }
+
+    // ~~~~~ Per-booth counts of ballot defects ~~~~~
+    QString quality_error;
+    if (!ballot_quality.write(db, table_names, quality_error))
+    {
+      out << quality_error << endl;
+      return 1;
+    }
+
+    if (write_derived_tables(db, writer, options, table_names, table_max_prefs, out) != 0)
+    {
+      return 1;
+    }
+
+    // The file is complete.
+    if (!Ingest_checkpoint::drop_table(db, checkpoint_error))
+    {
+      out << checkpoint_error << endl;
+      return 1;
+    }
+
+    // Back to the normal journal and sync settings before the file is
+    // handed over; VACUUM needs every statement to be finished.
+    query.finish();
+
+    out << "Vacuuming" << endl;
+
+    if (!writer.finish_build())
+    {
+      out << "Couldn't finish bulk load: " << writer.last_error() << endl;
+      return 1;
+    }
+  }
+  else
+  {
+    out << source_error << endl;
+    return 1;
+  }
+
+  return 0;
+}
+
+
+int ingest_state(const Ingest_options& options, const National_data& national, const QString& state)
+{
+  const QString& year = national.year;
+  Ingest_log out(year + " " + state);
+  
+  const QString db_file = QDir(options.out_dir).filePath(year + "_" + state + ".sqlite");
+  bool resuming         = false;
+  
+  if (QFileInfo(db_file).exists())
+  {
+    if (options.resume)
+    {
+      resuming = true;
+    }
+    else if (!options.overwrite)
+    {
+      out << "Output file " << db_file << " already exists (use --overwrite to replace it, or --resume)" << endl;
+      return 1;
+    }
+    else if (!QFile::remove(db_file))
+    {
+      out << "Couldn't remove existing output file " << db_file << endl;
+      return 1;
+    }
+  }
+  
+  // A store left from an earlier file would no longer match the ballots.
+  const QString store_file = Ballot_store::file_name_for(db_file);
+  if (!resuming && QFileInfo(store_file).exists() && !QFile::remove(store_file))
+  {
+    out << "Couldn't remove existing ballot store " << store_file << endl;
+    return 1;
+  }
+  
+  // Each state gets its own connection, since states can be
+  // ingested on different threads.
+  const QString connection_name = QString("ingest_%1_%2").arg(year, state);
+  int result;
+  
+  // The following is inside its own scope so that the database can be
+  // removed properly: https://doc.qt.io/qt-5/qsqldatabase.html#removeDatabase
+  {
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connection_name);
+    db.setDatabaseName(db_file);
+    
+    if (!db.open())
+    {
+      out << "Couldn't open db " << db_file << endl;
+      result = 1;
+    }
+    else if (resuming && Ingest_checkpoint::is_complete(db))
+    {
+      out << "Output file " << db_file << " is complete; nothing to resume" << endl;
+      result = 0;
+      db.close();
+    }
+    else if (resuming && !Ingest_checkpoint::exists(db))
+    {
+      out << "Output file " << db_file << " is unfinished but has no checkpoint, so can't be resumed (use --overwrite to build it again)" << endl;
+      result = 1;
+      db.close();
+    }
+    else
+    {
+      result = ingest_into_database(db, options, national, state, resuming, out);
+      db.close();
+    }
+  }
+  
+  QSqlDatabase::removeDatabase(connection_name);
+  
+  if (result == 0)
+  {
+    out << "end" << endl;
+  }
+  
+  return result;
+}
@@ -0,0 +1,53 @@
+#ifndef STATE_INGEST_H
+#define STATE_INGEST_H
+
+#include "national_data.h"
+#include "schema_indexes.h"
+
+#include <QList>
+#include <QSqlDatabase>
+#include <QString>
+#include <QStringList>
+
+class Bulk_writer;
+class Ingest_log;
+
+struct Ingest_options
+{
+  QString aec_dir;
+  QString out_dir;
+  int parse_threads = 1;
+  bool overwrite    = false;
+
+  // Carry on from the checkpoint in an existing output file, rather than
+  // starting again (see ingest_checkpoint.h).
+  bool resume = false;
+
+  // Bring existing output files up to date with a newer prefs file,
+  // rather than building them again (see state_update.h).
+  bool update = false;
+
+  // Also write <year>_<state>.spx (see ballot_store.h).
+  bool ballot_store = true;
+
+  // Rewrite the ballot tables in booth order (see booth_clustering.h).
+  bool cluster_booths = false;
+
+  // See schema_indexes.h.
+  QStringList index_kinds = Schema_indexes::default_kinds();
+};
+
+// Builds <out_dir>/<year>_<state>.sqlite from <aec_dir>/<year>_prefs_<state>.csv
+// and the already-loaded national files.  Returns 0 on success.
+//
+// Safe to call for several states at once from different threads.
+int ingest_state(const Ingest_options& options, const National_data& national, const QString& state);
+
+// Everything that's built from the finished ballot tables: the metadata
+// blob, the booth ordering and id ranges, the weighted tables, the indexes
+// and the ballot store, and a new content id in the file's user_version.
+// Also used by update_state().  Returns 0 on success.
+int write_derived_tables(QSqlDatabase& db, Bulk_writer& writer, const Ingest_options& options, const QStringList& table_names,
+                         const QList<int>& table_max_prefs, Ingest_log& out);
+
+#endif // STATE_INGEST_H
@@ -0,0 +1,683 @@
+#include "state_update.h"
+#include "ballot_parser.h"
+#include "ballot_quality.h"
+#include "ballot_store.h"
+#include "booth_aggregates.h"
+#include "booth_clustering.h"
+#include "bulk_writer.h"
+#include "ingest_checkpoint.h"
+#include "ingest_dictionary.h"
+#include "ingest_log.h"
+#include "ingest_pipeline.h"
+#include "prefs_source.h"
+#include "schema_indexes.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QVariant>
+#include <QVector>
+
+#include <memory>
+
+namespace
+{
+  // There while an update has rewritten ballots but not yet the tables
+  // built from them (see state_update.h).
+  const char* const PENDING_TABLE = "update_pending";
+
+  struct Booth_digest
+  {
+    quint64 hash         = 0;
+    long long ballots[2] = {0, 0};
+
+    long long formal_votes() const
+    {
+      return ballots[0] + ballots[1];
+    }
+
+    bool operator==(const Booth_digest& other) const
+    {
+      return hash == other.hash && ballots[0] == other.ballots[0] && ballots[1] == other.ballots[1];
+    }
+  };
+
+  // The splitmix64 finaliser.
+  quint64 mix(quint64 x)
+  {
+    x ^= x >> 30;
+    x *= Q_UINT64_C(0xbf58476d1ce4e5b9);
+    x ^= x >> 27;
+    x *= Q_UINT64_C(0x94d049bb133111eb);
+    x ^= x >> 31;
+    return x;
+  }
+
+  // Only the valid preferences count; the rest of the row is NO_PREF.
+  quint64 ballot_hash(int table, int num_prefs, const int* prefs)
+  {
+    quint64 h = mix((static_cast<quint64>(table) << 32) | static_cast<quint32>(num_prefs));
+    for (int i = 0; i < num_prefs; i++)
+    {
+      h = mix(h ^ static_cast<quint32>(prefs[i]));
+    }
+    return h;
+  }
+
+  void add_to_digest(QVector<Booth_digest>& digests, int booth_id, int table, quint64 hash)
+  {
+    if (booth_id >= digests.length())
+    {
+      digests.resize(booth_id + 1);
+    }
+
+    digests[booth_id].hash += hash;
+    digests[booth_id].ballots[table] += 1;
+  }
+
+  // The digests of the ballots already in table j.
+  bool read_digests(Bulk_writer& writer, const QString& table, int j, int max_prefs, QVector<Booth_digest>& digests, QString& error)
+  {
+    QString sql("SELECT booth_id, num_prefs");
+    for (int i = 0; i < max_prefs; i++)
+    {
+      sql += QString(", P%1").arg(i + 1);
+    }
+    sql += " FROM " + table;
+
+    Bulk_writer::Reader reader(writer, sql);
+    QVector<int> prefs(max_prefs);
+
+    while (reader.next())
+    {
+      const int booth_id  = reader.value(0);
+      const int num_prefs = qBound(0, reader.value(1), max_prefs);
+
+      for (int i = 0; i < num_prefs; i++)
+      {
+        prefs[i] = reader.value(2 + i);
+      }
+
+      add_to_digest(digests, booth_id, j, ballot_hash(j, num_prefs, prefs.constData()));
+    }
+
+    if (!reader.error().isEmpty())
+    {
+      error = QString("Couldn't read %1: %2").arg(table, reader.error());
+      return false;
+    }
+
+    return true;
+  }
+
+  // One pass through the prefs file, on the parse threads as in an ingest,
+  // handing each ballot (in file order) and its P values to add_ballot,
+  // which returns false (having set error) to stop.
+  template <typename Ballot_fn>
+  bool read_prefs(const QString& prefs_path, const QString& year, int num_atl, int num_btl, int num_threads, Ballot_fn add_ballot,
+                  QString& error)
+  {
+    std::unique_ptr<Prefs_source> source(Prefs_source::open(prefs_path, error));
+    if (!source)
+    {
+      return false;
+    }
+
+    source->set_header_lines(year == "2016" ? 2 : 1);
+
+    Chunk_feed chunk_feed(*source, 4 * 1024 * 1024);
+    Ballot_batch_queue batch_queue(4 * num_threads);
+    QList<Parse_thread*> parse_threads;
+
+    for (int i = 0; i < num_threads; i++)
+    {
+      Parse_thread* thread = new Parse_thread(chunk_feed, batch_queue, num_atl, num_btl, year != "2016", year == "2016");
+      parse_threads.append(thread);
+      thread->start();
+    }
+
+    bool ok = true;
+
+    while (ok)
+    {
+      Ballot_batch* batch = batch_queue.pop_next();
+      if (batch == nullptr)
+      {
+        break;
+      }
+
+      const int num_ballots = batch->ballots.size();
+
+      for (int k = 0; ok && k < num_ballots; k++)
+      {
+        const Parsed_ballot& ballot = batch->ballots[k];
+        ok = add_ballot(ballot, batch->prefs.data() + ballot.prefs_offset);
+      }
+
+      if (ok && batch->parse_error)
+      {
+        error = "Couldn't parse line " + QString::fromUtf8(batch->error_line);
+        ok    = false;
+      }
+
+      delete batch;
+    }
+
+    batch_queue.abort();
+    for (Parse_thread* thread : parse_threads)
+    {
+      thread->wait();
+      delete thread;
+    }
+
+    if (ok && source->has_error())
+    {
+      error = source->error();
+      ok    = false;
+    }
+
+    return ok;
+  }
+} // namespace
+
+// Everything that follows from the ballot tables, once the changed booths'
+// ballots, aggregates and formal votes are in.  It all starts again from
+// the tables, so an update left unfinished can run it again.
+static int finish_update(QSqlDatabase& db, Bulk_writer& writer, const Ingest_options& options, bool cluster_booths,
+                         const QStringList& table_names, const QList<int>& table_max_prefs, Ingest_log& out)
+{
+  QSqlQuery query(db);
+
+  // ~~~~~ Totals that follow from the booths' ~~~~~
+  // SQLite evaluates every SET against the old row, so formal_votes is
+  // summed after the other two.
+  if (!query.exec("UPDATE seats SET formal_votes = (SELECT COALESCE(SUM(formal_votes), 0) FROM booths WHERE booths.seat = seats.seat)") ||
+      !query.exec("UPDATE basic_info SET atl_votes = (SELECT COALESCE(SUM(votes), 0) FROM atl_booth_p1), "
+                  "btl_votes = (SELECT COALESCE(SUM(votes), 0) FROM btl_booth_p1) WHERE id = 0") ||
+      !query.exec("UPDATE basic_info SET formal_votes = atl_votes + btl_votes WHERE id = 0") ||
+      !query.exec("UPDATE groups SET primaries = (SELECT COALESCE(SUM(votes), 0) FROM atl_booth_p1 WHERE P1 = groups.id)") ||
+      !query.exec("UPDATE candidates SET primaries = (SELECT COALESCE(SUM(votes), 0) FROM btl_booth_p1 WHERE P1 = candidates.id)"))
+  {
+    out << "Couldn't update vote totals: " << query.lastError().text() << endl;
+    return 1;
+  }
+
+  if (query.exec("SELECT formal_votes, atl_votes, btl_votes FROM basic_info WHERE id = 0") && query.next())
+  {
+    out << "Formal: " << query.value(0).toLongLong() << ", ATL: " << query.value(1).toLongLong() << ", BTL: " << query.value(2).toLongLong() << endl;
+  }
+
+  // ~~~~~ Everything built from the whole ballot tables ~~~~~
+  Ingest_options rebuild_options = options;
+  rebuild_options.cluster_booths = cluster_booths;
+
+  // A store that isn't rewritten would no longer match the ballots.
+  const QString store_file = Ballot_store::file_name_for(db.databaseName());
+  if (!options.ballot_store && QFileInfo(store_file).exists() && !QFile::remove(store_file))
+  {
+    out << "Couldn't remove out of date ballot store " << store_file << endl;
+    return 1;
+  }
+
+  // The replaced booths leave gaps in the ids, and their new ballots went
+  // on the end, but the explorer shares queries out between threads over
+  // ids 0 to rows - 1.  Putting the tables in booth order renumbers them
+  // anyway.
+  if (!rebuild_options.cluster_booths)
+  {
+    QString renumber_error;
+    if (!Booth_clustering::renumber(db, table_names, renumber_error))
+    {
+      out << renumber_error << endl;
+      return 1;
+    }
+  }
+
+  if (write_derived_tables(db, writer, rebuild_options, table_names, table_max_prefs, out) != 0)
+  {
+    return 1;
+  }
+
+  // The ids the explorer would split a query over have to hold exactly
+  // the ballots counted in basic_info.
+  for (const QString& table : table_names)
+  {
+    const QString votes_column = table + "_votes";
+
+    if (!query.exec(QString("SELECT (SELECT COUNT(*) FROM %1 WHERE id BETWEEN 0 AND %2 - 1), %2 FROM basic_info WHERE id = 0")
+                      .arg(table, votes_column)) ||
+        !query.next())
+    {
+      out << "Couldn't count the ballots in " << table << ": " << query.lastError().text() << endl;
+      return 1;
+    }
+
+    if (query.value(0).toLongLong() != query.value(1).toLongLong())
+    {
+      out << "ERROR: ids 0 to " << (query.value(1).toLongLong() - 1) << " of " << table << " hold " << query.value(0).toLongLong()
+          << " ballots, not " << query.value(1).toLongLong() << endl;
+      return 1;
+    }
+  }
+
+  // Only now is the update finished.
+  if (!query.exec(QString("DROP TABLE IF EXISTS %1").arg(PENDING_TABLE)))
+  {
+    out << "Couldn't drop " << PENDING_TABLE << ": " << query.lastError().text() << endl;
+    return 1;
+  }
+
+  query.finish();
+
+  out << "Vacuuming" << endl;
+
+  if (!writer.finish_build())
+  {
+    out << "Couldn't finish bulk load: " << writer.last_error() << endl;
+    return 1;
+  }
+
+  return 0;
+}
+
+static int update_database(QSqlDatabase& db, const Ingest_options& options, const National_data& national, const QString& state,
+                           Ingest_log& out)
+{
+  const QString& year = national.year;
+
+  QSqlQuery query(db);
+
+  if (!query.exec("SELECT version FROM schema_version WHERE id = 0") || !query.next() ||
+      query.value(0).toInt() != Schema_indexes::SCHEMA_VERSION)
+  {
+    out << "ERROR: " << db.databaseName() << " is from an older version of this program; ingest it again with --overwrite" << endl;
+    return 1;
+  }
+
+  Bulk_writer writer(db);
+
+  if (!writer.is_native())
+  {
+    out << "Qt's SQLite isn't the one this program is linked against; writing through QSqlQuery instead" << endl;
+  }
+
+  // ~~~~~~ The seats and booths, with the ids they already have ~~~~~~
+  Ingest_dictionary dictionary;
+
+  if (!query.exec("SELECT seat FROM seats ORDER BY id"))
+  {
+    out << "Couldn't read seats: " << query.lastError().text() << endl;
+    return 1;
+  }
+
+  while (query.next())
+  {
+    dictionary.add_seat(query.value(0).toString());
+  }
+
+  QVector<long long> old_formal_votes;
+
+  if (!query.exec("SELECT seat, booth, formal_votes FROM booths ORDER BY id"))
+  {
+    out << "Couldn't read booths: " << query.lastError().text() << endl;
+    return 1;
+  }
+
+  while (query.next())
+  {
+    const int seat_id = dictionary.seat_id(query.value(0).toString());
+    if (seat_id < 0)
+    {
+      out << "ERROR: booth " << query.value(1).toString() << " is in an unknown seat" << endl;
+      return 1;
+    }
+
+    dictionary.add_existing_booth(seat_id, query.value(1).toString());
+    old_formal_votes.append(query.value(2).toLongLong());
+  }
+
+  const int existing_booths = dictionary.num_booths();
+
+  int num_atl = 0;
+  int num_btl = 0;
+
+  if (query.exec("SELECT COUNT(*) FROM groups") && query.next())
+  {
+    num_atl = query.value(0).toInt();
+  }
+
+  if (query.exec("SELECT COUNT(*) FROM candidates") && query.next())
+  {
+    num_btl = query.value(0).toInt();
+  }
+
+  QStringList table_names;
+  table_names << "atl" << "btl";
+
+  QList<int> table_max_prefs;
+  table_max_prefs << num_atl << num_btl;
+
+  // ~~~~~~ Digests of the ballots already in the file ~~~~~~
+  out << "Reading the booths' ballots from " << QFileInfo(db.databaseName()).fileName() << endl;
+
+  QVector<Booth_digest> old_digests(existing_booths);
+
+  for (int j = 0; j < 2; j++)
+  {
+    QString digest_error;
+    if (!read_digests(writer, table_names.at(j), j, table_max_prefs.at(j), old_digests, digest_error))
+    {
+      out << digest_error << endl;
+      return 1;
+    }
+  }
+
+  // ~~~~~~ Digests of the ballots in the new prefs file ~~~~~~
+  QString prefs_path;
+  for (const QString& file_name : Prefs_source::file_names(year + "_prefs_" + state))
+  {
+    prefs_path = QDir(options.aec_dir).filePath(file_name);
+    if (QFileInfo(prefs_path).exists())
+    {
+      break;
+    }
+  }
+
+  out << "Comparing with " << prefs_path << endl;
+
+  QVector<Booth_digest> new_digests(existing_booths);
+  QString prefs_error;
+
+  auto digest_ballot = [&](const Parsed_ballot& ballot, const int* prefs_ordered)
+  {
+    const int seat_id = dictionary.seat_id(ballot.seat, ballot.seat_length);
+    if (seat_id < 0)
+    {
+      prefs_error = "Couldn't find seat id for " + QString::fromUtf8(ballot.seat, ballot.seat_length);
+      return false;
+    }
+
+    // New booths are interned here, after the existing ones.
+    const int booth_id = dictionary.booth_id(seat_id, ballot.booth, ballot.booth_length);
+    add_to_digest(new_digests, booth_id, ballot.table, ballot_hash(ballot.table, ballot.num_valid_prefs, prefs_ordered));
+    return true;
+  };
+
+  const bool read_new = read_prefs(prefs_path, year, num_atl, num_btl, options.parse_threads, digest_ballot, prefs_error);
+
+  if (!read_new)
+  {
+    out << "ERROR: " << prefs_error << endl;
+    return 1;
+  }
+
+  const int num_booths = dictionary.num_booths();
+  new_digests.resize(num_booths);
+  old_digests.resize(num_booths);
+
+  QVector<bool> booth_changed(num_booths, false);
+  QList<int> changed_booths;
+
+  for (int i = 0; i < num_booths; i++)
+  {
+    const long long old_votes = i < existing_booths ? old_formal_votes.at(i) : -1;
+
+    if (!(old_digests.at(i) == new_digests.at(i)) || old_votes != new_digests.at(i).formal_votes())
+    {
+      booth_changed[i] = true;
+      changed_booths.append(i);
+    }
+  }
+
+  const bool pending = db.tables().indexOf(PENDING_TABLE) >= 0;
+
+  // A file that was put in booth order stays in booth order, including
+  // one that an unfinished update left part way through the rebuild.
+  bool cluster_booths = options.cluster_booths || db.tables().contains(Booth_clustering::ranges_table_for(table_names.first()));
+
+  if (pending && query.exec(QString("SELECT cluster_booths FROM %1 WHERE id = 0").arg(PENDING_TABLE)) && query.next())
+  {
+    cluster_booths = cluster_booths || query.value(0).toBool();
+  }
+
+  if (changed_booths.isEmpty() && !pending)
+  {
+    out << "No booths have changed" << endl;
+    return 0;
+  }
+
+  if (changed_booths.isEmpty())
+  {
+    out << "No booths have changed, but the last update didn't finish; rebuilding the tables that follow from the ballots" << endl;
+
+    if (!writer.begin_build())
+    {
+      out << "Couldn't set bulk-load pragmas: " << writer.last_error() << endl;
+      return 1;
+    }
+
+    query.finish();
+    return finish_update(db, writer, options, cluster_booths, table_names, table_max_prefs, out);
+  }
+
+  out << changed_booths.length() << " of " << num_booths << " booths have changed, " << (num_booths - existing_booths) << " of them new" << endl;
+
+  if (!writer.begin_build())
+  {
+    out << "Couldn't set bulk-load pragmas: " << writer.last_error() << endl;
+    return 1;
+  }
+
+  // ~~~~~~ The changed booths' ballots, replaced ~~~~~~
+  QList<long long> next_ids;
+
+  for (int j = 0; j < 2; j++)
+  {
+    QString sql_prepare("INSERT INTO " + table_names.at(j) + " VALUES(?, ?, ?, ?");
+    for (int i = 0; i < table_max_prefs.at(j); i++)
+    {
+      sql_prepare += ", ?, ?";
+    }
+    sql_prepare += ")";
+
+    if (!writer.prepare_insert(j, sql_prepare))
+    {
+      out << "Couldn't prepare insert for " << table_names.at(j) << ": " << writer.last_error() << endl;
+      return 1;
+    }
+
+    if (!query.exec(QString("SELECT COALESCE(MAX(id), -1) + 1 FROM %1").arg(table_names.at(j))) || !query.next())
+    {
+      out << "Couldn't read the last id of " << table_names.at(j) << endl;
+      return 1;
+    }
+
+    next_ids.append(query.value(0).toLongLong());
+  }
+
+  query.finish();
+
+  QStringList id_list;
+  for (int booth_id : changed_booths)
+  {
+    id_list.append(QString::number(booth_id));
+  }
+
+  // The old rows and the new go in one transaction, so a failed update
+  // leaves the ballots as they were.  So does the pending marker, which
+  // stays until everything built from the ballots has been rebuilt.
+  if (!writer.begin_transaction() ||
+      !writer.exec(QString("CREATE TABLE IF NOT EXISTS %1 (id INTEGER PRIMARY KEY, cluster_booths INTEGER)").arg(PENDING_TABLE)) ||
+      !writer.exec(QString("INSERT OR REPLACE INTO %1 VALUES (0, %2)").arg(PENDING_TABLE).arg(cluster_booths ? 1 : 0)) ||
+      !writer.exec(QString("DELETE FROM atl WHERE booth_id IN (%1)").arg(id_list.join(", "))) ||
+      !writer.exec(QString("DELETE FROM btl WHERE booth_id IN (%1)").arg(id_list.join(", "))))
+  {
+    out << "Couldn't delete the changed booths' ballots: " << writer.last_error() << endl;
+    return 1;
+  }
+
+  out << "Writing the changed booths' ballots" << endl;
+
+  Booth_aggregates booth_aggregates(2);
+  Ballot_quality ballot_quality(2);
+
+  auto write_ballot = [&](const Parsed_ballot& ballot, const int* prefs_ordered)
+  {
+    const int seat_id  = dictionary.seat_id(ballot.seat, ballot.seat_length);
+    const int booth_id = dictionary.booth_id(seat_id, ballot.booth, ballot.booth_length);
+
+    if (!booth_changed.at(booth_id))
+    {
+      return true;
+    }
+
+    const int max_prefs  = ballot.table == Ballot_parser::BTL ? num_btl : num_atl;
+    const int* prefs_for = prefs_ordered + max_prefs;
+
+    booth_aggregates.add(ballot.table, booth_id, prefs_ordered[0], max_prefs > 1 ? prefs_ordered[1] : Ballot_parser::NO_PREF);
+    ballot_quality.add(booth_id, ballot);
+
+    if (!writer.insert_ballot(ballot.table, next_ids[ballot.table]++, seat_id, booth_id, ballot.num_valid_prefs,
+                              prefs_ordered, prefs_for, max_prefs))
+    {
+      prefs_error = "Error at insert exec: " + writer.last_error();
+      return false;
+    }
+
+    return true;
+  };
+
+  const bool wrote_new = read_prefs(prefs_path, year, num_atl, num_btl, options.parse_threads, write_ballot, prefs_error);
+
+  if (!wrote_new)
+  {
+    out << "ERROR: " << prefs_error << endl;
+    writer.exec("ROLLBACK");
+    return 1;
+  }
+
+  if (!writer.commit())
+  {
+    out << "couldn't commit: " << writer.last_error() << endl;
+    return 1;
+  }
+
+  // New booths from the prefs file, as unlisted booths are in an ingest.
+  db.transaction();
+  query.prepare("INSERT OR REPLACE INTO booths VALUES(?, ?, ?, ?, ?, ?)");
+
+  for (int i = existing_booths; i < num_booths; i++)
+  {
+    query.addBindValue(i);
+    query.addBindValue(dictionary.seat_name(dictionary.booth_seat_id(i)));
+    query.addBindValue(dictionary.booth_name(i));
+    query.addBindValue(0.);
+    query.addBindValue(0.);
+    query.addBindValue(0);
+
+    if (!query.exec())
+    {
+      out << "couldn't bind new booth" << endl;
+      return 1;
+    }
+  }
+
+  if (!db.commit())
+  {
+    out << "Couldn't commit new booths" << endl;
+    return 1;
+  }
+
+  // ~~~~~ Per-booth P1 and P1 x P2 counts, and counts of ballot defects ~~~~~
+  QString aggregates_error;
+  if (!booth_aggregates.write_booths(db, table_names, changed_booths, aggregates_error) ||
+      !ballot_quality.write_booths(db, table_names, changed_booths, aggregates_error))
+  {
+    out << aggregates_error << endl;
+    return 1;
+  }
+
+  // ~~~~~ Formal vote totals of the changed booths ~~~~~
+  db.transaction();
+
+  if (!query.prepare("UPDATE booths SET formal_votes = ? WHERE id = ?"))
+  {
+    out << "Couldn't prepare setting formal votes for booths" << endl;
+    return 1;
+  }
+
+  for (int booth_id : changed_booths)
+  {
+    query.addBindValue(new_digests.at(booth_id).formal_votes());
+    query.addBindValue(booth_id);
+
+    if (!query.exec())
+    {
+      out << "Couldn't update booths formal votes" << endl;
+      return 1;
+    }
+  }
+
+  if (!db.commit())
+  {
+    out << "Couldn't commit booths formal votes" << endl;
+    return 1;
+  }
+
+  query.finish();
+
+  return finish_update(db, writer, options, cluster_booths, table_names, table_max_prefs, out);
+}
+
+
+int update_state(const Ingest_options& options, const National_data& national, const QString& state)
+{
+  const QString& year = national.year;
+  const QString db_file = QDir(options.out_dir).filePath(year + "_" + state + ".sqlite");
+
+  if (!QFileInfo(db_file).exists())
+  {
+    return ingest_state(options, national, state);
+  }
+
+  Ingest_log out(year + " " + state);
+
+  const QString connection_name = QString("update_%1_%2").arg(year, state);
+  int result;
+
+  // The following is inside its own scope so that the database can be
+  // removed properly: https://doc.qt.io/qt-5/qsqldatabase.html#removeDatabase
+  {
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connection_name);
+    db.setDatabaseName(db_file);
+
+    if (!db.open())
+    {
+      out << "Couldn't open db " << db_file << endl;
+      result = 1;
+    }
+    else if (Ingest_checkpoint::exists(db))
+    {
+      out << "Output file " << db_file << " is unfinished; finish it with --resume before updating it" << endl;
+      result = 1;
+      db.close();
+    }
+    else
+    {
+      result = update_database(db, options, national, state, out);
+      db.close();
+    }
+  }
+
+  QSqlDatabase::removeDatabase(connection_name);
+
+  if (result == 0)
+  {
+    out << "end" << endl;
+  }
+
+  return result;
+}
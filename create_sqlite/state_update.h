@@ -0,0 +1,49 @@
+#ifndef STATE_UPDATE_H
+#define STATE_UPDATE_H
+
+// With --update, an existing <year>_<state>.sqlite is brought up to date
+// with a newer prefs file (the AEC republishes them as counts are
+// corrected) instead of being built again.
+//
+// Each booth's ballots are summarised by a digest: the number of ballots
+// in each table, and the sum of a 64-bit hash of each ballot's table and
+// preference sequence, so it doesn't depend on the order of the ballots.
+// The digests of the ballots already in the file are compared with those
+// of the new file, and only the booths that differ are rewritten: their
+// rows are deleted from atl and btl and their ballots in the new file
+// inserted, in one transaction.  A booth's formal_votes is updated last,
+// so one left behind by a failed update still counts as changed.  The
+// ballot tables are then renumbered from 0 in id order (or put in booth
+// order again), as the explorer expects ids 0 to rows - 1, and checked
+// against the new totals.
+//
+// Then the precomputed tables are brought into line: the booth P1 and
+// P1 x P2 counts and ballot quality of the changed booths, the booths',
+// seats' and state's formal votes, and the groups' and candidates'
+// primaries (from the booth P1 counts).  Everything built from the whole
+// ballot tables (the metadata blob, booth order, weighted tables, indexes
+// and ballot store) is then rebuilt, as at the end of an ingest.
+//
+// An update_pending table (which also records whether the file is in booth
+// order) is created in the same transaction as the new ballots, and
+// dropped only once all of that has been done.  If an update
+// fails after the ballots are in, the next one finds no booth changed, but
+// sees update_pending and does the rest again.
+//
+// booths.csv isn't read again; booths that are new in the prefs file are
+// added as unlisted booths, and booths that have gone keep their row,
+// with no votes.
+
+#include "national_data.h"
+#include "state_ingest.h"
+
+#include <QString>
+
+// Updates <out_dir>/<year>_<state>.sqlite from <aec_dir>/<year>_prefs_<state>.csv,
+// or ingests it from scratch if there's no such file yet.  Returns 0 on
+// success, including when nothing has changed.
+//
+// Safe to call for several states at once from different threads.
+int update_state(const Ingest_options& options, const National_data& national, const QString& state);
+
+#endif // STATE_UPDATE_H
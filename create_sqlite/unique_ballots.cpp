@@ -0,0 +1,103 @@
+#include "unique_ballots.h"
+
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QVariant>
+
+namespace Unique_ballots
+{
+  QString table_for(const QString& table)
+  {
+    return table + "_unique";
+  }
+
+  bool build(QSqlDatabase& db, const QStringList& table_names, const QList<int>& table_num_groups, QStringList& kept_tables, QString& error)
+  {
+    QSqlQuery query(db);
+    kept_tables.clear();
+
+    for (int j = 0; j < table_names.length(); j++)
+    {
+      const QString& table       = table_names.at(j);
+      const QString unique_table = table_for(table);
+      const int n                = table_num_groups.at(j);
+
+      QString create  = QString("CREATE TABLE %1 (id INTEGER PRIMARY KEY, seat_id INTEGER, booth_id INTEGER, weight INTEGER, num_prefs INTEGER").arg(unique_table);
+      QString columns = "seat_id, booth_id, num_prefs";
+      QString pfor_columns;
+
+      for (int i = 0; i < n; i++)
+      {
+        create += QString(", P%1 INTEGER").arg(i + 1);
+        columns += QString(", P%1").arg(i + 1);
+      }
+
+      for (int i = 0; i < n; i++)
+      {
+        create += QString(", Pfor%1 INTEGER").arg(i);
+        pfor_columns += QString(", Pfor%1").arg(i);
+      }
+
+      create += ")";
+
+      // Rows are only collapsed if every column the explorer can query is
+      // the same, Pfor included: the parser makes Pfor the inverse of the
+      // P columns, but a file built before it did may have Pfor = 0 for
+      // an unreadable mark.  The ids are numbered from 0, as in the ballot
+      // tables: the explorer shares a table out between threads by id,
+      // over 0 to rows - 1.
+      const QString insert = QString("INSERT INTO %1 (id, %2%3, weight) SELECT ROW_NUMBER() OVER (ORDER BY %2%3) - 1, %2%3, COUNT(*) "
+                                     "FROM %4 GROUP BY %2%3 ORDER BY %2%3")
+                               .arg(unique_table, columns, pfor_columns, table);
+
+      if (!query.exec(QString("DROP TABLE IF EXISTS %1").arg(unique_table)) || !query.exec(create))
+      {
+        error = QString("Couldn't create %1: %2").arg(unique_table, query.lastError().text());
+        return false;
+      }
+
+      db.transaction();
+
+      if (!query.exec(insert))
+      {
+        error = QString("Couldn't fill %1: %2").arg(unique_table, query.lastError().text());
+        db.rollback();
+        return false;
+      }
+
+      if (!db.commit())
+      {
+        error = QString("Couldn't commit %1").arg(unique_table);
+        return false;
+      }
+
+      long long num_ballots = 0;
+      long long num_unique  = 0;
+
+      if (query.exec(QString("SELECT COUNT(*) FROM %1").arg(table)) && query.next())
+      {
+        num_ballots = query.value(0).toLongLong();
+      }
+
+      if (query.exec(QString("SELECT COUNT(*) FROM %1").arg(unique_table)) && query.next())
+      {
+        num_unique = query.value(0).toLongLong();
+      }
+
+      if (num_unique > MAX_ROW_FRACTION * num_ballots)
+      {
+        if (!query.exec(QString("DROP TABLE %1").arg(unique_table)))
+        {
+          error = QString("Couldn't drop %1: %2").arg(unique_table, query.lastError().text());
+          return false;
+        }
+      }
+      else
+      {
+        kept_tables.append(table);
+      }
+    }
+
+    return true;
+  }
+} // namespace Unique_ballots
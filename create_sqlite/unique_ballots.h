@@ -0,0 +1,34 @@
+#ifndef UNIQUE_BALLOTS_H
+#define UNIQUE_BALLOTS_H
+
+// The ballot tables with identical ballots from the same booth collapsed
+// into one row, counted by weight:
+//
+//   CREATE TABLE atl_unique (id INTEGER PRIMARY KEY, seat_id INTEGER, booth_id INTEGER, weight INTEGER,
+//                            num_prefs INTEGER, P1, P2, ..., Pfor0, Pfor1, ...)
+//
+// and the same for btl.  ATL ballots repeat a lot ("1" only, how-to-votes,
+// donkey votes), so the explorer reads these instead, summing weight where
+// it would count rows.  A table is only kept if it comes out at no more
+// than MAX_ROW_FRACTION of the ballots; BTL ballots are mostly unique, and
+// a copy that isn't much smaller isn't worth the space.
+
+#include <QList>
+#include <QSqlDatabase>
+#include <QString>
+#include <QStringList>
+
+namespace Unique_ballots
+{
+  const double MAX_ROW_FRACTION = 0.75;
+
+  // "atl" -> "atl_unique"
+  QString table_for(const QString& table);
+
+  // Creates (or recreates) <table>_unique for each table, and drops the
+  // ones that don't shrink enough; kept_tables gets the names of the ballot
+  // tables that have one.  Returns false and sets error on failure.
+  bool build(QSqlDatabase& db, const QStringList& table_names, const QList<int>& table_num_groups, QStringList& kept_tables, QString& error);
+} // namespace Unique_ballots
+
+#endif // UNIQUE_BALLOTS_H
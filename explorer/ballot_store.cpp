@@ -0,0 +1,446 @@
+#include "ballot_store.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BALLOT_STORE_AVX2
+#endif
+
+namespace
+{
+  const int HEADER_SIZE      = 16;
+  const int TABLE_ENTRY_SIZE = 64;
+  const int RANGE_SIZE       = 16;
+
+  qint64 align_64(qint64 offset)
+  {
+    return (offset + 63) & ~static_cast<qint64>(63);
+  }
+
+#ifdef BALLOT_STORE_AVX2
+  bool have_avx2()
+  {
+    static const bool have = __builtin_cpu_supports("avx2");
+    return have;
+  }
+
+  // Eight values at a time: gather the 32 bits from the byte each value
+  // starts in, shift each lane by where the value starts in its byte, and
+  // mask it off.  Reads up to 3 bytes past the last value.  Returns how
+  // many values it did (a multiple of 8), for the caller to finish.
+  __attribute__((target("avx2"))) int decode_avx2(const uchar* column, int bits, int none, int first_row, int count, int* out)
+  {
+    const __m256i lanes   = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i mask    = _mm256_set1_epi32(none);
+    const __m256i no_pref = _mm256_set1_epi32(999);
+    const __m256i seven   = _mm256_set1_epi32(7);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+      const __m256i rows  = _mm256_add_epi32(_mm256_set1_epi32(first_row + i), lanes);
+      const __m256i bit   = _mm256_mullo_epi32(rows, _mm256_set1_epi32(bits));
+      const __m256i bytes = _mm256_srli_epi32(bit, 3);
+      const __m256i shift = _mm256_and_si256(bit, seven);
+
+      __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int*>(column), bytes, 1);
+      v         = _mm256_and_si256(_mm256_srlv_epi32(v, shift), mask);
+      v         = _mm256_blendv_epi8(v, no_pref, _mm256_cmpeq_epi32(v, mask));
+
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), v);
+    }
+
+    return i;
+  }
+#endif
+} // namespace
+
+QVector<Ballot_store_range> Ballot_store_table::ranges_for_rows(int begin, int end) const
+{
+  QVector<Ballot_store_range> ranges;
+
+  for (const Ballot_store_range& range : _ranges)
+  {
+    if (range.end <= begin || range.begin >= end)
+    {
+      continue;
+    }
+
+    Ballot_store_range part = range;
+    part.begin              = qMax(range.begin, begin);
+    part.end                = qMin(range.end, end);
+    ranges.append(part);
+  }
+
+  return ranges;
+}
+
+QVector<Ballot_store_range> Ballot_store_table::ranges_for_seat(int seat_id) const
+{
+  QVector<Ballot_store_range> ranges;
+
+  for (const Ballot_store_range& range : _ranges)
+  {
+    if (range.seat_id == seat_id)
+    {
+      ranges.append(range);
+    }
+  }
+
+  return ranges;
+}
+
+void Ballot_store_table::read_ballot(int row, int* prefs_for, int* num_prefs, int* prefs) const
+{
+  const int n = _value(_num_prefs, row);
+  *num_prefs  = n;
+
+  const uchar* p = _prefs;
+  for (int i = 0; i < _num_columns; i++)
+  {
+    prefs[i] = _value(p, row);
+    p += _column_bytes;
+  }
+
+  invert_prefs(prefs, n, _num_columns, prefs_for);
+}
+
+Row_bitmap Ballot_store_table::pref_bitmap(int group, int pref) const
+{
+  if (group < 0 || group >= _num_columns || pref < 1 || pref > _bitmap_prefs)
+  {
+    return Row_bitmap();
+  }
+
+  return _bitmap(_bitmap_prefs * group + pref - 1);
+}
+
+Row_bitmap Ballot_store_table::num_prefs_bitmap(int n) const
+{
+  if (n < 0 || n > _num_columns)
+  {
+    return Row_bitmap();
+  }
+
+  return _bitmap(_num_columns * _bitmap_prefs + n);
+}
+
+Row_bitmap Ballot_store_table::_bitmap(int i) const
+{
+  Row_bitmap bitmap;
+  if (_bitmap_offsets == nullptr)
+  {
+    return bitmap;
+  }
+
+  // An offset of 0 is an empty bitmap.  A bad one reads as empty too; the
+  // offsets aren't all checked when the file is opened.
+  const quint64 offset = qFromLittleEndian<quint64>(_bitmap_offsets + 8 * i);
+  if (offset != 0 && offset < static_cast<quint64>(_data_end - _data))
+  {
+    bitmap.read(_data + offset, _data_end);
+  }
+
+  return bitmap;
+}
+
+void Ballot_store_table::decode(int column, int first_row, int count, int* out) const
+{
+  const uchar* data = column < 0 ? _num_prefs : _prefs + column * _column_bytes;
+  int done          = 0;
+
+#ifdef BALLOT_STORE_AVX2
+  // The gather reads 4 bytes from where each value starts, which has to
+  // stay inside the column.
+  const qint64 last_byte = (static_cast<qint64>(first_row + count - 1) * _bits) >> 3;
+  if (have_avx2() && last_byte + 4 <= _column_bytes)
+  {
+    done = decode_avx2(data, _bits, _none, first_row, count, out);
+  }
+#endif
+
+  for (int i = done; i < count; i++)
+  {
+    out[i] = _value(data, first_row + i);
+  }
+}
+
+void Ballot_store_table::invert_prefs(const int* prefs, int num_prefs, int num_columns, int* prefs_for)
+{
+  // A scatter, one store per preference given.  Comparing every P against
+  // every group would vectorise, but costs num_columns times as much,
+  // which for 150 BTL candidates is far more than the scatter.
+  std::fill(prefs_for, prefs_for + num_columns, 999);
+
+  const int n = qMin(num_prefs, num_columns);
+  for (int k = 0; k < n; k++)
+  {
+    const int group = prefs[k];
+    if (group >= 0 && group < num_columns)
+    {
+      prefs_for[group] = k + 1;
+    }
+  }
+}
+
+Ballot_store_block_reader::Ballot_store_block_reader(const Ballot_store_table* table)
+  : _table(table)
+  , _begin(0)
+  , _end(0)
+  , _block_columns(0)
+  , _num_prefs(table == nullptr ? 0 : BLOCK_ROWS)
+  , _prefs(table == nullptr ? 0 : BLOCK_ROWS * table->num_columns())
+{
+}
+
+void Ballot_store_block_reader::read_ballot(int row, int* prefs_for, int* num_prefs, int* prefs)
+{
+  if (row < _begin || row >= _end)
+  {
+    _decode_block(row);
+  }
+
+  const int i           = row - _begin;
+  const int num_columns = _table->num_columns();
+  const int n           = _num_prefs.at(i);
+  *num_prefs            = n;
+
+  const int* block = _prefs.constData() + i;
+  for (int k = 0; k < _block_columns; k++)
+  {
+    prefs[k] = block[k * BLOCK_ROWS];
+  }
+  std::fill(prefs + _block_columns, prefs + num_columns, 999);
+
+  Ballot_store_table::invert_prefs(prefs, n, num_columns, prefs_for);
+}
+
+void Ballot_store_block_reader::_decode_block(int row)
+{
+  _begin          = row;
+  _end            = qMin(row + BLOCK_ROWS, _table->num_rows());
+  const int count = _end - _begin;
+
+  _table->decode(-1, _begin, count, _num_prefs.data());
+
+  // Past the longest ballot in the block, every P is 999, so those
+  // columns needn't be unpacked at all.  For BTL, that's most of them.
+  int max_prefs = 0;
+  for (int i = 0; i < count; i++)
+  {
+    max_prefs = qMax(max_prefs, _num_prefs.at(i));
+  }
+
+  _block_columns = qMin(max_prefs, _table->num_columns());
+
+  for (int k = 0; k < _block_columns; k++)
+  {
+    _table->decode(k, _begin, count, _prefs.data() + k * BLOCK_ROWS);
+  }
+}
+
+Ballot_store::Ballot_store()
+  : _data(nullptr)
+  , _base(nullptr)
+{
+}
+
+Ballot_store::~Ballot_store()
+{
+  close();
+}
+
+QString Ballot_store::file_name_for(const QString& db_file)
+{
+  QString file_name = db_file;
+  if (file_name.endsWith(".sqlite"))
+  {
+    file_name.chop(7);
+  }
+
+  return file_name + ".spx";
+}
+
+bool Ballot_store::open(const QString& file_name, QString& error)
+{
+  close();
+
+  _file.setFileName(file_name);
+  if (!_file.open(QIODevice::ReadOnly))
+  {
+    error = QString("Couldn't open %1").arg(file_name);
+    return false;
+  }
+
+  const qint64 file_size = _file.size();
+  if (file_size < HEADER_SIZE)
+  {
+    error = QString("%1 is too short").arg(file_name);
+    close();
+    return false;
+  }
+
+  _data = _file.map(0, file_size);
+  if (_data == nullptr)
+  {
+    error = QString("Couldn't map %1").arg(file_name);
+    close();
+    return false;
+  }
+
+  if (!_read(_data, file_size, file_name, error))
+  {
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+bool Ballot_store::open_in(const uchar* data, qint64 size, const QString& name, QString& error)
+{
+  close();
+
+  if (size < HEADER_SIZE)
+  {
+    error = QString("%1 is too short").arg(name);
+    return false;
+  }
+
+  if (!_read(data, size, name, error))
+  {
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+bool Ballot_store::_read(const uchar* data, qint64 file_size, const QString& file_name, QString& error)
+{
+  _base = data;
+
+  const int version    = qFromLittleEndian<quint32>(_base + 4);
+  const int num_tables = qFromLittleEndian<quint32>(_base + 8);
+
+  if (std::memcmp(_base, "SPX", 4) != 0 || version != VERSION || HEADER_SIZE + TABLE_ENTRY_SIZE * static_cast<qint64>(num_tables) > file_size)
+  {
+    error = QString("%1 isn't a ballot store this version can read").arg(file_name);
+    return false;
+  }
+
+  for (int j = 0; j < num_tables; j++)
+  {
+    const uchar* entry = _base + HEADER_SIZE + TABLE_ENTRY_SIZE * j;
+
+    Ballot_store_table table;
+    table._name         = QString::fromLatin1(reinterpret_cast<const char*>(entry), qstrnlen(reinterpret_cast<const char*>(entry), 8));
+    table._num_rows     = qFromLittleEndian<quint32>(entry + 8);
+    table._num_columns  = qFromLittleEndian<quint32>(entry + 12);
+
+    const int bits     = qFromLittleEndian<quint32>(entry + 16);
+    const bool bits_ok = bits >= 1 && bits <= 16;
+
+    table._bits         = bits_ok ? bits : 8;
+    table._none         = (1 << table._bits) - 1;
+    table._column_bytes = align_64((static_cast<qint64>(table._num_rows) * table._bits + 7) / 8 + 8);
+
+    const int num_ranges            = qFromLittleEndian<quint32>(entry + 20);
+    const quint64 ranges_offset     = qFromLittleEndian<quint64>(entry + 24);
+    const quint64 num_prefs_offset  = qFromLittleEndian<quint64>(entry + 32);
+    const quint64 prefs_offset      = qFromLittleEndian<quint64>(entry + 40);
+    const quint64 weight_offset     = qFromLittleEndian<quint64>(entry + 48);
+    const quint64 bitmaps_offset    = qFromLittleEndian<quint64>(entry + 56);
+    const quint64 size              = static_cast<quint64>(file_size);
+    const quint64 all_columns_bytes = static_cast<quint64>(table._column_bytes) * table._num_columns;
+
+    if (!bits_ok || ranges_offset + RANGE_SIZE * static_cast<quint64>(num_ranges) > size ||
+        num_prefs_offset + table._column_bytes > size || prefs_offset + all_columns_bytes > size ||
+        weight_offset + 4 * static_cast<quint64>(table._num_rows) > size)
+    {
+      error = QString("%1 is truncated or corrupt").arg(file_name);
+      return false;
+    }
+
+    const uchar* range_data = _base + ranges_offset;
+    for (int i = 0; i < num_ranges; i++)
+    {
+      Ballot_store_range range;
+      range.seat_id  = qFromLittleEndian<quint32>(range_data);
+      range.booth_id = qFromLittleEndian<quint32>(range_data + 4);
+      range.begin    = qFromLittleEndian<quint32>(range_data + 8);
+      range.end      = qFromLittleEndian<quint32>(range_data + 12);
+      range_data += RANGE_SIZE;
+
+      if (range.begin > range.end || range.end > table._num_rows)
+      {
+        error = QString("%1 has a bad row range").arg(file_name);
+        return false;
+      }
+
+      table._ranges.append(range);
+    }
+
+    table._num_prefs = _base + num_prefs_offset;
+    table._prefs     = _base + prefs_offset;
+    table._weights   = weight_offset == 0 ? nullptr : _base + weight_offset;
+    table._data      = _base;
+    table._data_end  = _base + file_size;
+
+    if (bitmaps_offset != 0)
+    {
+      // The bitmap index starts with the number of preferences indexed and
+      // the number of bitmaps, and then an offset for each bitmap.
+      const quint64 num_bitmaps = bitmaps_offset + 8 <= size ? qFromLittleEndian<quint32>(_base + bitmaps_offset + 4) : 0;
+      table._bitmap_prefs       = bitmaps_offset + 8 <= size ? qFromLittleEndian<quint32>(_base + bitmaps_offset) : 0;
+
+      if (table._bitmap_prefs > table._num_columns ||
+          num_bitmaps != static_cast<quint64>(table._num_columns) * table._bitmap_prefs + table._num_columns + 1 ||
+          bitmaps_offset + 8 + 8 * num_bitmaps > size)
+      {
+        error = QString("%1 has a bad bitmap index").arg(file_name);
+        return false;
+      }
+
+      table._bitmap_offsets = _base + bitmaps_offset + 8;
+    }
+
+    for (int row = 0; row < table._num_rows; row++)
+    {
+      table._total_weight += table.weight(row);
+    }
+
+    _tables.append(table);
+  }
+
+  return true;
+}
+
+void Ballot_store::close()
+{
+  _tables.clear();
+  _base = nullptr;
+
+  if (_data != nullptr)
+  {
+    _file.unmap(_data);
+    _data = nullptr;
+  }
+
+  _file.close();
+}
+
+const Ballot_store_table* Ballot_store::table(const QString& name) const
+{
+  for (const Ballot_store_table& table : _tables)
+  {
+    if (table._name == name)
+    {
+      return &table;
+    }
+  }
+
+  return nullptr;
+}
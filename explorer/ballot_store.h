@@ -0,0 +1,218 @@
+#ifndef BALLOT_STORE_H
+#define BALLOT_STORE_H
+
+// Read-only view of a <year>_<state>.spx file, the columnar copy of the atl
+// and btl tables that create_senate_sqlite writes next to the database (the
+// layout is described in create_sqlite/ballot_store.h).  The file is memory-
+// mapped, so the workers can all scan it at once without opening the
+// database or decoding SQLite records.
+//
+// The rows are in seat and booth order, with one range of rows per booth.
+// The values are bit-packed; Ballot_store_block_reader unpacks a block of
+// rows at a time, for the scans that read every ballot.
+
+#include "row_bitmap.h"
+
+#include <QFile>
+#include <QString>
+#include <QVector>
+#include <QtEndian>
+
+struct Ballot_store_range
+{
+  int seat_id;
+  int booth_id;
+  int begin;
+  int end;
+};
+
+class Ballot_store_table
+{
+public:
+  const QString& name() const { return _name; }
+  int num_rows() const { return _num_rows; }
+  int num_columns() const { return _num_columns; }
+
+  // In a weighted table, a row can stand for several identical ballots.
+  bool is_weighted() const { return _weights != nullptr; }
+  qint64 total_weight() const { return _total_weight; }
+  int weight(int row) const { return _weights == nullptr ? 1 : static_cast<int>(qFromLittleEndian<quint32>(_weights + 4 * static_cast<qint64>(row))); }
+
+  // One range per booth, in seat and booth order.
+  const QVector<Ballot_store_range>& ranges() const { return _ranges; }
+
+  // The booth ranges cut down to the rows [begin, end), for splitting a
+  // scan between threads.
+  QVector<Ballot_store_range> ranges_for_rows(int begin, int end) const;
+  QVector<Ballot_store_range> ranges_for_seat(int seat_id) const;
+
+  // Values as in the database: 999 for no preference.
+  int num_prefs(int row) const { return _value(_num_prefs, row); }
+  int pref(int i, int row) const { return _value(_prefs + i * _column_bytes, row); }
+
+  // Pfor0, ..., Pfor(N-1) to prefs_for, num_prefs to *num_prefs and
+  // P1, ..., PN to prefs.  The Pfor values are worked out from the P
+  // values, which gives the same as the database: the ingest writes 999
+  // for every square outside the valid sequence, unreadable marks included.
+  void read_ballot(int row, int* prefs_for, int* num_prefs, int* prefs) const;
+
+  // Sets prefs_for[P<k>] = k for the first num_prefs preferences, and 999
+  // for every other group or candidate.
+  static void invert_prefs(const int* prefs, int num_prefs, int num_columns, int* prefs_for);
+
+  // The values of rows [first_row, first_row + count) of num_prefs
+  // (column -1) or P<column + 1>, to out.
+  void decode(int column, int first_row, int count, int* out) const;
+
+  // The rows where P<pref> = group (pref from 1), and the rows with
+  // num_prefs = n, from the bitmap index.  Empty if there's no such row,
+  // or no index.
+  bool has_bitmaps() const { return _bitmap_offsets != nullptr; }
+  Row_bitmap pref_bitmap(int group, int pref) const;
+  Row_bitmap num_prefs_bitmap(int n) const;
+
+private:
+  friend class Ballot_store;
+
+  int _value(const uchar* column, int row) const
+  {
+    // Every column has 8 spare bytes at the end, so one 64-bit load always
+    // covers the value.
+    const qint64 bit = static_cast<qint64>(row) * _bits;
+    const int v      = static_cast<int>((qFromLittleEndian<quint64>(column + (bit >> 3)) >> (bit & 7)) & _none);
+
+    return v == _none ? 999 : v;
+  }
+
+  Row_bitmap _bitmap(int i) const;
+
+  QString _name;
+  int _num_rows = 0;
+  int _num_columns = 0;
+  int _bits = 8;
+  int _none = 0xff; // All bits set
+  qint64 _column_bytes = 0;
+  QVector<Ballot_store_range> _ranges;
+  const uchar* _num_prefs = nullptr;
+  const uchar* _prefs = nullptr;
+  const uchar* _weights = nullptr;
+  qint64 _total_weight = 0;
+  const uchar* _data = nullptr;
+  const uchar* _data_end = nullptr;
+  const uchar* _bitmap_offsets = nullptr;
+  int _bitmap_prefs = 0;
+};
+
+// Steps through the rows of a list of ranges:
+//
+//   Ballot_store_cursor cursor(ranges);
+//   while (cursor.next()) { ... cursor.row() ... cursor.booth_id() ... }
+class Ballot_store_cursor
+{
+public:
+  explicit Ballot_store_cursor(const QVector<Ballot_store_range>& ranges)
+    : _ranges(ranges)
+    , _range(-1)
+    , _row(0)
+    , _end(0)
+  {
+  }
+
+  bool next()
+  {
+    if (++_row < _end)
+    {
+      return true;
+    }
+
+    while (++_range < _ranges.length())
+    {
+      _row = _ranges.at(_range).begin;
+      _end = _ranges.at(_range).end;
+      if (_row < _end)
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  int row() const { return _row; }
+  int booth_id() const { return _ranges.at(_range).booth_id; }
+  int seat_id() const { return _ranges.at(_range).seat_id; }
+
+private:
+  const QVector<Ballot_store_range>& _ranges;
+  int _range;
+  int _row;
+  int _end;
+};
+
+// Reads the ballots of a table a block of rows at a time: each block's
+// num_prefs and P columns are unpacked together (with AVX2 where the CPU
+// has it), and only as far as the longest ballot in the block.
+//
+//   Ballot_store_block_reader reader(table);
+//   while (cursor.next()) { reader.read_ballot(cursor.row(), ...); ... }
+class Ballot_store_block_reader
+{
+public:
+  static const int BLOCK_ROWS = 64;
+
+  // table may be null, for a worker that isn't reading a store; then
+  // read_ballot() mustn't be called.
+  explicit Ballot_store_block_reader(const Ballot_store_table* table);
+
+  // As Ballot_store_table::read_ballot().  Rows are best read in order.
+  void read_ballot(int row, int* prefs_for, int* num_prefs, int* prefs);
+
+private:
+  void _decode_block(int row);
+
+  const Ballot_store_table* _table;
+  int _begin;
+  int _end;
+  int _block_columns;
+  QVector<int> _num_prefs;
+  QVector<int> _prefs; // BLOCK_ROWS values per column
+};
+
+class Ballot_store
+{
+public:
+  // The version of create_sqlite/ballot_store.h, the only one that can be
+  // read.
+  static const int VERSION = 1;
+
+  Ballot_store();
+  ~Ballot_store();
+
+  // <year>_<state>.sqlite -> <year>_<state>.spx
+  static QString file_name_for(const QString& db_file);
+
+  // Maps the file and checks its header.  Returns false and sets error if
+  // it can't be used; the store is then closed.
+  bool open(const QString& file_name, QString& error);
+
+  // As open(), for a store that's already in memory, e.g. inside an
+  // election archive (election_archive.h), which has to stay mapped for as
+  // long as the store is open.  name is just for errors.
+  bool open_in(const uchar* data, qint64 size, const QString& name, QString& error);
+
+  void close();
+  bool is_open() const { return _base != nullptr; }
+
+  // nullptr if the store isn't open or has no such table.
+  const Ballot_store_table* table(const QString& name) const;
+
+private:
+  bool _read(const uchar* data, qint64 file_size, const QString& file_name, QString& error);
+
+  QFile _file;
+  uchar* _data;       // The mapping, if open() made one
+  const uchar* _base; // The start of the store
+  QVector<Ballot_store_table> _tables;
+};
+
+#endif // BALLOT_STORE_H
@@ -0,0 +1,140 @@
+#include "election_archive.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+#include <QtEndian>
+
+#include <cstring>
+
+namespace
+{
+  const int HEADER_SIZE = 32;
+  const int ENTRY_SIZE  = 64;
+} // namespace
+
+Election_archive::Election_archive()
+  : _data(nullptr)
+{
+}
+
+Election_archive::~Election_archive()
+{
+  close();
+}
+
+bool Election_archive::open(const QString& file_name, QString& error)
+{
+  close();
+
+  _file.setFileName(file_name);
+  if (!_file.open(QIODevice::ReadOnly))
+  {
+    error = QString("Couldn't open %1").arg(file_name);
+    return false;
+  }
+
+  const qint64 file_size = _file.size();
+  if (file_size < HEADER_SIZE)
+  {
+    error = QString("%1 is too short").arg(file_name);
+    close();
+    return false;
+  }
+
+  _data = _file.map(0, file_size);
+  if (_data == nullptr)
+  {
+    error = QString("Couldn't map %1").arg(file_name);
+    close();
+    return false;
+  }
+
+  const int version            = qFromLittleEndian<quint32>(_data + 4);
+  const int num_elections      = qFromLittleEndian<quint32>(_data + 8);
+  const quint64 strings_offset = qFromLittleEndian<quint64>(_data + 16);
+  const quint64 strings_size   = qFromLittleEndian<quint64>(_data + 24);
+  const quint64 size           = static_cast<quint64>(file_size);
+
+  if (std::memcmp(_data, "SPA", 4) != 0 || version != VERSION || num_elections < 0 ||
+      HEADER_SIZE + ENTRY_SIZE * static_cast<qint64>(num_elections) > file_size || strings_offset + strings_size > size)
+  {
+    error = QString("%1 isn't an election archive this version can read").arg(file_name);
+    close();
+    return false;
+  }
+
+  const QByteArray string_data =
+    qUncompress(QByteArray::fromRawData(reinterpret_cast<const char*>(_data + strings_offset), static_cast<int>(strings_size)));
+  QDataStream in(string_data);
+  in.setVersion(QDataStream::Qt_5_6);
+  in >> _strings;
+
+  if (in.status() != QDataStream::Ok)
+  {
+    error = QString("%1 has a corrupt string table").arg(file_name);
+    close();
+    return false;
+  }
+
+  // The .sqlite files are found from where the archive is now.
+  const QDir archive_dir = QFileInfo(file_name).absoluteDir();
+
+  for (int i = 0; i < num_elections; i++)
+  {
+    const uchar* entry            = _data + HEADER_SIZE + ENTRY_SIZE * i;
+    const quint32 state           = qFromLittleEndian<quint32>(entry + 4);
+    const quint32 db_file         = qFromLittleEndian<quint32>(entry + 8);
+    const quint64 metadata_offset = qFromLittleEndian<quint64>(entry + 16);
+    const quint64 metadata_size   = qFromLittleEndian<quint64>(entry + 24);
+    const quint64 store_offset    = qFromLittleEndian<quint64>(entry + 32);
+    const quint64 store_size      = qFromLittleEndian<quint64>(entry + 40);
+
+    if (state >= static_cast<quint32>(_strings.length()) || db_file >= static_cast<quint32>(_strings.length()) ||
+        metadata_offset + metadata_size > size || store_offset + store_size > size)
+    {
+      error = QString("%1 has a bad directory entry").arg(file_name);
+      close();
+      return false;
+    }
+
+    Archive_election election;
+    election.year          = static_cast<int>(qFromLittleEndian<quint32>(entry));
+    election.state         = _strings.at(state);
+    election.db_file       = QDir::cleanPath(archive_dir.absoluteFilePath(_strings.at(db_file)));
+    election.metadata      = _data + metadata_offset;
+    election.metadata_size = static_cast<qint64>(metadata_size);
+    election.store         = store_size == 0 ? nullptr : _data + store_offset;
+    election.store_size    = static_cast<qint64>(store_size);
+    election.content_id    = qFromLittleEndian<quint32>(entry + 12);
+    election.atl_ids       = qFromLittleEndian<quint32>(entry + 48);
+    election.btl_ids       = qFromLittleEndian<quint32>(entry + 52);
+    election.atl_votes     = qFromLittleEndian<quint32>(entry + 56);
+    election.btl_votes     = qFromLittleEndian<quint32>(entry + 60);
+    _elections.append(election);
+  }
+
+  _file_name = file_name;
+  return true;
+}
+
+void Election_archive::close()
+{
+  _elections.clear();
+  _strings.clear();
+  _file_name.clear();
+
+  if (_data != nullptr)
+  {
+    _file.unmap(_data);
+    _data = nullptr;
+  }
+
+  _file.close();
+}
+
+QByteArray Election_archive::metadata_body(int i) const
+{
+  const Archive_election& election = _elections.at(i);
+  return qUncompress(QByteArray::fromRawData(reinterpret_cast<const char*>(election.metadata), static_cast<int>(election.metadata_size)));
+}
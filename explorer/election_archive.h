@@ -0,0 +1,70 @@
+#ifndef ELECTION_ARCHIVE_H
+#define ELECTION_ARCHIVE_H
+
+// Reads a .spa archive of many elections (the layout is in
+// create_sqlite/election_archive.h): a directory of the elections, one
+// table of strings shared by all of them, and each election's metadata and
+// ballot store.  The file is mapped once, when it's opened, and the strings
+// are read then too, so switching elections costs only that election's
+// metadata.
+//
+// Once open, it's only read, so the loading thread can use it while the
+// GUI thread holds it.
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+struct Archive_election
+{
+  int year;
+  QString state;
+  QString db_file; // Absolute
+  const uchar* metadata;
+  qint64 metadata_size;
+  const uchar* store; // nullptr if it has none
+  qint64 store_size;
+
+  // What the .sqlite file had when the archive was written; the metadata
+  // and store only go with a file that still has them.
+  quint32 content_id; // Its user_version
+  quint32 atl_ids;    // MAX(id) + 1
+  quint32 btl_ids;
+  quint32 atl_votes;
+  quint32 btl_votes;
+};
+
+class Election_archive
+{
+public:
+  static const int VERSION = 1;
+
+  Election_archive();
+  ~Election_archive();
+
+  // Maps the file and reads its directory and strings.  Returns false and
+  // sets error if it can't be used; the archive is then closed.
+  bool open(const QString& file_name, QString& error);
+  void close();
+  bool is_open() const { return _data != nullptr; }
+
+  const QString& file_name() const { return _file_name; }
+  int num_elections() const { return _elections.length(); }
+  const Archive_election& election(int i) const { return _elections.at(i); }
+  const QStringList& strings() const { return _strings; }
+
+  // The election's metadata body, uncompressed (see metadata_blob.h in
+  // create_sqlite); its strings are indexes in strings().
+  QByteArray metadata_body(int i) const;
+
+private:
+  QFile _file;
+  QString _file_name;
+  uchar* _data;
+  QStringList _strings;
+  QVector<Archive_election> _elections;
+};
+
+#endif // ELECTION_ARCHIVE_H
@@ -7,6 +7,31 @@ CREATE TABLE candidates (id INTEGER PRIMARY KEY, group_letter TEXT, group_pos IN
 CREATE TABLE atl (id INTEGER PRIMARY KEY, seat_id INTEGER, booth_id INTEGER, num_prefs INTEGER, P1, P2, ..., Pfor0, Pfor1, ...)
 CREATE TABLE btl (id INTEGER PRIMARY KEY, seat_id INTEGER, booth_id INTEGER, num_prefs INTEGER, P1, P2, ..., Pfor0, Pfor1, ...)
 CREATE TABLE boundaries (id INTEGER PRIARY KEY, boundaries_csv TEXT)
+
+Files from the current create_sqlite also have (schema version 2):
+CREATE TABLE schema_version (id INTEGER PRIMARY KEY, version INTEGER)
+CREATE TABLE schema_indexes (id INTEGER PRIMARY KEY, table_name TEXT, index_name TEXT, kind TEXT, columns TEXT)
+CREATE TABLE atl_booth_p1 (booth_id INTEGER, P1 INTEGER, votes INTEGER, PRIMARY KEY (booth_id, P1))
+CREATE TABLE atl_booth_p1_p2 (booth_id INTEGER, P1 INTEGER, P2 INTEGER, votes INTEGER, PRIMARY KEY (booth_id, P1, P2))
+CREATE TABLE atl_unique (id INTEGER PRIMARY KEY, seat_id INTEGER, booth_id INTEGER, weight INTEGER, num_prefs INTEGER, P1, P2, ..., Pfor0, Pfor1, ...)
+CREATE TABLE atl_booth_rows (booth_id INTEGER PRIMARY KEY, seat_id INTEGER, first_id INTEGER, last_id INTEGER)
+CREATE TABLE ballot_quality (booth_id INTEGER, table_name TEXT, ballots INTEGER, ended_by_duplicate INTEGER, ended_by_gap INTEGER, with_duplicate INTEGER, with_gap INTEGER, with_unreadable INTEGER, with_discarded_prefs INTEGER, btl_marks_ignored INTEGER, PRIMARY KEY (booth_id, table_name))
+CREATE TABLE metadata_blob (id INTEGER PRIMARY KEY, version INTEGER, data BLOB)
+and likewise for btl, and basic_info has atl_votes and btl_votes after
+formal_votes.  <table>_unique (identical ballots from a booth collapsed
+into one row; counted with SUM(weight)) is only there where it's worth keeping,
+and <table>_booth_rows only for the tables in booth order.  The ids of every
+ballot table run from 0 to rows - 1.
+
+A <year>_<state>.spx file next to the database, if there is one, holds the atl
+and btl ballots again in columns (see ballot_store.h); the custom-table workers
+scan it instead of querying atl or btl when they can, and Step-forward columns
+are read from a prefix trie over it (prefix_trie.h).  Its bitmap indexes pick
+out the ballots for First-n and Later prefs columns.  Without a store,
+Step-forward columns past the booth aggregates, and First-n and Later prefs
+columns, are counted from the ballot table's P columns, read into memory
+(step_forward_engine.h).  So are n-party-preferred columns, with or without a
+store, in place of the SQL's pairwise Pfor comparisons.
 */
 
 #include "main_widget.h"
@@ -17,11 +42,13 @@ CREATE TABLE boundaries (id INTEGER PRIARY KEY, boundaries_csv TEXT)
 #include "math.h"
 #include "table_type_constants.h"
 #include "table_window.h"
+#include "worker_load_database.h"
 #include "worker_sql_cross_table.h"
 #include "worker_sql_custom_every_expr.h"
 #include "worker_sql_custom_table.h"
 #include "worker_sql_main_table.h"
 #include "worker_sql_npp_table.h"
+#include "worker_step_forward.h"
 
 // Layout etc.:
 #include <QApplication>
@@ -127,6 +154,7 @@ Widget::Widget(QWidget* parent)
   // query):
   qRegisterMetaType<QVector<QVector<QVector<int>>>>("QVector<QVector<QVector<int>>>");
   qRegisterMetaType<QVector<QVector<int>>>("QVector<QVector<int>>");
+  qRegisterMetaType<Database_metadata>("Database_metadata");
 
   // Required to allow the QML to talk to the model containing the polygons:
   qmlRegisterType<Polygon_model>("Division_boundaries", 1, 0, "PolygonManager");
@@ -166,8 +194,13 @@ Widget::Widget(QWidget* parent)
   _label_load = new QLabel(this);
   _label_load->setText("No file loaded");
 
+  // Only shown when an archive of several elections is open:
+  _combo_election = new QComboBox(this);
+  _combo_election->hide();
+
   layout_load->addWidget(_button_load);
   layout_load->addWidget(_label_load);
+  layout_load->addWidget(_combo_election);
 
   layout_left->addLayout(layout_load);
   layout_left->setAlignment(layout_load, Qt::AlignTop);
@@ -889,6 +922,7 @@ Widget::Widget(QWidget* parent)
   container_widget_right->setLayout(layout_right);
 
   connect(_button_load,                        &QPushButton::clicked,                                this, &Widget::_open_database);
+  connect(_combo_election,                     QOverload<int>::of(&QComboBox::currentIndexChanged),  this, &Widget::_change_election);
   connect(_combo_abtl,                         QOverload<int>::of(&QComboBox::currentIndexChanged),  this, &Widget::_change_abtl);
   connect(_combo_table_type,                   QOverload<int>::of(&QComboBox::currentIndexChanged),  this, &Widget::_change_table_type);
   connect(_combo_value_type,                   QOverload<int>::of(&QComboBox::currentIndexChanged),  this, &Widget::_change_value_type);
@@ -1034,7 +1068,7 @@ void Widget::_reset_spinboxes()
 void Widget::_open_database()
 {
   const QString file_name = QFileDialog::getOpenFileName(
-    this, QString(), _latest_path, QString("*.sqlite"));
+    this, QString(), _latest_path, QString("Preferences (*.sqlite *.spa)"));
 
   if (file_name.isNull())
   {
@@ -1045,11 +1079,80 @@ void Widget::_open_database()
   if (check_exists.exists() && check_exists.isFile())
   {
     _latest_path = check_exists.absolutePath();
-    _load_database(file_name);
+
+    if (check_exists.suffix() == "spa")
+    {
+      _open_archive(file_name);
+    }
+    else
+    {
+      _close_archive();
+      _load_database(file_name);
+    }
+  }
+}
+
+void Widget::_open_archive(const QString& archive_file)
+{
+  _close_archive();
+
+  QString error;
+  if (!_archive.open(archive_file, error) || _archive.num_elections() == 0)
+  {
+    QMessageBox msg_box;
+    msg_box.setText(QString("Error: %1").arg(error.isEmpty() ? QString("%1 has no elections in it").arg(archive_file) : error));
+    msg_box.exec();
+
+    _archive.close();
+    return;
+  }
+
+  _combo_election->blockSignals(true);
+  for (int i = 0; i < _archive.num_elections(); i++)
+  {
+    const Archive_election& election = _archive.election(i);
+    _combo_election->addItem(QString("%1 %2").arg(election.year).arg(election.state));
+  }
+  _combo_election->setCurrentIndex(0);
+  _combo_election->blockSignals(false);
+  _combo_election->show();
+
+  _load_database(_archive.election(0).db_file, 0);
+}
+
+void Widget::_close_archive()
+{
+  if (!_archive.is_open())
+  {
+    return;
+  }
+
+  // The store and the tries point into the archive's mapping.
+  _atl_trie.reset(nullptr);
+  _btl_trie.reset(nullptr);
+  _ballot_store.close();
+
+  _archive_metadata.clear();
+  _archive_election = -1;
+  _archive.close();
+
+  _combo_election->blockSignals(true);
+  _combo_election->clear();
+  _combo_election->blockSignals(false);
+  _combo_election->hide();
+}
+
+void Widget::_change_election(int i)
+{
+  if (_doing_calculation || i < 0 || i >= _archive.num_elections() || i == _archive_election)
+  {
+    return;
   }
+
+  _load_database(_archive.election(i).db_file, i);
 }
 
-void Widget::_load_database(const QString& db_file)
+void Widget::_load_database(const QString& db_file, int archive_election)
 {
   // Get rid of any data that might exist:
   _clear_main_table_data();
@@ -1063,331 +1166,202 @@ void Widget::_load_database(const QString& db_file)
   _cand_from_short.clear();
   _group_from_candidate.clear();
   _candidates_per_group.clear();
+  _db_indexes.clear();
+  _schema_version = 1;
+  _has_booth_aggregates = false;
+  _unique_table_rows.clear();
+  _seat_id_ranges.clear();
+  _atl_trie.reset(nullptr);
+  _btl_trie.reset(nullptr);
+  _atl_engine.reset();
+  _btl_engine.reset();
+  _ballot_store.close();
   _custom_main_table_col_sorting_col = -1;
   _clear_col_widths();
   _reset_spinboxes();
+  _opened_database  = false;
+  _archive_election = archive_election;
 
-  bool errors = false;
-  QString error_msg;
-  QString connection_name("conn");
-
+  // An election from the archive that's been opened before is already
+  // unpacked.
+  if (archive_election >= 0 && _archive_metadata.contains(archive_election))
   {
-    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connection_name);
-    db.setDatabaseName(db_file);
+    _process_loaded_database(_archive_metadata.value(archive_election));
+    return;
+  }
 
-    if (!db.open())
-    {
-      errors    = true;
-      error_msg = QString("Error: couldn't open database.");
-    }
+  // Everything but the ballots is read on another thread, from the
+  // metadata blob if the file has one (see worker_load_database.h), or
+  // from the archive.
+  _lock_main_interface();
+  _label_load->setText("Loading...");
 
-    if (!errors)
-    {
-      QStringList tables = db.tables();
-      if (tables.indexOf("basic_info") < 0 || tables.indexOf("candidates") < 0 || tables.indexOf("groups") < 0 || tables.indexOf("seats") < 0 ||
-          tables.indexOf("booths") < 0 || tables.indexOf("atl") < 0 || tables.indexOf("btl") < 0)
-      {
-        errors    = true;
-        error_msg = QString("Error: database is not formatted correctly.");
-      }
-    }
+  QThread* thread              = new QThread;
+  Worker_load_database* worker = new Worker_load_database(db_file, archive_election >= 0 ? &_archive : nullptr, archive_election);
+  worker->moveToThread(thread);
 
-    QSqlQuery query(db);
+  connect(thread, &QThread::started,                     worker, &Worker_load_database::do_load);
+  connect(worker, &Worker_load_database::finished_load,  this,   &Widget::_process_loaded_database);
+  connect(worker, &Worker_load_database::error,          this,   &Widget::_process_load_error);
+  connect(worker, &Worker_load_database::finished_load,  thread, &QThread::quit);
+  connect(worker, &Worker_load_database::error,          thread, &QThread::quit);
+  connect(thread, &QThread::finished,                    worker, &Worker_load_database::deleteLater);
+  connect(thread, &QThread::finished,                    thread, &QThread::deleteLater);
 
-    if (!errors)
-    {
-      if (!query.exec("SELECT state, state_full, year, formal_votes, atl_votes, btl_votes FROM basic_info"))
-      {
-        errors    = true;
-        error_msg = "Couldn't read basic information from database";
-      }
-      else
-      {
-        query.next();
-        _state_short        = query.value(0).toString();
-        _state_full         = query.value(1).toString();
-        _year               = query.value(2).toInt();
-        _total_formal_votes = query.value(3).toInt();
-        _total_atl_votes    = query.value(4).toInt();
-        _total_btl_votes    = query.value(5).toInt();
+  thread->start();
+}
 
-        _label_load->setText(QString("%1 %2").arg(_state_short).arg(_year));
-      }
-    }
+void Widget::_process_load_error(const QString& error_msg)
+{
+  _unlock_main_interface();
 
-    if (!errors)
-    {
-      // *** Error-handling needs to be much better in here ***
-      // e.g., even after detecting an error, the code continues to run....
+  QMessageBox msg_box;
+  msg_box.setText(QString("Error: %1").arg(error_msg));
+  msg_box.exec();
 
-      if (!query.exec("SELECT COUNT(*) FROM groups"))
-      {
-        errors    = true;
-        error_msg = "Couldn't count number of groups";
-      }
-      else
-      {
-        query.next();
-        _num_groups = query.value(0).toInt();
-      }
+  _opened_database    = false;
+  _database_file_path = "";
+  _label_load->setText("No file selected");
 
-      if (!query.exec("SELECT COUNT(*) FROM candidates"))
-      {
-        errors    = true;
-        error_msg = "Couldn't count number of candidates";
-      }
-      else
-      {
-        query.next();
-        _num_cands = query.value(0).toInt();
-      }
-    }
+  _button_cross_table->setEnabled(false);
+  _button_abbreviations->setEnabled(false);
+  _button_divisions_copy->setEnabled(false);
+  _button_divisions_export->setEnabled(false);
+  _button_divisions_booths_export->setEnabled(false);
+  _button_divisions_cross_table->setEnabled(false);
+  _button_booths_cross_table->setEnabled(false);
+  _button_calculate_custom->setEnabled(false);
 
-    if (!errors)
-    {
-      if (!query.exec("SELECT party, party_ab FROM groups ORDER BY id"))
-      {
-        errors    = true;
-        error_msg = "Couldn't read party names";
-      }
-      else
-      {
-        _atl_groups.clear();
-        _atl_groups_short.clear();
-        int i = 0;
+  _clear_divisions_table();
+}
 
-        while (query.next())
-        {
-          const QString group_short = query.value(1).toString();
-          _atl_groups.append(query.value(0).toString());
-          _atl_groups_short.append(group_short);
-          _group_from_short.insert(group_short, i);
-          i++;
-        }
-      }
-    }
+void Widget::_process_loaded_database(const Database_metadata& metadata)
+{
+  _unlock_main_interface();
 
-    if (!errors)
-    {
-      if (!query.exec("SELECT party_ab, group_letter, group_pos, candidate FROM candidates ORDER BY id"))
-      {
-        errors    = true;
-        error_msg = "Couldn't read candidate names";
-      }
-      else
-      {
-        _btl_names.clear();
-        _btl_names_short.clear();
-        int i     = 0;
-        int group = -1;
+  if (_archive_election >= 0)
+  {
+    _archive_metadata.insert(_archive_election, metadata);
+  }
 
-        while (query.next())
-        {
-          QString this_party(query.value(0).toString());
-          if (query.value(1).toString() == "UG")
-          {
-            this_party = "UG";
-          }
+  _state_short          = metadata.state_short;
+  _state_full           = metadata.state_full;
+  _year                 = metadata.year;
+  _total_formal_votes   = metadata.total_formal_votes;
+  _total_atl_votes      = metadata.total_atl_votes;
+  _total_btl_votes      = metadata.total_btl_votes;
+  _schema_version       = metadata.schema_version;
+  _db_indexes           = metadata.db_indexes;
+  _has_booth_aggregates = metadata.has_booth_aggregates;
+  _unique_table_rows    = metadata.unique_table_rows;
+  _seat_id_ranges       = metadata.seat_id_ranges;
+  _atl_groups           = metadata.atl_groups;
+  _atl_groups_short     = metadata.atl_groups_short;
+  _btl_names            = metadata.btl_names;
+  _btl_names_short      = metadata.btl_names_short;
+  _group_from_candidate = metadata.group_from_candidate;
+  _divisions            = metadata.divisions;
+  _division_bboxes      = metadata.division_bboxes;
+  _booths               = metadata.booths;
+  _num_groups           = _atl_groups.length();
+  _num_cands            = _btl_names.length();
 
-          QString full_name   = query.value(3).toString();
-          const int comma_pos = full_name.indexOf(",");
-          if (comma_pos >= 0)
-          {
-            int n = 1;
-            if (comma_pos == full_name.indexOf(", "))
-            {
-              n = 2;
-            }
-            full_name.replace(comma_pos, n, ",\n");
-          }
+  _label_load->setText(QString("%1 %2").arg(_state_short).arg(_year));
 
-          const QVariant group_pos = query.value(2);
-          const QString short_name = this_party + "_" + group_pos.toString();
-          if (group_pos.toInt() == 1)
-          {
-            group++;
-            _candidates_per_group.push_back(std::vector<int>());
-          }
-          _btl_names.append(full_name);
-          _btl_names_short.append(short_name);
-          _cand_from_short.insert(short_name, i);
-          _group_from_candidate.append(group);
-          _candidates_per_group[group].push_back(i);
-          i++;
-        }
-        // Empty list of candidates for Exhaust
-        _candidates_per_group.push_back(std::vector<int>());
-      }
-    }
+  for (int i = 0; i < _num_groups; i++)
+  {
+    _group_from_short.insert(_atl_groups_short.at(i), i);
+  }
 
-    if (!errors)
+  for (int i = 0; i < _num_cands; i++)
+  {
+    const int group = _group_from_candidate.at(i);
+    while (static_cast<int>(_candidates_per_group.size()) <= group)
     {
-      if (!query.exec("SELECT seat, formal_votes FROM seats ORDER BY id"))
-      {
-        errors    = true;
-        error_msg = "Couldn't read divisions";
-      }
-      else
-      {
-        // The changed() signal from the divisions combobox will be emitted
-        // if it's not blocked, leading to a potential crash when the program
-        // tries to update the table but the data is missing.
-        _combo_division->blockSignals(true);
-        _combo_division->clear();
-
-        _divisions.clear();
-        _division_bboxes.clear();
-
-        // The bounding box for each division will be set based
-        // on its election-day booths; initialise the bounds so
-        // that they'll be updated from the first read of a booth
-        // coordinate:
-        Bounding_box bbox;
-        bbox.min_latitude  = 0.;
-        bbox.max_latitude  = -80;
-        bbox.min_longitude = 180.;
-        bbox.max_longitude = 0.;
-
-        QFont font = _table_divisions->font();
-        QFontMetrics font_metrics(font);
-        static const int min_width_division_header = font_metrics.boundingRect("Division").width();
-        _table_divisions_first_col_width = min_width_division_header;
-
-        while (query.next())
-        {
-          QString div(query.value(0).toString());
-          _divisions.append(div);
-          _combo_division->addItem(div);
-          _division_formal_votes.append(query.value(1).toInt());
-          _division_bboxes.append(bbox);
-
-          _table_divisions_first_col_width = qMax(_table_divisions_first_col_width, font_metrics.boundingRect(div).width());
-        }
-        _combo_division->addItem(_state_full);
-        _combo_division->setCurrentIndex(_divisions.length());
-
-        font.setBold(true);
-        QFontMetrics bold_metrics(font);
-        // Fudging the padding needed for both Windows and Mac (on my computers at least):
-        _table_divisions_first_col_width = 5 + CELL_TEXT_BUFFER + qMax(_table_divisions_first_col_width, bold_metrics.boundingRect(_state_full).width());
-
-        _division_formal_votes.append(_total_formal_votes);
-        _combo_division->blockSignals(false);
-      }
+      _candidates_per_group.push_back(std::vector<int>());
     }
 
-    if (!errors)
-    {
-      if (!query.exec("SELECT id, seat, booth, lon, lat, formal_votes FROM booths ORDER BY id"))
-      {
-        errors    = true;
-        error_msg = "Couldn't read booths";
-      }
-      else
-      {
-        _booths.clear();
-
-        int i = 0;
+    _cand_from_short.insert(_btl_names_short.at(i), i);
+    _candidates_per_group[group].push_back(i);
+  }
+  // Empty list of candidates for Exhaust
+  _candidates_per_group.push_back(std::vector<int>());
 
-        while (query.next())
-        {
-          Booth this_booth;
-          this_booth.id       = query.value(0).toInt();
-          this_booth.division = query.value(1).toString();
+  // The changed() signal from the divisions combobox will be emitted
+  // if it's not blocked, leading to a potential crash when the program
+  // tries to update the table but the data is missing.
+  _combo_division->blockSignals(true);
+  _combo_division->clear();
 
-          // I was worried that 3000 indexOf's would be slow, but it's fine:
-          this_booth.division_id = _divisions.indexOf(this_booth.division);
+  QFont font = _table_divisions->font();
+  QFontMetrics font_metrics(font);
+  static const int min_width_division_header = font_metrics.boundingRect("Division").width();
+  _table_divisions_first_col_width = min_width_division_header;
 
-          this_booth.booth        = query.value(2).toString();
-          this_booth.longitude    = query.value(3).toDouble();
-          this_booth.latitude     = query.value(4).toDouble();
-          this_booth.formal_votes = query.value(5).toInt();
+  for (const QString& div : _divisions)
+  {
+    _combo_division->addItem(div);
+    _table_divisions_first_col_width = qMax(_table_divisions_first_col_width, font_metrics.boundingRect(div).width());
+  }
+  _combo_division->addItem(_state_full);
+  _combo_division->setCurrentIndex(_divisions.length());
 
-          if (i != this_booth.id)
-          {
-            errors    = true;
-            error_msg = "Booth ID's not as expected";
-            break;
-          }
+  font.setBold(true);
+  QFontMetrics bold_metrics(font);
+  // Fudging the padding needed for both Windows and Mac (on my computers at least):
+  _table_divisions_first_col_width = 5 + CELL_TEXT_BUFFER + qMax(_table_divisions_first_col_width, bold_metrics.boundingRect(_state_full).width());
 
-          if (this_booth.division_id < 0)
-          {
-            errors    = true;
-            error_msg = QString("Error reading booths; couldn't find %1 in %2")
-                          .arg(this_booth.booth, this_booth.division);
-            break;
-          }
+  _division_formal_votes = metadata.division_formal_votes;
+  _division_formal_votes.append(_total_formal_votes);
+  _combo_division->blockSignals(false);
 
-          // Update bounding box based on election-day booths with non-zero lon/lat:
-          if (!this_booth.booth.contains("PPVC") && !this_booth.booth.contains("PREPOLL", Qt::CaseInsensitive) &&
-              !this_booth.booth.contains("Sydney (") && !this_booth.booth.contains("Adelaide (") && !this_booth.booth.contains("Perth (") &&
-              !this_booth.booth.contains("Brisbane City (") && !this_booth.booth.contains("Hobart (") && !this_booth.booth.contains("Melbourne ("))
-          {
-            if (this_booth.latitude < -1. && this_booth.longitude > 1. && this_booth.formal_votes > 0)
-            {
-              const int j                       = this_booth.division_id;
-              _division_bboxes[j].max_latitude  = qMax(_division_bboxes[j].max_latitude, this_booth.latitude);
-              _division_bboxes[j].min_latitude  = qMin(_division_bboxes[j].min_latitude, this_booth.latitude);
-              _division_bboxes[j].max_longitude = qMax(_division_bboxes[j].max_longitude, this_booth.longitude);
-              _division_bboxes[j].min_longitude = qMin(_division_bboxes[j].min_longitude, this_booth.longitude);
-            }
-          }
+  _opened_database    = true;
+  _database_file_path = metadata.db_file;
 
-          i++;
-          _booths.append(this_booth);
-        }
-      }
-    }
+  // The ballot store is optional; without it (or if it doesn't match
+  // the database), everything is read through SQL as before.  An archive
+  // has its elections' stores in it, as long as the file hasn't changed
+  // since it was written.
+  QString store_error;
+  bool store_open = false;
 
-    db.close();
+  if (metadata.from_archive)
+  {
+    const Archive_election& election = _archive.election(_archive_election);
+    store_open = election.store != nullptr && _ballot_store.open_in(election.store, election.store_size, _archive.file_name(), store_error);
   }
-
-  QSqlDatabase::removeDatabase(connection_name);
-
-  if (errors)
+  else
   {
-    QMessageBox msg_box;
-    msg_box.setText(QString("Error: %1").arg(error_msg));
-    msg_box.exec();
-
-    _opened_database    = false;
-    _database_file_path = "";
-    _label_load->setText("No file selected");
-
-    _button_cross_table->setEnabled(false);
-    _button_abbreviations->setEnabled(false);
-    _button_divisions_copy->setEnabled(false);
-    _button_divisions_export->setEnabled(false);
-    _button_divisions_booths_export->setEnabled(false);
-    _button_divisions_cross_table->setEnabled(false);
-    _button_booths_cross_table->setEnabled(false);
-    _button_calculate_custom->setEnabled(false);
+    store_open = _ballot_store.open(Ballot_store::file_name_for(_database_file_path), store_error);
+  }
 
-    _clear_divisions_table();
+  if (store_open)
+  {
+    const Ballot_store_table* atl = _ballot_store.table("atl");
+    const Ballot_store_table* btl = _ballot_store.table("btl");
 
-    return;
+    if (atl == nullptr || btl == nullptr || atl->total_weight() != _total_atl_votes || btl->total_weight() != _total_btl_votes ||
+        atl->num_columns() != _num_groups || btl->num_columns() != _num_cands)
+    {
+      _ballot_store.close();
+    }
   }
-  else
-  {
-    _opened_database    = true;
-    _database_file_path = db_file;
-    _set_table_groups();
-    const int current_num_groups = get_num_groups();
-    _spinbox_first_n_prefs->setMaximum(current_num_groups);
-    _spinbox_later_prefs_up_to->setMaximum(current_num_groups);
-    _spinbox_pref_sources_max->setMaximum(current_num_groups);
-    _spinbox_pref_sources_min->setMaximum(_get_pref_sources_max());
-    _spinbox_pref_sources_max->setMinimum(_get_pref_sources_min());
+  _set_table_groups();
+  const int current_num_groups = get_num_groups();
+  _spinbox_first_n_prefs->setMaximum(current_num_groups);
+  _spinbox_later_prefs_up_to->setMaximum(current_num_groups);
+  _spinbox_pref_sources_max->setMaximum(current_num_groups);
+  _spinbox_pref_sources_min->setMaximum(_get_pref_sources_max());
+  _spinbox_pref_sources_max->setMinimum(_get_pref_sources_min());
 
-    _button_calculate_custom->setEnabled(true);
+  _button_calculate_custom->setEnabled(true);
 
-    _map_divisions_model.setup_list(_database_file_path, _state_short, _year, _divisions);
-    _map_booths_model.setup_list(_booths, _get_map_booth_threshold());
+  _map_divisions_model.setup_list(_database_file_path, _state_short, _year, _divisions);
+  _map_booths_model.setup_list(_booths, _get_map_booth_threshold());
 
-    _setup_main_table();
+  _setup_main_table();
 
-    _add_column_to_main_table();
-  }
+  _add_column_to_main_table();
 }
 
 void Widget::_set_table_groups()
@@ -1682,7 +1656,7 @@ void Widget::_write_custom_operations_to_file()
   }
 }
 
-void Widget::_do_sql_query_for_table(const QString& q, bool wide_table)
+void Widget::_do_sql_query_for_table(const QString& q, bool wide_table, const QString& split_column)
 {
   // If wide_table is true, then the SQL query q should return a table with
   // one row per division, and one column per group.
@@ -1703,7 +1677,7 @@ void Widget::_do_sql_query_for_table(const QString& q, bool wide_table)
   const int num_booths         = _booths.length();
 
   int num_threads     = 1;
-  QStringList queries = _queries_threaded(q, num_threads);
+  QStringList queries = _queries_threaded_with_max(q, num_threads, -1, split_column);
 
   _current_threads   = num_threads;
   _completed_threads = 0;
@@ -1739,12 +1713,16 @@ QStringList Widget::_queries_threaded(const QString& q, int& num_threads, bool o
   return _queries_threaded_with_max(q, num_threads, one_thread ? 1 : -1);
 }
 
-QStringList Widget::_queries_threaded_with_max(const QString &q, int &num_threads, int max_threads)
+QStringList Widget::_queries_threaded_with_max(const QString &q, int &num_threads, int max_threads, const QString& split_column)
 {
-  const QString abtl   = get_abtl();
-  const int max_record = (abtl == "atl" ? _total_atl_votes : _total_btl_votes) - 1;
+  // split_column is the column whose range is shared out between the
+  // threads: id normally, booth_id when a covering index is led by it
+  // (see _split_column_for()), or empty for a single thread.
+  const QString abtl   = _ballot_table();
+  const int max_record = _unique_table_rows.value(abtl, get_abtl() == "atl" ? _total_atl_votes : _total_btl_votes) - 1;
+  const int max_split  = split_column == "booth_id" ? _booths.length() - 1 : max_record;
 
-  num_threads = max_record > 10000 ? QThread::idealThreadCount() : 1;
+  num_threads = (max_record > 10000 && !split_column.isEmpty()) ? QThread::idealThreadCount() : 1;
   if (max_threads > 0)
   {
     num_threads = qMin(num_threads, max_threads);
@@ -1761,10 +1739,10 @@ QStringList Widget::_queries_threaded_with_max(const QString &q, int &num_thread
 
   for (int i = 0; i < num_threads; i++)
   {
-    const int id_1 = (i == 0) ? 0 : max_record * i / num_threads + 1;
-    const int id_2 = max_record * (i + 1) / num_threads;
+    const int id_1 = (i == 0) ? 0 : max_split * i / num_threads + 1;
+    const int id_2 = max_split * (i + 1) / num_threads;
 
-    QString where_clause = QString("(id BETWEEN %1 AND %2)").arg(id_1).arg(id_2);
+    QString where_clause = QString("(%1 BETWEEN %2 AND %3)").arg(split_column).arg(id_1).arg(id_2);
 
     queries.append(q);
 
@@ -1780,6 +1758,442 @@ QStringList Widget::_queries_threaded_with_max(const QString &q, int &num_thread
   return queries;
 }
 
+QString Widget::_split_column_for(const QStringList& columns, const QStringList& where_columns)
+{
+  // Looks for an index on the current table that covers the query (every
+  // index has id in it too), and picks how to split the query to suit it.
+  //
+  // If the index is led by the WHERE columns (e.g. P1, P2 for
+  // WHERE P1 = a AND P2 = b), SQLite seeks straight to the rows, and one
+  // thread is enough.  If it's led by booth_id, each thread scans a range
+  // of booths in the index and the GROUP BY needs no sorting.  Otherwise,
+  // threads get ranges of the table by id, as before.
+  for (const QStringList& index : _db_indexes.value(_ballot_table()))
+  {
+    bool covers = true;
+    for (const QString& column : columns)
+    {
+      if (column != "id" && index.indexOf(column) < 0)
+      {
+        covers = false;
+        break;
+      }
+    }
+
+    if (!covers)
+    {
+      continue;
+    }
+
+    if (where_columns.isEmpty())
+    {
+      if (index.first() == "booth_id")
+      {
+        return "booth_id";
+      }
+    }
+    else if (where_columns.length() <= index.length())
+    {
+      bool leading = true;
+      for (int i = 0; i < where_columns.length(); i++)
+      {
+        if (where_columns.indexOf(index.at(i)) < 0)
+        {
+          leading = false;
+          break;
+        }
+      }
+
+      if (leading)
+      {
+        return "";
+      }
+    }
+  }
+
+  return "id";
+}
+
+QString Widget::_split_column_for_step_forward(int this_pref)
+{
+  // SELECT booth_id, P<this_pref>, ... WHERE P1 = a AND ... P<this_pref - 1> = b
+  QStringList columns;
+  QStringList where_columns;
+  columns << "booth_id";
+
+  for (int i = 1; i <= this_pref; i++)
+  {
+    columns << QString("P%1").arg(i);
+    if (i < this_pref)
+    {
+      where_columns << QString("P%1").arg(i);
+    }
+  }
+
+  return _split_column_for(columns, where_columns);
+}
+
+QString Widget::_booth_aggregate_query(int this_pref)
+{
+  // The first two Step-forward columns are precomputed by create_senate_sqlite
+  // (schema version 2), so they can be read rather than counted.  Returns an
+  // empty string if the file doesn't have them, or for later columns.
+  if (!_has_booth_aggregates || this_pref > 2)
+  {
+    return "";
+  }
+
+  if (this_pref == 1)
+  {
+    return QString("SELECT booth_id, P1, votes FROM %1_booth_p1").arg(get_abtl());
+  }
+
+  return QString("SELECT booth_id, P2, votes FROM %1_booth_p1_p2 WHERE P1 = %2").arg(get_abtl()).arg(_clicked_cells.at(0));
+}
+
+QString Widget::_ballot_table()
+{
+  // The weighted copy of the ballot table if there is one (schema version
+  // 2), where each row stands for weight identical ballots from a booth.
+  // Ballots are counted with _ballot_count() and summed with _ballot_sum(),
+  // which work on either table.
+  const QString unique_table = get_abtl() + "_unique";
+  return _unique_table_rows.contains(unique_table) ? unique_table : get_abtl();
+}
+
+QString Widget::_ballot_count()
+{
+  return _ballot_table() == get_abtl() ? "COUNT(id)" : "SUM(weight)";
+}
+
+QString Widget::_ballot_sum(const QString& expr)
+{
+  return _ballot_table() == get_abtl() ? QString("SUM(%1)").arg(expr) : QString("SUM((%1) * weight)").arg(expr);
+}
+
+QString Widget::_ballot_weight()
+{
+  return _ballot_table() == get_abtl() ? "1" : "weight";
+}
+
+QString Widget::_seat_condition(int seat_id)
+{
+  // When the table is in booth order (schema version 2), a division's
+  // ballots are one range of ids, which SQLite can read straight off the
+  // table instead of checking seat_id on every row.
+  const QHash<int, QPair<int, int>> ranges = _seat_id_ranges.value(_ballot_table());
+  if (ranges.contains(seat_id))
+  {
+    return QString("id BETWEEN %1 AND %2").arg(ranges.value(seat_id).first).arg(ranges.value(seat_id).second);
+  }
+
+  return QString("seat_id = %1").arg(seat_id);
+}
+
+const Ballot_store_table* Widget::_current_store_table()
+{
+  return _ballot_store.is_open() ? _ballot_store.table(get_abtl()) : nullptr;
+}
+
+void Widget::_step_forward_from_trie(int this_pref)
+{
+  // Fills in a Step-forward column (P<this_pref>, given the clicked cells
+  // before it) from the prefix trie over the ballot store.  The trie keeps
+  // every node it has expanded, so this is quick enough to do here rather
+  // than in worker threads; the column goes through the same processing as
+  // a worker's results.
+  const Ballot_store_table* table = _current_store_table();
+  Prefix_trie& trie               = get_abtl() == "atl" ? _atl_trie : _btl_trie;
+
+  if (trie.table() != table)
+  {
+    trie.reset(table);
+  }
+
+  QVector<QVector<int>> col_data(_num_table_rows, QVector<int>(_booths.length(), 0));
+  trie.next_pref_counts(_clicked_cells.mid(0, this_pref - 1), col_data);
+
+  _current_threads   = 1;
+  _completed_threads = 0;
+
+  _lock_main_interface();
+  _process_thread_sql_main_table(col_data);
+}
+
+Step_forward_engine& Widget::_current_engine()
+{
+  // The engine for the ballot table queries would go to, set up afresh
+  // if it was for another table or file.
+  const QString table         = _ballot_table();
+  Step_forward_engine& engine = get_abtl() == "atl" ? _atl_engine : _btl_engine;
+
+  if (engine.db_file() != _database_file_path || engine.table() != table)
+  {
+    const int num_rows = _unique_table_rows.value(table, get_abtl() == "atl" ? _total_atl_votes : _total_btl_votes);
+    engine.reset(_database_file_path, table, table != get_abtl(), num_rows, get_num_groups());
+  }
+
+  return engine;
+}
+
+bool Widget::_step_forward_from_engine(int this_pref)
+{
+  // Fills in a Step-forward column (P<this_pref>, given the clicked cells
+  // before it) from the ballots held in memory, when there's no ballot
+  // store.  Returns false if the table is too big to hold, for the caller
+  // to use SQL instead.
+  Step_forward_engine& engine = _current_engine();
+
+  if (!engine.can_hold(this_pref))
+  {
+    return false;
+  }
+
+  _count_with_engine(engine, this_pref, _clicked_cells.mid(0, this_pref - 1), QVector<int>(), 0);
+  return true;
+}
+
+bool Widget::_first_n_prefs_from_engine(const QVector<int>& fixed, const QVector<int>& within, int by_pref)
+{
+  // The engine's version of _first_n_prefs_from_bitmaps(), for when
+  // there's no store.  Returns false if the table is too big to hold.
+  Step_forward_engine& engine = _current_engine();
+  const int num_prefs         = engine.prefs_for_first_n(fixed.length(), by_pref);
+
+  if (!engine.can_hold(num_prefs))
+  {
+    return false;
+  }
+
+  _count_with_engine(engine, num_prefs, fixed, within, by_pref);
+  return true;
+}
+
+void Widget::_count_with_engine(Step_forward_engine& engine, int num_prefs, const QVector<int>& prefix, const QVector<int>& within, int by_pref)
+{
+  // If the engine hasn't read P<num_prefs> yet, a worker reads it (and
+  // the column is counted there); otherwise the count is quick enough to
+  // do here, as with the trie.  by_pref > 0 for a First-n column.
+  _current_threads   = 1;
+  _completed_threads = 0;
+
+  _lock_main_interface();
+
+  if (engine.has_prefs(num_prefs))
+  {
+    QVector<QVector<int>> col_data(_num_table_rows, QVector<int>(_booths.length(), 0));
+
+    if (by_pref > 0)
+    {
+      engine.first_n_counts(prefix, within, by_pref, col_data);
+    }
+    else
+    {
+      engine.next_pref_counts(prefix, col_data);
+    }
+
+    _process_thread_sql_main_table(col_data);
+    return;
+  }
+
+  _label_progress->setText("Reading ballots...");
+
+  QThread* thread             = new QThread;
+  Worker_step_forward* worker = new Worker_step_forward(0, &engine, num_prefs, prefix, within, by_pref, _num_table_rows, _booths.length());
+  worker->moveToThread(thread);
+
+  connect(thread, &QThread::started,                     worker, &Worker_step_forward::do_query);
+  connect(worker, &Worker_step_forward::finished_query,  this,   &Widget::_process_thread_sql_main_table);
+  connect(worker, &Worker_step_forward::error,           this,   &Widget::_process_step_forward_error);
+  connect(worker, &Worker_step_forward::finished_query,  thread, &QThread::quit);
+  connect(worker, &Worker_step_forward::error,           thread, &QThread::quit);
+  connect(worker, &Worker_step_forward::finished_query,  worker, &Worker_step_forward::deleteLater);
+  connect(worker, &Worker_step_forward::error,           worker, &Worker_step_forward::deleteLater);
+  connect(thread, &QThread::finished,                    thread, &QThread::deleteLater);
+
+  thread->start();
+}
+
+bool Widget::_n_party_preferred_from_engine()
+{
+  // The n-party-preferred columns from the ballots held in memory, which
+  // pick up from the last calculation when a party has been added since.
+  // Returns false if the table is too big to hold, for the caller to use
+  // SQL instead.
+  Step_forward_engine& engine = _current_engine();
+  const int num_prefs         = engine.prefs_for_npp();
+
+  if (!engine.can_hold(num_prefs))
+  {
+    return false;
+  }
+
+  _current_threads   = 1;
+  _completed_threads = 0;
+
+  _lock_main_interface();
+
+  if (engine.has_prefs(num_prefs))
+  {
+    QVector<QVector<QVector<int>>> table(_clicked_n_parties.length() + 1,
+                                         QVector<QVector<int>>(get_num_groups(), QVector<int>(_booths.length(), 0)));
+    engine.npp_counts(_clicked_n_parties, table);
+
+    _process_thread_sql_npp_table(table);
+    return true;
+  }
+
+  _label_progress->setText("Reading ballots...");
+
+  QThread* thread              = new QThread;
+  Worker_sql_npp_table* worker = new Worker_sql_npp_table(0, &engine, get_num_groups(), _booths.length(), _clicked_n_parties);
+  worker->moveToThread(thread);
+
+  connect(thread, &QThread::started,                     worker, &Worker_sql_npp_table::do_query);
+  connect(worker, &Worker_sql_npp_table::finished_query, this,   &Widget::_process_thread_sql_npp_table);
+  connect(worker, &Worker_sql_npp_table::error,          this,   &Widget::_process_npp_engine_error);
+  connect(worker, &Worker_sql_npp_table::finished_query, thread, &QThread::quit);
+  connect(worker, &Worker_sql_npp_table::error,          thread, &QThread::quit);
+  connect(worker, &Worker_sql_npp_table::finished_query, worker, &Worker_sql_npp_table::deleteLater);
+  connect(worker, &Worker_sql_npp_table::error,          worker, &Worker_sql_npp_table::deleteLater);
+  connect(thread, &QThread::finished,                    thread, &QThread::deleteLater);
+
+  thread->start();
+  return true;
+}
+
+void Widget::_process_step_forward_error(const QString& error_msg)
+{
+  // The engine won't be used again for this file, so the column is taken
+  // off and added again through SQL.
+  Q_UNUSED(error_msg);
+
+  _table_main_data.removeLast();
+  _table_main_booth_data.removeLast();
+
+  _unlock_main_interface();
+  _add_column_to_main_table();
+}
+
+void Widget::_process_npp_engine_error(const QString& error_msg)
+{
+  // As above: the columns are worked out again, through SQL this time.
+  Q_UNUSED(error_msg);
+
+  _unlock_main_interface();
+  _calculate_n_party_preferred();
+}
+
+bool Widget::_first_n_prefs_from_bitmaps(const QVector<int>& fixed, const QVector<int>& within, int by_pref)
+{
+  // The store's version of the First-n (and Later prefs) query: how many of
+  // the ballots with P1 = fixed[0], P2 = fixed[1], ..., that also have each
+  // group in within among their first by_pref preferences (or, for
+  // Exhaust, fewer than by_pref preferences), have each group among their
+  // first by_pref.  The ballots are picked out with the store's bitmap
+  // indexes, so only those ones are read.  Returns false if the store has
+  // no bitmap indexes, for the caller to use SQL instead.
+  const Ballot_store_table* table = _current_store_table();
+  if (table == nullptr || !table->has_bitmaps())
+  {
+    return false;
+  }
+
+  const int current_num_groups = get_num_groups();
+
+  Row_bitmap rows = Row_bitmap::all(table->num_rows());
+
+  for (int i = 0; i < fixed.length(); i++)
+  {
+    rows.intersect(table->pref_bitmap(fixed.at(i), i + 1));
+  }
+
+  for (int gp : within)
+  {
+    Row_bitmap gp_rows;
+
+    if (gp < current_num_groups)
+    {
+      for (int pref = 1; pref <= by_pref; pref++)
+      {
+        gp_rows.unite(table->pref_bitmap(gp, pref));
+      }
+    }
+    else
+    {
+      for (int n = 0; n < by_pref; n++)
+      {
+        gp_rows.unite(table->num_prefs_bitmap(n));
+      }
+    }
+
+    rows.intersect(gp_rows);
+  }
+
+  QVector<QVector<int>> col_data(_num_table_rows, QVector<int>(_booths.length(), 0));
+  const QVector<Ballot_store_range>& ranges = table->ranges();
+  int range                                 = 0;
+
+  rows.for_each([&](int row) {
+    while (ranges.at(range).end <= row)
+    {
+      range++;
+    }
+
+    const int booth_id  = ranges.at(range).booth_id;
+    const int weight    = table->weight(row);
+    const int num_prefs = table->num_prefs(row);
+    const int n         = qMin(num_prefs, by_pref);
+
+    for (int k = 0; k < n; k++)
+    {
+      col_data[table->pref(k, row)][booth_id] += weight;
+    }
+
+    if (num_prefs < by_pref)
+    {
+      col_data[current_num_groups][booth_id] += weight;
+    }
+  });
+
+  // As in the SQL version, the groups already clicked on are left out.
+  for (int gp : fixed + within)
+  {
+    if (gp <= current_num_groups)
+    {
+      col_data[gp].fill(0);
+    }
+  }
+
+  _current_threads   = 1;
+  _completed_threads = 0;
+
+  _lock_main_interface();
+  _process_thread_sql_main_table(col_data);
+  return true;
+}
+
+QVector<QVector<Ballot_store_range>> Widget::_store_ranges_threaded(const Ballot_store_table* table, int num_threads, int seat_id)
+{
+  // The store's counterpart to _queries_threaded(): one division's booths
+  // for one thread, or else equal shares of the rows.
+  QVector<QVector<Ballot_store_range>> ranges;
+
+  if (seat_id >= 0)
+  {
+    ranges.append(table->ranges_for_seat(seat_id));
+    return ranges;
+  }
+
+  const qint64 num_rows = table->num_rows();
+  for (int i = 0; i < num_threads; i++)
+  {
+    ranges.append(table->ranges_for_rows(static_cast<int>(num_rows * i / num_threads), static_cast<int>(num_rows * (i + 1) / num_threads)));
+  }
+
+  return ranges;
+}
+
 void Widget::_sort_table_column(int i)
 {
   QVector<int> indices;
@@ -2694,10 +3108,23 @@ void Widget::_add_column_to_main_table()
       }
     }
 
-    const QString query = QString("SELECT booth_id, P%1, COUNT(P%1) FROM %2 %3 GROUP BY booth_id, P%1")
-                            .arg(QString::number(this_pref), get_abtl(), query_where);
+    const QString aggregate_query = _booth_aggregate_query(this_pref);
+
+    if (_current_store_table() != nullptr)
+    {
+      _step_forward_from_trie(this_pref);
+    }
+    else if (!aggregate_query.isEmpty())
+    {
+      _do_sql_query_for_table(aggregate_query, false, "");
+    }
+    else if (!_step_forward_from_engine(this_pref))
+    {
+      const QString query = QString("SELECT booth_id, P%1, %2 FROM %3 %4 GROUP BY booth_id, P%1")
+                              .arg(QString::number(this_pref), _ballot_count(), _ballot_table(), query_where);
 
-    _do_sql_query_for_table(query, false);
+      _do_sql_query_for_table(query, false, _split_column_for_step_forward(this_pref));
+    }
   }
   else if (table_type == Table_types::FIRST_N_PREFS)
   {
@@ -2734,13 +3161,17 @@ void Widget::_add_column_to_main_table()
     QString query = QString("SELECT booth_id");
     for (int i = 0; i < current_num_groups; i++)
     {
-      query += QString(", SUM(Pfor%1 <= %2)").arg(i).arg(by_pref);
+      query += ", " + _ballot_sum(QString("Pfor%1 <= %2").arg(i).arg(by_pref));
     }
-    query += QString(", SUM(num_prefs < %1)").arg(by_pref);
+    query += ", " + _ballot_sum(QString("num_prefs < %1").arg(by_pref));
 
-    query += QString(", COUNT(id) FROM %1 %2 GROUP BY booth_id").arg(get_abtl(), query_where);
+    query += QString(", %1 FROM %2 %3 GROUP BY booth_id").arg(_ballot_count(), _ballot_table(), query_where);
 
-    _do_sql_query_for_table(query, true);
+    if (!_first_n_prefs_from_bitmaps(QVector<int>(), _clicked_cells.mid(0, col), by_pref) &&
+        !_first_n_prefs_from_engine(QVector<int>(), _clicked_cells.mid(0, col), by_pref))
+    {
+      _do_sql_query_for_table(query, true);
+    }
   }
   else if (table_type == Table_types::LATER_PREFS)
   {
@@ -2767,10 +3198,23 @@ void Widget::_add_column_to_main_table()
         }
       }
 
-      QString query = QString("SELECT booth_id, P%1, COUNT(P%1) FROM %2 %3 GROUP BY booth_id, P%1")
-                        .arg(QString::number(this_pref), get_abtl(), query_where);
+      const QString aggregate_query = _booth_aggregate_query(this_pref);
 
-      _do_sql_query_for_table(query, false);
+      if (_current_store_table() != nullptr)
+      {
+        _step_forward_from_trie(this_pref);
+      }
+      else if (!aggregate_query.isEmpty())
+      {
+        _do_sql_query_for_table(aggregate_query, false, "");
+      }
+      else if (!_step_forward_from_engine(this_pref))
+      {
+        QString query = QString("SELECT booth_id, P%1, %2 FROM %3 %4 GROUP BY booth_id, P%1")
+                          .arg(QString::number(this_pref), _ballot_count(), _ballot_table(), query_where);
+
+        _do_sql_query_for_table(query, false, _split_column_for_step_forward(this_pref));
+      }
     }
     else
     {
@@ -2810,13 +3254,17 @@ void Widget::_add_column_to_main_table()
       QString query = QString("SELECT booth_id");
       for (int i = 0; i < current_num_groups; i++)
       {
-        query += QString(", SUM(Pfor%1 <= %2)").arg(i).arg(by_pref);
+        query += ", " + _ballot_sum(QString("Pfor%1 <= %2").arg(i).arg(by_pref));
       }
-      query += QString(", SUM(num_prefs < %1)").arg(by_pref);
+      query += ", " + _ballot_sum(QString("num_prefs < %1").arg(by_pref));
 
-      query += QString(", COUNT(id) FROM %1 %2 GROUP BY booth_id").arg(get_abtl(), query_where);
+      query += QString(", %1 FROM %2 %3 GROUP BY booth_id").arg(_ballot_count(), _ballot_table(), query_where);
 
-      _do_sql_query_for_table(query, true);
+      if (!_first_n_prefs_from_bitmaps(_clicked_cells.mid(0, fixed_prefs), _clicked_cells.mid(fixed_prefs, col - fixed_prefs), by_pref) &&
+          !_first_n_prefs_from_engine(_clicked_cells.mid(0, fixed_prefs), _clicked_cells.mid(fixed_prefs, col - fixed_prefs), by_pref))
+      {
+        _do_sql_query_for_table(query, true);
+      }
     }
   }
   else if (table_type == Table_types::PREF_SOURCES)
@@ -2829,11 +3277,11 @@ void Widget::_add_column_to_main_table()
       QString query = QString("SELECT booth_id");
       for (int i = 0; i < current_num_groups; i++)
       {
-        query += QString(", SUM(Pfor%1 BETWEEN %2 AND %3)").arg(i).arg(min_pref).arg(max_pref);
+        query += ", " + _ballot_sum(QString("Pfor%1 BETWEEN %2 AND %3").arg(i).arg(min_pref).arg(max_pref));
       }
-      query += QString(", SUM(num_prefs BETWEEN %1 AND %2)").arg(min_pref - 1).arg(max_pref - 1);
+      query += ", " + _ballot_sum(QString("num_prefs BETWEEN %1 AND %2").arg(min_pref - 1).arg(max_pref - 1));
 
-      query += QString(", COUNT(id) FROM %1 GROUP BY booth_id").arg(get_abtl());
+      query += QString(", %1 FROM %2 GROUP BY booth_id").arg(_ballot_count(), _ballot_table());
 
       _do_sql_query_for_table(query, true);
     }
@@ -2843,13 +3291,13 @@ void Widget::_add_column_to_main_table()
       if (_clicked_cells.at(0) == current_num_groups)
       {
         // Exhaust
-        query = QString("SELECT booth_id, P1, COUNT(P1) FROM %1 WHERE num_prefs BETWEEN %2 and %3 GROUP BY booth_id, P1")
-                  .arg(get_abtl(), QString::number(min_pref - 1), QString::number(max_pref - 1));
+        query = QString("SELECT booth_id, P1, %1 FROM %2 WHERE num_prefs BETWEEN %3 and %4 GROUP BY booth_id, P1")
+                  .arg(_ballot_count(), _ballot_table(), QString::number(min_pref - 1), QString::number(max_pref - 1));
       }
       else
       {
-        query = QString("SELECT booth_id, P1, COUNT(P1) FROM %1 WHERE Pfor%2 BETWEEN %3 and %4 GROUP BY booth_id, P1")
-                  .arg(get_abtl(), QString::number(_clicked_cells.at(0)), QString::number(min_pref), QString::number(max_pref));
+        query = QString("SELECT booth_id, P1, %1 FROM %2 WHERE Pfor%3 BETWEEN %4 and %5 GROUP BY booth_id, P1")
+                  .arg(_ballot_count(), _ballot_table(), QString::number(_clicked_cells.at(0)), QString::number(min_pref), QString::number(max_pref));
       }
 
       _do_sql_query_for_table(query, false);
@@ -2857,9 +3305,22 @@ void Widget::_add_column_to_main_table()
   }
   else if (table_type == Table_types::NPP)
   {
-    const QString query = QString("SELECT booth_id, P1, COUNT(P1) FROM %1 GROUP BY booth_id, P1").arg(get_abtl());
+    const QString aggregate_query = _booth_aggregate_query(1);
 
-    _do_sql_query_for_table(query, false);
+    if (_current_store_table() != nullptr)
+    {
+      _step_forward_from_trie(1);
+    }
+    else if (!aggregate_query.isEmpty())
+    {
+      _do_sql_query_for_table(aggregate_query, false, "");
+    }
+    else if (!_step_forward_from_engine(1))
+    {
+      const QString query = QString("SELECT booth_id, P1, %1 FROM %2 GROUP BY booth_id, P1").arg(_ballot_count(), _ballot_table());
+
+      _do_sql_query_for_table(query, false, _split_column_for_step_forward(1));
+    }
   }
 }
 
@@ -2910,7 +3371,13 @@ void Widget::_calculate_n_party_preferred()
   _table_main_model->setHorizontalHeaderItem(n + 2, new QStandardItem("Exh"));
   _table_main_model->horizontalHeaderItem(n + 2)->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
 
-  QString q = QString("SELECT booth_id, P1, COUNT(id)");
+  if (_n_party_preferred_from_engine())
+  {
+    _button_n_party_preferred_calculate->setEnabled(false);
+    return;
+  }
+
+  QString q = QString("SELECT booth_id, P1, %1").arg(_ballot_count());
 
   if (n > 1)
   {
@@ -2945,7 +3412,7 @@ void Widget::_calculate_n_party_preferred()
   }
   q = QString("%1) v%2").arg(q).arg(n);
 
-  q = QString("%1 FROM %2 GROUP BY booth_id, P1").arg(q, get_abtl());
+  q = QString("%1 FROM %2 GROUP BY booth_id, P1").arg(q, _ballot_table());
 
   for (int i = 0; i <= n; i++)
   {
@@ -3626,7 +4093,7 @@ void Widget::_slot_calculate_custom()
         const QString expr_sql = axis.every_numbers_ast->to_sql(this);
 
         q = QString("SELECT DISTINCT (%1) AS v FROM %2 %3 ORDER BY v")
-              .arg(expr_sql, abtl, where_clause);
+              .arg(expr_sql, _ballot_table(), where_clause);
       }
       else
       {
@@ -3643,13 +4110,21 @@ void Widget::_slot_calculate_custom()
           q += QString(", P%1").arg(i + 1);
         }
 
-        q += QString(" FROM %1 %2").arg(abtl, where_clause);
+        q += QString(" FROM %1 %2").arg(_ballot_table(), where_clause);
       }
 
       int num_threads     = 1;
       QStringList queries = _queries_threaded(q, num_threads, use_pure_sql);
       _num_custom_every_expr_threads += num_threads;
 
+      const Ballot_store_table* store_table = _current_store_table();
+      QVector<QVector<Ballot_store_range>> store_ranges;
+
+      if (store_table != nullptr && !use_pure_sql && where_clause.isEmpty())
+      {
+        store_ranges = _store_ranges_threaded(store_table, num_threads);
+      }
+
       auto slot = use_pure_sql ? &Worker_sql_custom_every_expr::do_query_pure_sql : &Worker_sql_custom_every_expr::do_query_operations;
 
       std::vector<std::vector<int>> empty_indices;
@@ -3666,6 +4141,11 @@ void Widget::_slot_calculate_custom()
         Worker_sql_custom_every_expr* worker = new Worker_sql_custom_every_expr(
           _database_file_path, i_axis, thread_num, queries.at(i), current_num_groups, max_loop_index, agg_indices, filter_operations, axis_operations);
 
+        if (!store_ranges.isEmpty())
+        {
+          worker->set_ballot_store(store_table, store_ranges.at(i));
+        }
+
         worker->moveToThread(thread);
 
         connect(thread, &QThread::started,                             worker, slot);
@@ -3909,8 +4389,9 @@ void Widget::_calculate_custom_query()
     {
       q += QString(", P%1").arg(i + 1);
     }
+    q += ", " + _ballot_weight();
 
-    q += " FROM " + abtl;
+    q += " FROM " + _ballot_table();
 
     QStringList where_clauses;
 
@@ -3930,7 +4411,7 @@ void Widget::_calculate_custom_query()
 
     if (individual_division)
     {
-      where_clauses.append(QString("(seat_id = %1)").arg(this_div));
+      where_clauses.append(QString("(%1)").arg(_seat_condition(this_div)));
     }
 
     if (!where_clauses.isEmpty())
@@ -3969,6 +4450,15 @@ void Widget::_calculate_custom_query()
     _current_threads    = num_threads;
     _completed_threads  = 0;
 
+    // The store can stand in for the query unless the filter is SQL.
+    const Ballot_store_table* store_table = _current_store_table();
+    QVector<QVector<Ballot_store_range>> store_ranges;
+
+    if (store_table != nullptr && (_custom_filter_sql.isEmpty() || _custom_filter_sql == NO_FILTER))
+    {
+      store_ranges = _store_ranges_threaded(store_table, num_threads, individual_division ? this_div : -1);
+    }
+
 
     if (popup)
     {
@@ -4000,6 +4490,12 @@ void Widget::_calculate_custom_query()
       Worker_sql_custom_table* worker = new Worker_sql_custom_table(
         i, _database_file_path, queries.at(i), current_num_groups, num_booths, _custom_axis_numbers, _custom_row_stack_indices,
         _custom_col_stack_indices, max_loop_index, agg_indices, _custom_filter_operations, _custom_row_operations, _custom_col_operations, _custom_cell_operations);
+
+      if (!store_ranges.isEmpty())
+      {
+        worker->set_ballot_store(store_table, store_ranges.at(i));
+      }
+
       worker->moveToThread(thread);
 
       if (popup)
@@ -4144,7 +4640,7 @@ void Widget::_make_cross_table()
 
   if (!whole_state)
   {
-    where_clause       = QString(" WHERE seat_id = %1").arg(this_div);
+    where_clause       = QString(" WHERE %1").arg(_seat_condition(this_div));
     and_str            = " AND";
     have_where         = true;
     _cross_table_title = QString("%1: ").arg(_divisions.at(this_div));
@@ -4193,8 +4689,8 @@ void Widget::_make_cross_table()
 
     const int col_pref = row_pref + 1;
 
-    q = QString("SELECT P%1, P%2, COUNT(id) FROM %3%4 GROUP BY P%1, P%2")
-          .arg(QString::number(row_pref), QString::number(col_pref), get_abtl(), where_clause);
+    q = QString("SELECT P%1, P%2, %3 FROM %4%5 GROUP BY P%1, P%2")
+          .arg(QString::number(row_pref), QString::number(col_pref), _ballot_count(), _ballot_table(), where_clause);
 
     if (value_type == VALUE_PERCENTAGES)
     {
@@ -4268,7 +4764,7 @@ void Widget::_make_cross_table()
       q     = QString("%1%2 P%3").arg(q, comma, QString::number(i));
       comma = ",";
     }
-    q = QString("%1, num_prefs FROM %2 %3").arg(q, get_abtl(), where_clause);
+    q = QString("%1, num_prefs, %2 FROM %3 %4").arg(q, _ballot_weight(), _ballot_table(), where_clause);
 
     if (value_type == VALUE_PERCENTAGES)
     {
@@ -4361,7 +4857,7 @@ void Widget::_make_cross_table()
       q     = QString("%1%2 P%3").arg(q, comma, QString::number(i));
       comma = ",";
     }
-    q = QString("%1, num_prefs FROM %2 %3").arg(q, get_abtl(), where_clause);
+    q = QString("%1, num_prefs, %2 FROM %3 %4").arg(q, _ballot_weight(), _ballot_table(), where_clause);
 
     int eff_num_clicked = qMax(1, num_clicked);
     eff_num_clicked     = qMin(up_to - 1, eff_num_clicked);
@@ -4433,7 +4929,7 @@ void Widget::_make_cross_table()
       q = QString("%1, P%2").arg(q).arg(i);
     }
 
-    q = QString("%1, num_prefs FROM %2%3").arg(q, get_abtl(), where_clause);
+    q = QString("%1, num_prefs, %2 FROM %3%4").arg(q, _ballot_weight(), _ballot_table(), where_clause);
 
     QString pref_part;
     if (pref_min == pref_max)
@@ -5426,6 +5922,7 @@ void Widget::_lock_main_interface()
 {
   _doing_calculation = true;
   _button_load->setEnabled(false);
+  _combo_election->setEnabled(false);
   _combo_abtl->setEnabled(false);
   _combo_table_type->setEnabled(false);
   _combo_value_type->setEnabled(false);
@@ -5458,6 +5955,7 @@ void Widget::_unlock_main_interface()
 {
   _doing_calculation = false;
   _button_load->setEnabled(true);
+  _combo_election->setEnabled(true);
   _combo_abtl->setEnabled(true);
   _combo_table_type->setEnabled(true);
   _combo_value_type->setEnabled(true);
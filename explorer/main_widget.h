@@ -1,13 +1,18 @@
 #ifndef MAIN_WIDGET_H
 #define MAIN_WIDGET_H
 
+#include "ballot_store.h"
 #include "booth_model.h"
 #include "clickable_label.h"
 #include "custom_operation.h"
+#include "election_archive.h"
 #include "map_container.h"
 #include "polygon_model.h"
+#include "prefix_trie.h"
+#include "step_forward_engine.h"
 #include "table_view.h"
 #include "table_window.h"
+#include "worker_load_database.h"
 #include <QComboBox>
 #include <QElapsedTimer>
 #include <QLabel>
@@ -53,14 +58,6 @@ struct Arbitrary_axis_sort
   bool is_descending;
 };
 
-struct Bounding_box
-{
-  double min_longitude;
-  double max_longitude;
-  double min_latitude;
-  double max_latitude;
-};
-
 class Widget : public QWidget
 {
   Q_OBJECT
@@ -99,6 +96,11 @@ private slots:
   void _process_thread_sql_custom_popup_table(int, const QVector<int>&, const QVector<QVector<int>>&);
   void _process_thread_sql_custom_every_expr(int, const QVector<int>&);
   void _open_database();
+  void _change_election(int i);
+  void _process_loaded_database(const Database_metadata& metadata);
+  void _process_load_error(const QString& error_msg);
+  void _process_step_forward_error(const QString& error_msg);
+  void _process_npp_engine_error(const QString& error_msg);
   void _clicked_main_table(const QModelIndex& index);
   void _change_abtl(int i);
   void _change_table_type(int i);
@@ -143,7 +145,11 @@ private slots:
 
 private:
   void _reset_spinboxes();
-  void _load_database(const QString& db_file);
+  void _open_archive(const QString& archive_file);
+  void _close_archive();
+  // archive_election is the election's index in _archive, or -1 for a
+  // file on its own.
+  void _load_database(const QString& db_file, int archive_election = -1);
   void _set_table_groups();
   void _setup_main_table();
   void _reset_table();
@@ -152,7 +158,7 @@ private:
   void _set_all_main_table_cells_custom();
   void _set_main_table_row_height();
   void _make_main_table_row_headers(bool is_blank);
-  void _do_sql_query_for_table(const QString& q, bool wide_table = false);
+  void _do_sql_query_for_table(const QString& q, bool wide_table = false, const QString& split_column = "id");
   void _set_divisions_table();
   void _init_main_table_custom(int n_main_rows, int n_rows, int n_main_cols, int n_cols);
   void _enable_division_export_buttons_custom();
@@ -188,7 +194,24 @@ private:
   QString _get_export_line(QStandardItemModel* model, int i, const QString& separator);
   std::uint64_t _available_physical_memory();
   QStringList _queries_threaded(const QString& q, int& num_threads, bool one_thread = false);
-  QStringList _queries_threaded_with_max(const QString& q, int& num_threads, int max_threads = -1);
+  QStringList _queries_threaded_with_max(const QString& q, int& num_threads, int max_threads = -1, const QString& split_column = "id");
+  QString _split_column_for(const QStringList& columns, const QStringList& where_columns);
+  QString _split_column_for_step_forward(int this_pref);
+  QString _booth_aggregate_query(int this_pref);
+  QString _ballot_table();
+  QString _ballot_count();
+  QString _ballot_sum(const QString& expr);
+  QString _ballot_weight();
+  QString _seat_condition(int seat_id);
+  const Ballot_store_table* _current_store_table();
+  void _step_forward_from_trie(int this_pref);
+  Step_forward_engine& _current_engine();
+  bool _step_forward_from_engine(int this_pref);
+  bool _first_n_prefs_from_engine(const QVector<int>& fixed, const QVector<int>& within, int by_pref);
+  bool _n_party_preferred_from_engine();
+  void _count_with_engine(Step_forward_engine& engine, int num_prefs, const QVector<int>& prefix, const QVector<int>& within, int by_pref);
+  bool _first_n_prefs_from_bitmaps(const QVector<int>& fixed, const QVector<int>& within, int by_pref);
+  QVector<QVector<Ballot_store_range>> _store_ranges_threaded(const Ballot_store_table* table, int num_threads, int seat_id = -1);
   QString _get_table_type();
   QString _get_value_type();
   QString _get_groups_table();
@@ -231,6 +254,7 @@ private:
 
   QPushButton* _button_load;
   QLabel* _label_load;
+  QComboBox* _combo_election;
   QComboBox* _combo_abtl;
   QComboBox* _combo_table_type;
   QComboBox* _combo_value_type;
@@ -358,6 +382,19 @@ private:
   int _total_formal_votes;
   int _total_atl_votes;
   int _total_btl_votes;
+  int _schema_version;
+  QHash<QString, QVector<QStringList>> _db_indexes;
+  bool _has_booth_aggregates;
+  QHash<QString, int> _unique_table_rows;
+  QHash<QString, QHash<int, QPair<int, int>>> _seat_id_ranges;
+  Ballot_store _ballot_store;
+  Election_archive _archive;
+  int _archive_election = -1;
+  QHash<int, Database_metadata> _archive_metadata;
+  Prefix_trie _atl_trie;
+  Prefix_trie _btl_trie;
+  Step_forward_engine _atl_engine;
+  Step_forward_engine _btl_engine;
   int _current_threads;
   int _completed_threads;
   bool _doing_calculation;
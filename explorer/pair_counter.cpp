@@ -0,0 +1,94 @@
+#include "pair_counter.h"
+
+#include <QtAlgorithms>
+
+namespace
+{
+  const int TILE = 64;
+} // namespace
+
+Pair_counter::Pair_counter(int num_rows, const QVector<int>& ignore_groups)
+  : _num_rows(num_rows)
+  , _num_groups(num_rows - 1)
+  , _words((num_rows - 1 + 63) / 64)
+  , _keep(_words, ~static_cast<quint64>(0))
+  , _ballot(_words, 0)
+  , _pairs(_words * (_words + 1) / 2 * TILE * TILE, 0)
+  , _exhausted(num_rows - 1, 0)
+{
+  for (int group : ignore_groups)
+  {
+    if (group >= 0 && group < _num_groups)
+    {
+      _keep[group >> 6] &= ~(static_cast<quint64>(1) << (group & 63));
+    }
+  }
+}
+
+int Pair_counter::_tile_offset(int word_a, int word_b) const
+{
+  // Rows before word_a's hold _words, _words - 1, ... tiles.
+  const int tile = word_a * _words - word_a * (word_a - 1) / 2 + (word_b - word_a);
+  return tile * TILE * TILE;
+}
+
+void Pair_counter::add_ballot(int weight, bool exhausted)
+{
+  for (int w = 0; w < _words; w++)
+  {
+    _ballot[w] &= _keep.at(w);
+  }
+
+  for (int word_a = 0; word_a < _words; word_a++)
+  {
+    quint64 bits_a = _ballot.at(word_a);
+
+    while (bits_a != 0)
+    {
+      const int a = qCountTrailingZeroBits(bits_a);
+      bits_a &= bits_a - 1;
+
+      if (exhausted)
+      {
+        _exhausted[64 * word_a + a] += weight;
+      }
+
+      // The rest of bits_a are the groups after a in the same word.
+      int* row = _tile(word_a, word_a) + a * TILE;
+      for (quint64 bits_b = bits_a; bits_b != 0; bits_b &= bits_b - 1)
+      {
+        row[qCountTrailingZeroBits(bits_b)] += weight;
+      }
+
+      for (int word_b = word_a + 1; word_b < _words; word_b++)
+      {
+        row = _tile(word_a, word_b) + a * TILE;
+        for (quint64 bits_b = _ballot.at(word_b); bits_b != 0; bits_b &= bits_b - 1)
+        {
+          row[qCountTrailingZeroBits(bits_b)] += weight;
+        }
+      }
+    }
+  }
+
+  _ballot.fill(0);
+}
+
+void Pair_counter::add_to(QVector<QVector<int>>& table) const
+{
+  for (int a = 0; a < _num_groups; a++)
+  {
+    const int word_a = a / TILE;
+
+    for (int b = a + 1; b < _num_groups; b++)
+    {
+      const int votes = _pairs.at(_tile_offset(word_a, b / TILE) + (a % TILE) * TILE + b % TILE);
+
+      table[a][b] += votes;
+      table[b][a] += votes;
+    }
+
+    table[_num_rows - 1][a] += _exhausted.at(a);
+    table[a][_num_rows - 1] += _exhausted.at(a);
+  }
+}
@@ -0,0 +1,58 @@
+#ifndef PAIR_COUNTER_H
+#define PAIR_COUNTER_H
+
+// Counts, for First-n and Later prefs cross tables, the votes for each pair
+// of groups that are both among a ballot's first n preferences.
+//
+// Each ballot's first n groups are held as a bitmask, one bit per group,
+// with the groups the table ignores (the clicked ones) masked out once per
+// ballot rather than looked up for each pair.  The pairs are then the set
+// bits taken two at a time, and only one of (a, b) and (b, a) is counted;
+// the table is mirrored at the end.  The counts are a flat upper triangle,
+// laid out in 64 x 64 tiles that match the mask's words, so that all the
+// pairs from a ballot's word a and word b land in the same 16 KB.
+//
+// Each cross-table worker has its own, and the workers' tables are summed
+// as they come in, as before.
+
+#include <QVector>
+#include <QtGlobal>
+
+class Pair_counter
+{
+public:
+  // num_rows is the cross table's size, i.e. num_groups + 1 with the last
+  // row and column for ballots that exhaust before n preferences.
+  Pair_counter(int num_rows, const QVector<int>& ignore_groups);
+
+  // Builds up a ballot's groups, between add_ballot()s.
+  void insert(int group)
+  {
+    if (group >= 0 && group < _num_groups)
+    {
+      _ballot[group >> 6] |= static_cast<quint64>(1) << (group & 63);
+    }
+  }
+
+  // Adds weight to each pair of the ballot's groups (and, if it exhausted
+  // before n, to each group's exhausted count), and starts the next ballot.
+  void add_ballot(int weight, bool exhausted);
+
+  // Adds the counts into a num_rows x num_rows table.
+  void add_to(QVector<QVector<int>>& table) const;
+
+private:
+  int* _tile(int word_a, int word_b) { return _pairs.data() + _tile_offset(word_a, word_b); }
+  int _tile_offset(int word_a, int word_b) const;
+
+  int _num_rows;
+  int _num_groups;
+  int _words;
+
+  QVector<quint64> _keep;   // Groups that aren't ignored
+  QVector<quint64> _ballot; // The current ballot's groups
+  QVector<int> _pairs;      // Tile (a, b) for a <= b, by a then b
+  QVector<int> _exhausted;  // By group
+};
+
+#endif // PAIR_COUNTER_H
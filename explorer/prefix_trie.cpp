@@ -0,0 +1,192 @@
+#include "prefix_trie.h"
+
+#include <algorithm>
+
+Prefix_trie::Prefix_trie()
+  : _table(nullptr)
+{
+}
+
+void Prefix_trie::reset(const Ballot_store_table* table)
+{
+  _table = table;
+  _rows.clear();
+  _booth_of_row.clear();
+  _nodes.clear();
+  _booth_counts.clear();
+}
+
+void Prefix_trie::next_pref_counts(const QVector<int>& prefix, QVector<QVector<int>>& counts)
+{
+  if (_table == nullptr)
+  {
+    return;
+  }
+
+  if (_nodes.isEmpty())
+  {
+    _build_root();
+  }
+
+  int node = 0;
+  for (int depth = 0; depth < prefix.length(); depth++)
+  {
+    node = _child(node, depth, prefix.at(depth));
+    if (node < 0)
+    {
+      // No ballot starts this way.
+      return;
+    }
+  }
+
+  if (_nodes.at(node).first_child < 0)
+  {
+    _expand(node, prefix.length());
+  }
+
+  const Node& parent = _nodes.at(node);
+  for (int i = parent.first_child; i < parent.first_child + parent.num_children; i++)
+  {
+    const Node& child = _nodes.at(i);
+    QVector<int>& pref_counts = counts[child.pref];
+
+    for (int j = child.counts_begin; j < child.counts_end; j++)
+    {
+      pref_counts[_booth_counts.at(j).booth_id] += _booth_counts.at(j).votes;
+    }
+  }
+}
+
+void Prefix_trie::_build_root()
+{
+  const int num_rows = _table->num_rows();
+
+  _rows.resize(num_rows);
+  _booth_of_row.resize(num_rows);
+
+  for (int row = 0; row < num_rows; row++)
+  {
+    _rows[row] = row;
+  }
+
+  for (const Ballot_store_range& range : _table->ranges())
+  {
+    std::fill(_booth_of_row.begin() + range.begin, _booth_of_row.begin() + range.end, range.booth_id);
+  }
+
+  Node root;
+  root.pref         = -1;
+  root.begin        = 0;
+  root.end          = num_rows;
+  root.first_child  = -1;
+  root.num_children = 0;
+  root.counts_begin = 0;
+  root.counts_end   = 0;
+  _nodes.append(root);
+}
+
+void Prefix_trie::_expand(int node, int depth)
+{
+  // depth is the number of preferences fixed at node, so its children are
+  // by P<depth + 1>.  A stable counting sort of the node's rows by that
+  // preference puts each child's rows together without losing their booth
+  // order.
+  const int num_columns = _table->num_columns();
+  const int begin       = _nodes.at(node).begin;
+  const int end         = _nodes.at(node).end;
+
+  QVector<int> keys(end - begin);
+  QVector<int> bucket_begin(num_columns + 2, 0);
+
+  for (int i = begin; i < end; i++)
+  {
+    const int pref = depth < num_columns ? _table->pref(depth, _rows.at(i)) : 999;
+    const int key  = (pref >= 0 && pref < num_columns) ? pref : num_columns;
+
+    keys[i - begin] = key;
+    bucket_begin[key + 1]++;
+  }
+
+  for (int key = 0; key <= num_columns; key++)
+  {
+    bucket_begin[key + 1] += bucket_begin.at(key);
+  }
+
+  QVector<int> sorted(end - begin);
+  QVector<int> next(bucket_begin);
+
+  for (int i = begin; i < end; i++)
+  {
+    sorted[next[keys.at(i - begin)]++] = _rows.at(i);
+  }
+
+  std::copy(sorted.cbegin(), sorted.cend(), _rows.begin() + begin);
+
+  const int first_child = _nodes.length();
+  int num_children      = 0;
+
+  for (int key = 0; key <= num_columns; key++)
+  {
+    if (bucket_begin.at(key) == bucket_begin.at(key + 1))
+    {
+      continue;
+    }
+
+    Node child;
+    child.pref         = key;
+    child.begin        = begin + bucket_begin.at(key);
+    child.end          = begin + bucket_begin.at(key + 1);
+    child.first_child  = -1;
+    child.num_children = 0;
+    child.counts_begin = _booth_counts.length();
+
+    // Each booth's rows are still one run.
+    for (int i = child.begin; i < child.end; i++)
+    {
+      const int row      = _rows.at(i);
+      const int booth_id = _booth_of_row.at(row);
+
+      if (_booth_counts.length() == child.counts_begin || _booth_counts.last().booth_id != booth_id)
+      {
+        _booth_counts.append({booth_id, 0});
+      }
+
+      _booth_counts.last().votes += _table->weight(row);
+    }
+
+    child.counts_end = _booth_counts.length();
+    _nodes.append(child);
+    num_children++;
+  }
+
+  _nodes[node].first_child  = first_child;
+  _nodes[node].num_children = num_children;
+}
+
+int Prefix_trie::_child(int node, int depth, int pref)
+{
+  // Only real preferences are followed: as in SQL, P<k> = exhaust matches
+  // no ballot.
+  if (pref < 0 || pref >= _table->num_columns())
+  {
+    return -1;
+  }
+
+  if (_nodes.at(node).first_child < 0)
+  {
+    _expand(node, depth);
+  }
+
+  const int first_child = _nodes.at(node).first_child;
+  const int end_child   = first_child + _nodes.at(node).num_children;
+
+  for (int i = first_child; i < end_child; i++)
+  {
+    if (_nodes.at(i).pref == pref)
+    {
+      return i;
+    }
+  }
+
+  return -1;
+}
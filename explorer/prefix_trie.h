@@ -0,0 +1,66 @@
+#ifndef PREFIX_TRIE_H
+#define PREFIX_TRIE_H
+
+// A trie of the preference sequences in a ballot store table, for
+// Step-forward: the node for P1 = a, P2 = b, ... has a child for every
+// next preference that follows it, each holding its votes per booth.
+// Adding a Step-forward column is then a walk down the clicked cells and a
+// read of one node's children, instead of a scan of the whole table.
+//
+// Nodes are only expanded when they're first asked for, so the trie grows
+// as the user clicks.  Every node is a range of one permutation of the
+// rows: expanding it sorts its range by the next preference, which leaves
+// each child's rows as a range inside it, still in booth order.  The whole
+// trie takes one int per row, one per row for the booth, and a count per
+// booth for each node that has been expanded.
+
+#include "ballot_store.h"
+
+#include <QVector>
+
+class Prefix_trie
+{
+public:
+  Prefix_trie();
+
+  // Forgets the trie, and builds it over table (which may be nullptr) when
+  // it's next used.
+  void reset(const Ballot_store_table* table);
+  const Ballot_store_table* table() const { return _table; }
+
+  // Votes per booth for each next preference after prefix (group or
+  // candidate numbers, as in _clicked_cells): counts[pref][booth_id], with
+  // exhausted ballots in counts[num_columns].  counts must already have
+  // num_columns + 1 rows of num_booths zeros.
+  void next_pref_counts(const QVector<int>& prefix, QVector<QVector<int>>& counts);
+
+private:
+  struct Node
+  {
+    int pref;         // Index of the preference in its parent; num_columns for exhausted
+    int begin;        // Range of _rows
+    int end;
+    int first_child;  // -1 until expanded
+    int num_children;
+    int counts_begin; // Range of _booth_counts
+    int counts_end;
+  };
+
+  struct Booth_count
+  {
+    int booth_id;
+    int votes;
+  };
+
+  void _build_root();
+  void _expand(int node, int depth);
+  int _child(int node, int depth, int pref);
+
+  const Ballot_store_table* _table;
+  QVector<int> _rows;
+  QVector<int> _booth_of_row;
+  QVector<Node> _nodes;
+  QVector<Booth_count> _booth_counts;
+};
+
+#endif // PREFIX_TRIE_H
@@ -0,0 +1,282 @@
+#include "row_bitmap.h"
+
+#include <QtEndian>
+
+#include <algorithm>
+#include <iterator>
+
+namespace
+{
+  const int WORDS = Row_bitmap::CHUNK_ROWS / 64;
+} // namespace
+
+Row_bitmap Row_bitmap::all(int num_rows)
+{
+  Row_bitmap bitmap;
+
+  for (int begin = 0; begin < num_rows; begin += CHUNK_ROWS)
+  {
+    const int n = qMin(CHUNK_ROWS, num_rows - begin);
+
+    Container container;
+    container.chunk       = begin / CHUNK_ROWS;
+    container.cardinality = n;
+    container.bits        = QVector<quint64>(WORDS, 0);
+
+    for (int w = 0; w < n / 64; w++)
+    {
+      container.bits[w] = ~static_cast<quint64>(0);
+    }
+    if (n % 64 != 0)
+    {
+      container.bits[n / 64] = (static_cast<quint64>(1) << (n % 64)) - 1;
+    }
+
+    _to_array_if_small(container);
+    bitmap._containers.append(container);
+  }
+
+  return bitmap;
+}
+
+bool Row_bitmap::read(const uchar* data, const uchar* end)
+{
+  _containers.clear();
+
+  if (end - data < 4)
+  {
+    return false;
+  }
+
+  const quint32 num_containers = qFromLittleEndian<quint32>(data);
+  const uchar* header          = data + 4;
+  const uchar* values          = header + 8 * static_cast<qint64>(num_containers);
+
+  if (num_containers > static_cast<quint32>(CHUNK_ROWS) || values > end)
+  {
+    return false;
+  }
+
+  for (quint32 i = 0; i < num_containers; i++)
+  {
+    Container container;
+    container.chunk       = qFromLittleEndian<quint16>(header);
+    const int kind        = qFromLittleEndian<quint16>(header + 2);
+    container.cardinality = static_cast<int>(qFromLittleEndian<quint32>(header + 4));
+    header += 8;
+
+    const qint64 bytes = kind == 0 ? 2 * static_cast<qint64>(container.cardinality) : 8 * WORDS;
+    if ((kind != 0 && kind != 1) || container.cardinality > CHUNK_ROWS || end - values < bytes ||
+        (!_containers.isEmpty() && _containers.last().chunk >= container.chunk))
+    {
+      _containers.clear();
+      return false;
+    }
+
+    if (kind == 0)
+    {
+      container.array.resize(container.cardinality);
+      for (int j = 0; j < container.cardinality; j++)
+      {
+        container.array[j] = qFromLittleEndian<quint16>(values + 2 * j);
+      }
+    }
+    else
+    {
+      container.bits.resize(WORDS);
+      for (int w = 0; w < WORDS; w++)
+      {
+        container.bits[w] = qFromLittleEndian<quint64>(values + 8 * w);
+      }
+    }
+
+    values += bytes;
+    _containers.append(container);
+  }
+
+  return true;
+}
+
+qint64 Row_bitmap::cardinality() const
+{
+  qint64 n = 0;
+  for (const Container& container : _containers)
+  {
+    n += container.cardinality;
+  }
+
+  return n;
+}
+
+void Row_bitmap::unite(const Row_bitmap& other)
+{
+  QVector<Container> containers;
+  int i = 0;
+  int j = 0;
+
+  while (i < _containers.length() || j < other._containers.length())
+  {
+    if (j == other._containers.length() || (i < _containers.length() && _containers.at(i).chunk < other._containers.at(j).chunk))
+    {
+      containers.append(_containers.at(i++));
+    }
+    else if (i == _containers.length() || other._containers.at(j).chunk < _containers.at(i).chunk)
+    {
+      containers.append(other._containers.at(j++));
+    }
+    else
+    {
+      containers.append(_unite(_containers.at(i++), other._containers.at(j++)));
+    }
+  }
+
+  _containers = containers;
+}
+
+void Row_bitmap::intersect(const Row_bitmap& other)
+{
+  QVector<Container> containers;
+  int i = 0;
+  int j = 0;
+
+  while (i < _containers.length() && j < other._containers.length())
+  {
+    if (_containers.at(i).chunk < other._containers.at(j).chunk)
+    {
+      i++;
+    }
+    else if (other._containers.at(j).chunk < _containers.at(i).chunk)
+    {
+      j++;
+    }
+    else
+    {
+      const Container container = _intersect(_containers.at(i++), other._containers.at(j++));
+      if (container.cardinality > 0)
+      {
+        containers.append(container);
+      }
+    }
+  }
+
+  _containers = containers;
+}
+
+void Row_bitmap::_to_bitset(Container& container)
+{
+  if (!container.bits.isEmpty())
+  {
+    return;
+  }
+
+  container.bits = QVector<quint64>(WORDS, 0);
+  for (quint16 low : container.array)
+  {
+    container.bits[low >> 6] |= static_cast<quint64>(1) << (low & 63);
+  }
+  container.array.clear();
+}
+
+void Row_bitmap::_to_array_if_small(Container& container)
+{
+  if (container.bits.isEmpty() || container.cardinality > ARRAY_MAX)
+  {
+    return;
+  }
+
+  container.array.clear();
+  container.array.reserve(container.cardinality);
+
+  for (int w = 0; w < WORDS; w++)
+  {
+    quint64 word = container.bits.at(w);
+    while (word != 0)
+    {
+      container.array.append(static_cast<quint16>(64 * w + qCountTrailingZeroBits(word)));
+      word &= word - 1;
+    }
+  }
+  container.bits.clear();
+}
+
+Row_bitmap::Container Row_bitmap::_unite(const Container& a, const Container& b)
+{
+  Container result;
+  result.chunk = a.chunk;
+
+  if (a.bits.isEmpty() && b.bits.isEmpty() && a.cardinality + b.cardinality <= ARRAY_MAX)
+  {
+    std::set_union(a.array.cbegin(), a.array.cend(), b.array.cbegin(), b.array.cend(), std::back_inserter(result.array));
+    result.cardinality = result.array.length();
+    return result;
+  }
+
+  result = a;
+  _to_bitset(result);
+
+  if (b.bits.isEmpty())
+  {
+    for (quint16 low : b.array)
+    {
+      result.bits[low >> 6] |= static_cast<quint64>(1) << (low & 63);
+    }
+  }
+  else
+  {
+    for (int w = 0; w < WORDS; w++)
+    {
+      result.bits[w] |= b.bits.at(w);
+    }
+  }
+
+  result.cardinality = 0;
+  for (quint64 word : result.bits)
+  {
+    result.cardinality += qPopulationCount(word);
+  }
+
+  _to_array_if_small(result);
+  return result;
+}
+
+Row_bitmap::Container Row_bitmap::_intersect(const Container& a, const Container& b)
+{
+  Container result;
+  result.chunk = a.chunk;
+
+  if (a.bits.isEmpty() && b.bits.isEmpty())
+  {
+    std::set_intersection(a.array.cbegin(), a.array.cend(), b.array.cbegin(), b.array.cend(), std::back_inserter(result.array));
+  }
+  else if (a.bits.isEmpty() || b.bits.isEmpty())
+  {
+    // Keep the array's rows that are in the bitset.
+    const Container& array  = a.bits.isEmpty() ? a : b;
+    const Container& bitset = a.bits.isEmpty() ? b : a;
+
+    for (quint16 low : array.array)
+    {
+      if (bitset.bits.at(low >> 6) & (static_cast<quint64>(1) << (low & 63)))
+      {
+        result.array.append(low);
+      }
+    }
+  }
+  else
+  {
+    result.bits = QVector<quint64>(WORDS, 0);
+    result.cardinality = 0;
+
+    for (int w = 0; w < WORDS; w++)
+    {
+      result.bits[w] = a.bits.at(w) & b.bits.at(w);
+      result.cardinality += qPopulationCount(result.bits.at(w));
+    }
+
+    _to_array_if_small(result);
+    return result;
+  }
+
+  result.cardinality = result.array.length();
+  return result;
+}
@@ -0,0 +1,80 @@
+#ifndef ROW_BITMAP_H
+#define ROW_BITMAP_H
+
+// A set of ballot store rows, held like a roaring bitmap: one container
+// per chunk of 65536 rows that has any rows in it, either a sorted array
+// of the rows' low 16 bits or, once there are more than ARRAY_MAX of them,
+// a bitset of the whole chunk.  The ballot store's bitmap indexes
+// (create_sqlite/bitmap_index.h) are read into these, and filters are
+// worked out by intersecting and uniting them before any rows are read.
+
+#include <QVector>
+#include <QtAlgorithms>
+#include <QtGlobal>
+
+class Row_bitmap
+{
+public:
+  static const int CHUNK_ROWS = 65536;
+  static const int ARRAY_MAX  = 4096;
+
+  // Every row in [0, num_rows).
+  static Row_bitmap all(int num_rows);
+
+  // Decodes a bitmap as it's stored in the file.  Returns false, leaving
+  // the bitmap empty, if it would run past end.
+  bool read(const uchar* data, const uchar* end);
+
+  bool is_empty() const { return _containers.isEmpty(); }
+  qint64 cardinality() const;
+
+  void unite(const Row_bitmap& other);
+  void intersect(const Row_bitmap& other);
+
+  // Calls f(row) for each row, in order.
+  template <typename F>
+  void for_each(F f) const
+  {
+    for (const Container& container : _containers)
+    {
+      const int base = container.chunk * CHUNK_ROWS;
+
+      if (container.bits.isEmpty())
+      {
+        for (quint16 low : container.array)
+        {
+          f(base + low);
+        }
+        continue;
+      }
+
+      for (int w = 0; w < container.bits.length(); w++)
+      {
+        quint64 word = container.bits.at(w);
+        while (word != 0)
+        {
+          f(base + 64 * w + qCountTrailingZeroBits(word));
+          word &= word - 1;
+        }
+      }
+    }
+  }
+
+private:
+  struct Container
+  {
+    int chunk;
+    int cardinality;
+    QVector<quint16> array; // Sorted, if bits is empty
+    QVector<quint64> bits;  // CHUNK_ROWS / 64 words, or empty
+  };
+
+  static void _to_bitset(Container& container);
+  static void _to_array_if_small(Container& container);
+  static Container _unite(const Container& a, const Container& b);
+  static Container _intersect(const Container& a, const Container& b);
+
+  QVector<Container> _containers; // In chunk order
+};
+
+#endif // ROW_BITMAP_H
@@ -29,27 +29,36 @@ DEFINES += QT_DEPRECATED_WARNINGS
 CONFIG += c++11
 
 SOURCES += \
+        ballot_store.cpp \
         booth_model.cpp \
         custom_expr.cpp \
         custom_lexer.cpp \
         custom_operation.cpp \
         custom_parser.cpp \
+        election_archive.cpp \
         freeze_table_widget.cpp \
         main.cpp \
         main_widget.cpp \
         map_container.cpp \
+        pair_counter.cpp \
         polygon_model.cpp \
+        prefix_trie.cpp \
+        row_bitmap.cpp \
+        step_forward_engine.cpp \
         table_type_constants.cpp \
         table_window.cpp \
         viridis.cpp \
+        worker_load_database.cpp \
         worker_setup_polygon.cpp \
         worker_sql_cross_table.cpp \
         worker_sql_custom_every_expr.cpp \
         worker_sql_custom_table.cpp \
         worker_sql_main_table.cpp \
-        worker_sql_npp_table.cpp
+        worker_sql_npp_table.cpp \
+        worker_step_forward.cpp
 
 HEADERS += \
+        ballot_store.h \
         booth_model.h \
         clickable_label.h \
         custom_expr.h \
@@ -57,20 +66,27 @@ HEADERS += \
         custom_operation.h \
         custom_parser.h \
         custom_token.h \
+        election_archive.h \
         freeze_table_widget.h \
         main_widget.h \
         map_container.h \
+        pair_counter.h \
         polygon_model.h \
+        prefix_trie.h \
+        row_bitmap.h \
+        step_forward_engine.h \
         table_type_constants.h \
         table_view.h \
         table_window.h \
         viridis.h \
+        worker_load_database.h \
         worker_setup_polygon.h \
         worker_sql_cross_table.h \
         worker_sql_custom_every_expr.h \
         worker_sql_custom_table.h \
         worker_sql_main_table.h \
-        worker_sql_npp_table.h
+        worker_sql_npp_table.h \
+        worker_step_forward.h
 
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
@@ -0,0 +1,640 @@
+#include "step_forward_engine.h"
+
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QStringList>
+#include <QVariant>
+#include <QtAlgorithms>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define STEP_FORWARD_AVX2
+#endif
+
+namespace
+{
+  // The prefix is matched a block of 32 rows at a time, into a bit per
+  // row, and the blocks a chunk at a time, so that the masks stay in cache
+  // while the matching rows are tallied.
+  const int BLOCK_ROWS   = 32;
+  const int CHUNK_BLOCKS = 256;
+
+  // At least this many P columns are read at once.
+  const int MIN_LOAD_PREFS = 4;
+
+  // The rows to count, as an AND of terms, each an OR of (column, value)
+  // pairs: P1 = a is a term of one pair, and "b among the first n" a term
+  // of n pairs.  A condition with no terms matches every row.
+  struct Condition
+  {
+    QVector<const uchar*> columns;
+    QVector<uchar> values;
+    QVector<int> term_ends;
+
+    void add(const uchar* column, uchar value)
+    {
+      columns.append(column);
+      values.append(value);
+    }
+
+    void end_term()
+    {
+      term_ends.append(columns.length());
+    }
+  };
+
+  bool match_row(const Condition& condition, int row)
+  {
+    int c = 0;
+    for (int term_end : condition.term_ends)
+    {
+      bool any = false;
+      for (; c < term_end; c++)
+      {
+        any = any || condition.columns.at(c)[row] == condition.values.at(c);
+      }
+
+      if (!any)
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  void match_blocks(const Condition& condition, int first_row, int num_blocks, quint32* masks)
+  {
+    for (int b = 0; b < num_blocks; b++)
+    {
+      const int row = first_row + BLOCK_ROWS * b;
+      quint32 mask  = 0;
+
+      for (int i = 0; i < BLOCK_ROWS; i++)
+      {
+        mask |= static_cast<quint32>(match_row(condition, row + i)) << i;
+      }
+
+      masks[b] = mask;
+    }
+  }
+
+#ifdef STEP_FORWARD_AVX2
+  bool have_avx2()
+  {
+    static const bool have = __builtin_cpu_supports("avx2");
+    return have;
+  }
+
+  // 32 byte compares per pair per block, ORed within a term and ANDed
+  // across them; the mask is the top bit of each byte.
+  __attribute__((target("avx2"))) void match_blocks_avx2(const Condition& condition, int first_row, int num_blocks, quint32* masks)
+  {
+    const uchar* const* columns = condition.columns.constData();
+    const uchar* values         = condition.values.constData();
+
+    for (int b = 0; b < num_blocks; b++)
+    {
+      const int row = first_row + BLOCK_ROWS * b;
+      __m256i match = _mm256_set1_epi8(-1);
+      int c         = 0;
+
+      for (int term_end : condition.term_ends)
+      {
+        __m256i any = _mm256_setzero_si256();
+        for (; c < term_end; c++)
+        {
+          const __m256i prefs = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(columns[c] + row));
+          any                 = _mm256_or_si256(any, _mm256_cmpeq_epi8(prefs, _mm256_set1_epi8(static_cast<char>(values[c]))));
+        }
+
+        match = _mm256_and_si256(match, any);
+      }
+
+      masks[b] = static_cast<quint32>(_mm256_movemask_epi8(match));
+    }
+  }
+#endif
+
+  // Calls tally(row) for every row that meets condition, in order.
+  template <typename Tally_fn>
+  void for_each_match(const Condition& condition, int num_rows, Tally_fn tally)
+  {
+    if (condition.term_ends.isEmpty())
+    {
+      for (int row = 0; row < num_rows; row++)
+      {
+        tally(row);
+      }
+      return;
+    }
+
+    const int num_blocks = num_rows / BLOCK_ROWS;
+    quint32 masks[CHUNK_BLOCKS];
+
+    for (int block = 0; block < num_blocks; block += CHUNK_BLOCKS)
+    {
+      const int n         = qMin(CHUNK_BLOCKS, num_blocks - block);
+      const int first_row = BLOCK_ROWS * block;
+
+#ifdef STEP_FORWARD_AVX2
+      if (have_avx2())
+      {
+        match_blocks_avx2(condition, first_row, n, masks);
+      }
+      else
+#endif
+      {
+        match_blocks(condition, first_row, n, masks);
+      }
+
+      for (int b = 0; b < n; b++)
+      {
+        quint32 mask = masks[b];
+        while (mask != 0)
+        {
+          tally(first_row + BLOCK_ROWS * b + qCountTrailingZeroBits(mask));
+          mask &= mask - 1;
+        }
+      }
+    }
+
+    // The rows after the last whole block.
+    for (int row = BLOCK_ROWS * num_blocks; row < num_rows; row++)
+    {
+      if (match_row(condition, row))
+      {
+        tally(row);
+      }
+    }
+  }
+  // One column (P<k + 1>) of the n-party-preferred scan over rows
+  // [first_row, end_row): each row whose first preference for any party
+  // is still after k, and that hasn't exhausted, is won by party
+  // first_index + j if P<k + 1> = parties[j].  Returns whether any row
+  // could still change.
+  bool npp_column(const uchar* column, int k, const QVector<uchar>& parties, int first_index, int first_row, int end_row, uchar* first,
+                  uchar* winner)
+  {
+    bool active = false;
+
+    for (int row = first_row; row < end_row; row++)
+    {
+      if (first[row] <= k || column[row] == Step_forward_engine::EXHAUSTED)
+      {
+        continue;
+      }
+
+      active = true;
+
+      const int j = parties.indexOf(column[row]);
+      if (j >= 0)
+      {
+        first[row]  = static_cast<uchar>(k);
+        winner[row] = static_cast<uchar>(first_index + j);
+      }
+    }
+
+    return active;
+  }
+
+#ifdef STEP_FORWARD_AVX2
+  // As npp_column(), 32 rows at a time: the argmin of the parties' Pfor is
+  // kept as a running minimum, updated with blends where the column hits a
+  // party.  Returns the row after the last whole block in *end_blocks.
+  __attribute__((target("avx2"))) bool npp_column_avx2(const uchar* column, int k, const QVector<uchar>& parties, int first_index,
+                                                      int num_rows, uchar* first, uchar* winner, int* end_blocks)
+  {
+    const __m256i pref      = _mm256_set1_epi8(static_cast<char>(k));
+    const __m256i exhausted = _mm256_set1_epi8(static_cast<char>(Step_forward_engine::EXHAUSTED));
+    const __m256i ones      = _mm256_set1_epi8(-1);
+
+    __m256i any_active = _mm256_setzero_si256();
+    int row            = 0;
+
+    for (; row + BLOCK_ROWS <= num_rows; row += BLOCK_ROWS)
+    {
+      const __m256i prefs = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(column + row));
+      __m256i firsts      = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first + row));
+
+      // first > k, unsigned: not (max(first, k) == k).
+      const __m256i settled = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(firsts, pref), pref), _mm256_cmpeq_epi8(prefs, exhausted));
+      const __m256i active  = _mm256_xor_si256(settled, ones);
+
+      if (_mm256_testz_si256(active, active))
+      {
+        continue;
+      }
+
+      any_active      = _mm256_or_si256(any_active, active);
+      __m256i winners = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(winner + row));
+
+      for (int j = 0; j < parties.length(); j++)
+      {
+        const __m256i hit = _mm256_and_si256(active, _mm256_cmpeq_epi8(prefs, _mm256_set1_epi8(static_cast<char>(parties.at(j)))));
+
+        firsts  = _mm256_blendv_epi8(firsts, pref, hit);
+        winners = _mm256_blendv_epi8(winners, _mm256_set1_epi8(static_cast<char>(first_index + j)), hit);
+      }
+
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(first + row), firsts);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(winner + row), winners);
+    }
+
+    *end_blocks = row;
+    return !_mm256_testz_si256(any_active, any_active);
+  }
+#endif
+} // namespace
+
+Step_forward_engine::Step_forward_engine()
+{
+  reset();
+}
+
+void Step_forward_engine::reset(const QString& db_file, const QString& table, bool weighted, int num_rows, int num_groups)
+{
+  _db_file    = db_file;
+  _table      = table;
+  _weighted   = weighted;
+  _num_rows   = num_rows;
+  _num_groups = num_groups;
+  _failed     = false;
+
+  _booth_ids.clear();
+  _weights.clear();
+  _prefs.clear();
+
+  _npp_parties.clear();
+  _npp_first.clear();
+  _npp_winner.clear();
+}
+
+qint64 Step_forward_engine::_bytes_for(int num_prefs) const
+{
+  const qint64 bytes_per_row = sizeof(int) + (_weighted ? sizeof(int) : 0) + num_prefs;
+  return bytes_per_row * _num_rows;
+}
+
+bool Step_forward_engine::has_prefs(int num_prefs) const
+{
+  return !_failed && num_prefs <= _prefs.length();
+}
+
+bool Step_forward_engine::can_hold(int num_prefs) const
+{
+  // A group number has to fit in a byte alongside EXHAUSTED.
+  return !_failed && !_table.isEmpty() && _num_groups < EXHAUSTED && num_prefs <= _num_groups && _bytes_for(num_prefs) <= MAX_BYTES;
+}
+
+bool Step_forward_engine::load(int num_prefs, int thread_num, QString& error)
+{
+  if (!can_hold(num_prefs))
+  {
+    error = "Not enough memory for the Step-forward engine";
+    return false;
+  }
+
+  if (has_prefs(num_prefs))
+  {
+    return true;
+  }
+
+  // Twice as many columns as last time, if they fit, since each read is a
+  // scan of the whole table.
+  const int first_pref = _prefs.length() + 1;
+  int last_pref        = qMin(_num_groups, qMax(num_prefs, qMax(2 * _prefs.length(), MIN_LOAD_PREFS)));
+
+  while (last_pref > num_prefs && !can_hold(last_pref))
+  {
+    last_pref--;
+  }
+
+  const bool first_load = _booth_ids.isEmpty() && _prefs.isEmpty();
+
+  QStringList columns;
+  if (first_load)
+  {
+    columns << "booth_id";
+    if (_weighted)
+    {
+      columns << "weight";
+    }
+  }
+
+  const int first_pref_column = columns.length();
+  for (int pref = first_pref; pref <= last_pref; pref++)
+  {
+    columns << QString("P%1").arg(pref);
+  }
+
+  const QString q = QString("SELECT %1 FROM %2 ORDER BY id").arg(columns.join(", "), _table);
+
+  QVector<QVector<uchar>> new_prefs(last_pref - first_pref + 1);
+  for (QVector<uchar>& prefs : new_prefs)
+  {
+    prefs.reserve(_num_rows);
+  }
+
+  if (first_load)
+  {
+    _booth_ids.reserve(_num_rows);
+    _weights.reserve(_weighted ? _num_rows : 0);
+  }
+
+  const QString connection_name = QString("step_forward_%1").arg(thread_num);
+  bool ok                       = true;
+
+  // The following is inside its own scope so that the database can be
+  // removed properly: https://doc.qt.io/qt-5/qsqldatabase.html#removeDatabase
+  {
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connection_name);
+    db.setDatabaseName(_db_file);
+
+    if (!db.open())
+    {
+      error = QString("Couldn't open %1").arg(_db_file);
+      ok    = false;
+    }
+    else
+    {
+      QSqlQuery query(db);
+      query.setForwardOnly(true);
+
+      if (!query.exec(q))
+      {
+        error = QString("Error: failed to execute query:\n%1\n%2").arg(q, query.lastError().text());
+        ok    = false;
+      }
+
+      while (ok && query.next())
+      {
+        if (first_load)
+        {
+          _booth_ids.append(query.value(0).toInt());
+          if (_weighted)
+          {
+            _weights.append(query.value(1).toInt());
+          }
+        }
+
+        for (int i = 0; i < new_prefs.length(); i++)
+        {
+          const int pref = query.value(first_pref_column + i).toInt();
+          new_prefs[i].append(pref >= 0 && pref < _num_groups ? static_cast<uchar>(pref) : static_cast<uchar>(EXHAUSTED));
+        }
+      }
+
+      db.close();
+    }
+  }
+
+  QSqlDatabase::removeDatabase(connection_name);
+
+  // Later reads have to line up with the first, row for row.
+  for (int i = 0; ok && i < new_prefs.length(); i++)
+  {
+    if (new_prefs.at(i).length() != _booth_ids.length())
+    {
+      error = QString("%1 changed while it was being read").arg(_table);
+      ok    = false;
+    }
+  }
+
+  if (!ok)
+  {
+    _failed = true;
+    _booth_ids.clear();
+    _weights.clear();
+    _prefs.clear();
+    _npp_parties.clear();
+    return false;
+  }
+
+  _num_rows = _booth_ids.length();
+  for (const QVector<uchar>& prefs : new_prefs)
+  {
+    _prefs.append(prefs);
+  }
+  return true;
+}
+
+void Step_forward_engine::next_pref_counts(const QVector<int>& prefix, QVector<QVector<int>>& counts) const
+{
+  const int k = prefix.length();
+  if (!has_prefs(k + 1))
+  {
+    return;
+  }
+
+  // Nothing follows an exhausted ballot.
+  Condition condition;
+
+  for (int j = 0; j < k; j++)
+  {
+    if (prefix.at(j) < 0 || prefix.at(j) >= _num_groups)
+    {
+      return;
+    }
+
+    condition.add(_prefs.at(j).constData(), static_cast<uchar>(prefix.at(j)));
+    condition.end_term();
+  }
+
+  const uchar* next    = _prefs.at(k).constData();
+  const int* booth_ids = _booth_ids.constData();
+  const int* weights   = _weighted ? _weights.constData() : nullptr;
+
+  for_each_match(condition, _num_rows, [&](int row) {
+    const int pref = next[row] == EXHAUSTED ? _num_groups : next[row];
+    counts[pref][booth_ids[row]] += weights == nullptr ? 1 : weights[row];
+  });
+}
+
+int Step_forward_engine::prefs_for_first_n(int num_fixed, int by_pref) const
+{
+  return qMin(_num_groups, qMax(num_fixed, by_pref));
+}
+
+void Step_forward_engine::first_n_counts(const QVector<int>& fixed, const QVector<int>& within, int by_pref, QVector<QVector<int>>& counts) const
+{
+  if (by_pref < 1 || !has_prefs(prefs_for_first_n(fixed.length(), by_pref)))
+  {
+    return;
+  }
+
+  // Only P1, ..., P<by_pref> can hold a group among the first by_pref, and
+  // a ballot has fewer than by_pref preferences if P<by_pref> is empty (or
+  // there are fewer groups than that).
+  const int n                 = qMin(by_pref, _num_groups);
+  const bool always_exhausted = by_pref > _num_groups;
+  const uchar* last_pref      = always_exhausted ? nullptr : _prefs.at(by_pref - 1).constData();
+
+  Condition condition;
+
+  for (int j = 0; j < fixed.length(); j++)
+  {
+    if (fixed.at(j) < 0 || fixed.at(j) >= _num_groups)
+    {
+      return;
+    }
+
+    condition.add(_prefs.at(j).constData(), static_cast<uchar>(fixed.at(j)));
+    condition.end_term();
+  }
+
+  for (int gp : within)
+  {
+    if (gp < 0 || gp > _num_groups)
+    {
+      return;
+    }
+
+    if (gp < _num_groups)
+    {
+      for (int k = 0; k < n; k++)
+      {
+        condition.add(_prefs.at(k).constData(), static_cast<uchar>(gp));
+      }
+      condition.end_term();
+    }
+    else if (!always_exhausted)
+    {
+      condition.add(last_pref, static_cast<uchar>(EXHAUSTED));
+      condition.end_term();
+    }
+  }
+
+  QVector<const uchar*> first_prefs;
+  for (int k = 0; k < n; k++)
+  {
+    first_prefs.append(_prefs.at(k).constData());
+  }
+
+  const int* booth_ids = _booth_ids.constData();
+  const int* weights   = _weighted ? _weights.constData() : nullptr;
+
+  for_each_match(condition, _num_rows, [&](int row) {
+    const int booth_id = booth_ids[row];
+    const int weight   = weights == nullptr ? 1 : weights[row];
+
+    for (int k = 0; k < n; k++)
+    {
+      const int pref = first_prefs.at(k)[row];
+      if (pref == EXHAUSTED)
+      {
+        break;
+      }
+
+      counts[pref][booth_id] += weight;
+    }
+
+    if (always_exhausted || last_pref[row] == EXHAUSTED)
+    {
+      counts[_num_groups][booth_id] += weight;
+    }
+  });
+
+  // As in the SQL version, the groups already clicked on are left out.
+  for (int gp : fixed + within)
+  {
+    counts[gp].fill(0);
+  }
+}
+
+void Step_forward_engine::_npp_scan(const QVector<int>& parties, int first_index)
+{
+  QVector<uchar> values;
+  for (int party : parties)
+  {
+    values.append(static_cast<uchar>(party));
+  }
+
+  uchar* first  = _npp_first.data();
+  uchar* winner = _npp_winner.data();
+
+  // Once a column leaves no row that could change, neither will any later
+  // one: a row's first party only moves earlier, and an exhausted ballot
+  // stays exhausted.
+  for (int k = 0; k < _prefs.length(); k++)
+  {
+    const uchar* column = _prefs.at(k).constData();
+    int end_blocks      = 0;
+    bool active         = false;
+
+#ifdef STEP_FORWARD_AVX2
+    if (have_avx2())
+    {
+      active = npp_column_avx2(column, k, values, first_index, _num_rows, first, winner, &end_blocks);
+    }
+#endif
+
+    active = npp_column(column, k, values, first_index, end_blocks, _num_rows, first, winner) || active;
+
+    if (!active)
+    {
+      break;
+    }
+  }
+}
+
+void Step_forward_engine::npp_counts(const QVector<int>& parties, QVector<QVector<QVector<int>>>& counts)
+{
+  if (parties.isEmpty() || !has_prefs(prefs_for_npp()))
+  {
+    return;
+  }
+
+  for (int party : parties)
+  {
+    if (party < 0 || party >= _num_groups)
+    {
+      return;
+    }
+  }
+
+  // Clicking one more party only needs a pass for that party: the ballots
+  // it wins are those that put it ahead of the winner so far.  Anything
+  // else starts again.
+  const int num_before = _npp_parties.length();
+
+  if (num_before > 0 && num_before <= parties.length() && parties.mid(0, num_before) == _npp_parties)
+  {
+    _npp_scan(parties.mid(num_before), num_before);
+  }
+  else
+  {
+    _npp_first  = QVector<uchar>(_num_rows, static_cast<uchar>(EXHAUSTED));
+    _npp_winner = QVector<uchar>(_num_rows, static_cast<uchar>(EXHAUSTED));
+    _npp_scan(parties, 0);
+  }
+
+  _npp_parties = parties;
+
+  const int n          = parties.length();
+  const uchar* p1      = _prefs.at(0).constData();
+  const uchar* winner  = _npp_winner.constData();
+  const int* booth_ids = _booth_ids.constData();
+  const int* weights   = _weighted ? _weights.constData() : nullptr;
+
+  for (int row = 0; row < _num_rows; row++)
+  {
+    if (p1[row] == EXHAUSTED)
+    {
+      continue;
+    }
+
+    const int party = winner[row] == EXHAUSTED ? n : winner[row];
+    counts[party][p1[row]][booth_ids[row]] += weights == nullptr ? 1 : weights[row];
+  }
+
+  // As in the SQL version, the rows of the parties themselves are left out.
+  for (QVector<QVector<int>>& party_counts : counts)
+  {
+    for (int party : parties)
+    {
+      party_counts[party].fill(0);
+    }
+  }
+}
@@ -0,0 +1,123 @@
+#ifndef STEP_FORWARD_ENGINE_H
+#define STEP_FORWARD_ENGINE_H
+
+// Step-forward columns for a file without a ballot store (see
+// ballot_store.h), where they'd otherwise be a
+//
+//   SELECT booth_id, P<k>, COUNT(P<k>) FROM atl WHERE P1 = a AND P2 = b ... GROUP BY booth_id, P<k>
+//
+// that scans the whole table again for every click.  Instead, the ballot
+// table's booth ids (and weights, for a _unique table) and its P columns
+// are read once into arrays in memory, one byte per preference, and each
+// column is a scan of the arrays: the prefix is matched 32 rows at a time
+// with byte compares (AVX2, where the CPU has it), and the rows that match
+// are tallied straight into the [group][booth] counts.
+//
+// First-n columns (and Later prefs columns past the fixed ones), which
+// would be a SUM(Pfor<i> <= n) per group over the table, are counted from
+// the same arrays: "group b among the first n" is b in any of P1, ..., Pn,
+// so each clicked group is n compares ORed together, and each ballot that
+// matches adds its first n preferences to the counts.
+//
+// The n-party-preferred columns, which would be a GROUP BY over n * (n - 1)
+// Pfor comparisons, are counted from the same arrays too: a ballot goes to
+// whichever party it gives the earliest preference, i.e. the argmin of the
+// parties' Pfor, found as the first P column that holds one of them.  Each
+// ballot's winner and where it was found are kept, so a party clicked on
+// afterwards only needs a pass of its own.
+//
+// P columns are read as they're first needed, a few at a time, so a user
+// who only goes three preferences deep doesn't pay for the rest.  An
+// engine holds no more than MAX_BYTES; a table too big for that is left to
+// SQL.  Loading is slow (a full scan through SQLite), so it's done on a
+// worker thread (worker_step_forward.h); everything else is quick.
+
+#include <QString>
+#include <QVector>
+
+class Step_forward_engine
+{
+public:
+  static const qint64 MAX_BYTES = 512 * 1024 * 1024;
+
+  // Preferences are stored in a byte, with NO_PREF as EXHAUSTED.
+  static const int EXHAUSTED = 255;
+
+  Step_forward_engine();
+
+  // Forgets any columns read, and sets up for table in db_file, which has
+  // num_rows rows and num_groups P columns.  A weighted table (a _unique
+  // table) has its weight column read too.
+  void reset(const QString& db_file = QString(), const QString& table = QString(), bool weighted = false, int num_rows = 0,
+             int num_groups = 0);
+
+  const QString& db_file() const { return _db_file; }
+  const QString& table() const { return _table; }
+
+  // Whether P1, ..., P<num_prefs> are in memory.
+  bool has_prefs(int num_prefs) const;
+
+  // Whether P1, ..., P<num_prefs> would fit in MAX_BYTES, and the engine
+  // hasn't failed to load.
+  bool can_hold(int num_prefs) const;
+
+  // Reads whichever of P1, ..., P<num_prefs> aren't in memory yet (and
+  // some more, if they fit), through its own connection.  Returns false
+  // and sets error on failure, after which the engine isn't used again
+  // until it's reset.
+  bool load(int num_prefs, int thread_num, QString& error);
+
+  // As Prefix_trie::next_pref_counts(): votes per booth for each next
+  // preference after prefix, counts[pref][booth_id], with exhausted
+  // ballots in counts[num_groups].  P1, ..., P<prefix length + 1> must be
+  // in memory.
+  void next_pref_counts(const QVector<int>& prefix, QVector<QVector<int>>& counts) const;
+
+  // The P columns first_n_counts() needs.
+  int prefs_for_first_n(int num_fixed, int by_pref) const;
+
+  // As Widget::_first_n_prefs_from_bitmaps(): votes per booth for each
+  // group among the first by_pref preferences, counts[group][booth_id],
+  // and for fewer than by_pref preferences in counts[num_groups], from the
+  // ballots with P1 = fixed[0], P2 = fixed[1], ... that also have every
+  // group in within among their first by_pref (or, for num_groups, fewer
+  // than by_pref preferences).  The groups in fixed and within are left at
+  // zero.  counts must already have num_groups + 1 rows of num_booths
+  // zeros.
+  void first_n_counts(const QVector<int>& fixed, const QVector<int>& within, int by_pref, QVector<QVector<int>>& counts) const;
+
+  // The P columns npp_counts() needs: all of them.
+  int prefs_for_npp() const { return _num_groups; }
+
+  // Votes per booth for each party in parties (or none of them, at index
+  // parties.length()) by P1 group: counts[party][group][booth_id], with
+  // the groups in parties left at zero.  If parties is the last call's
+  // with some more on the end, only those are scanned for.  counts must
+  // already have parties.length() + 1 tables of num_groups rows of
+  // num_booths zeros.
+  void npp_counts(const QVector<int>& parties, QVector<QVector<QVector<int>>>& counts);
+
+private:
+  void _npp_scan(const QVector<int>& parties, int first_index);
+
+  qint64 _bytes_for(int num_prefs) const;
+
+  QString _db_file;
+  QString _table;
+  bool _weighted;
+  int _num_rows;
+  int _num_groups;
+  bool _failed;
+
+  QVector<int> _booth_ids;
+  QVector<int> _weights;          // Empty unless weighted
+  QVector<QVector<uchar>> _prefs; // P1, P2, ...
+
+  // From the last npp_counts(): each ballot's winner (an index into
+  // _npp_parties), and the P column it was found in (from 0), or EXHAUSTED.
+  QVector<int> _npp_parties;
+  QVector<uchar> _npp_first;
+  QVector<uchar> _npp_winner;
+};
+
+#endif // STEP_FORWARD_ENGINE_H
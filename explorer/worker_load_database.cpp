@@ -0,0 +1,443 @@
+#include "worker_load_database.h"
+#include <QDataStream>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QVariant>
+
+namespace
+{
+  // A string, given as its index in strings; an index out of range sets
+  // the stream's status, like any other bad read.
+  QString read_string(QDataStream& in, const QStringList& strings)
+  {
+    qint32 id = -1;
+    in >> id;
+
+    if (id < 0 || id >= strings.length())
+    {
+      in.setStatus(QDataStream::ReadCorruptData);
+      return QString();
+    }
+
+    return strings.at(id);
+  }
+
+  // A count, which can't be more than there are bytes.
+  int read_count(QDataStream& in, int size)
+  {
+    qint32 n = -1;
+    in >> n;
+
+    if (n < 0 || n > size)
+    {
+      in.setStatus(QDataStream::ReadCorruptData);
+      return 0;
+    }
+
+    return n;
+  }
+} // namespace
+
+Worker_load_database::Worker_load_database(const QString& db_file, const Election_archive* archive, int election)
+  : _db_file(db_file)
+  , _archive(archive)
+  , _election(election)
+{
+}
+
+Worker_load_database::~Worker_load_database() {}
+
+void Worker_load_database::do_load()
+{
+  const QString connection_name = "db_conn_load";
+  Database_metadata metadata;
+  metadata.db_file = _db_file;
+
+  bool errors = false;
+  QString error_msg;
+
+  {
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connection_name);
+    db.setDatabaseName(_db_file);
+
+    if (!db.open())
+    {
+      errors    = true;
+      error_msg = QString("Error: couldn't open database.");
+    }
+
+    const QStringList tables = errors ? QStringList() : db.tables();
+
+    if (!errors)
+    {
+      if (tables.indexOf("basic_info") < 0 || tables.indexOf("candidates") < 0 || tables.indexOf("groups") < 0 || tables.indexOf("seats") < 0 ||
+          tables.indexOf("booths") < 0 || tables.indexOf("atl") < 0 || tables.indexOf("btl") < 0)
+      {
+        errors    = true;
+        error_msg = QString("Error: database is not formatted correctly.");
+      }
+    }
+
+    if (!errors)
+    {
+      QSqlQuery query(db);
+      _read_schema(query, tables, metadata);
+
+      // The archive's copy is only good for the file it was taken from;
+      // a file that has been updated or built again since is read itself.
+      metadata.from_archive = _archive != nullptr && _archive_matches(query);
+
+      if (metadata.from_archive)
+      {
+        if (!_decode_body(_archive->metadata_body(_election), _archive->strings(), metadata))
+        {
+          errors    = true;
+          error_msg = QString("Error: the metadata for %1 in %2 is corrupt.").arg(_db_file, _archive->file_name());
+        }
+      }
+      else
+      {
+        // A blob from a different version of create_sqlite is just ignored.
+        const bool have_blob = tables.indexOf("metadata_blob") >= 0 && _read_blob(query, metadata);
+
+        if (!have_blob)
+        {
+          errors = !_read_tables(query, metadata, error_msg);
+        }
+      }
+    }
+
+    db.close();
+  }
+
+  QSqlDatabase::removeDatabase(connection_name);
+
+  if (errors)
+  {
+    emit error(error_msg);
+    return;
+  }
+
+  emit finished_load(metadata);
+}
+
+void Worker_load_database::_read_schema(QSqlQuery& query, const QStringList& tables, Database_metadata& metadata)
+{
+  // Files from before schema version 2 have none of the tables below.
+  if (tables.indexOf("schema_version") < 0)
+  {
+    return;
+  }
+
+  if (query.exec("SELECT version FROM schema_version") && query.next())
+  {
+    metadata.schema_version = query.value(0).toInt();
+  }
+
+  if (query.exec("SELECT table_name, columns FROM schema_indexes ORDER BY id"))
+  {
+    while (query.next())
+    {
+      metadata.db_indexes[query.value(0).toString()].append(query.value(1).toString().split(","));
+    }
+  }
+
+  metadata.has_booth_aggregates = tables.indexOf("atl_booth_p1") >= 0 && tables.indexOf("atl_booth_p1_p2") >= 0 &&
+                                  tables.indexOf("btl_booth_p1") >= 0 && tables.indexOf("btl_booth_p1_p2") >= 0;
+
+  // atl_unique and btl_unique, where they were worth keeping.
+  for (const QString& table : {QString("atl"), QString("btl")})
+  {
+    const QString unique_table = table + "_unique";
+    if (tables.indexOf(unique_table) >= 0 && query.exec(QString("SELECT COUNT(*) FROM %1").arg(unique_table)) && query.next())
+    {
+      metadata.unique_table_rows[unique_table] = query.value(0).toInt();
+    }
+  }
+
+  // The id range of each booth, for the tables in booth order.
+  for (const QString& table : {QString("atl"), QString("btl"), QString("atl_unique"), QString("btl_unique")})
+  {
+    if (tables.indexOf(table + "_booth_rows") >= 0 &&
+        query.exec(QString("SELECT seat_id, MIN(first_id), MAX(last_id) FROM %1_booth_rows GROUP BY seat_id").arg(table)))
+    {
+      while (query.next())
+      {
+        metadata.seat_id_ranges[table][query.value(0).toInt()] = qMakePair(query.value(1).toInt(), query.value(2).toInt());
+      }
+    }
+  }
+}
+
+bool Worker_load_database::_archive_matches(QSqlQuery& query) const
+{
+  const Archive_election& election = _archive->election(_election);
+
+  if (!query.exec("PRAGMA user_version") || !query.next() || query.value(0).toUInt() != election.content_id)
+  {
+    return false;
+  }
+
+  return query.exec("SELECT (SELECT COALESCE(MAX(id), -1) + 1 FROM atl), (SELECT COALESCE(MAX(id), -1) + 1 FROM btl), atl_votes, btl_votes "
+                    "FROM basic_info WHERE id = 0") &&
+         query.next() && query.value(0).toUInt() == election.atl_ids && query.value(1).toUInt() == election.btl_ids &&
+         query.value(2).toUInt() == election.atl_votes && query.value(3).toUInt() == election.btl_votes;
+}
+
+bool Worker_load_database::_read_blob(QSqlQuery& query, Database_metadata& metadata)
+{
+  if (!query.exec("SELECT version, data FROM metadata_blob WHERE id = 0") || !query.next() ||
+      query.value(0).toInt() != METADATA_BLOB_VERSION)
+  {
+    return false;
+  }
+
+  const QByteArray data = qUncompress(query.value(1).toByteArray());
+  QDataStream in(data);
+  in.setVersion(QDataStream::Qt_5_6);
+
+  QStringList strings;
+  QByteArray body;
+  in >> strings >> body;
+
+  return in.status() == QDataStream::Ok && _decode_body(body, strings, metadata);
+}
+
+bool Worker_load_database::_decode_body(const QByteArray& body, const QStringList& strings, Database_metadata& metadata)
+{
+  QDataStream in(body);
+  in.setVersion(QDataStream::Qt_5_6);
+
+  qint32 year;
+  qint32 formal_votes;
+  qint32 atl_votes;
+  qint32 btl_votes;
+
+  metadata.state_short = read_string(in, strings);
+  metadata.state_full  = read_string(in, strings);
+  in >> year >> formal_votes >> atl_votes >> btl_votes;
+
+  metadata.year               = year;
+  metadata.total_formal_votes = formal_votes;
+  metadata.total_atl_votes    = atl_votes;
+  metadata.total_btl_votes    = btl_votes;
+
+  const int num_groups = read_count(in, body.size());
+  for (int i = 0; i < num_groups && in.status() == QDataStream::Ok; i++)
+  {
+    metadata.atl_groups.append(read_string(in, strings));
+    metadata.atl_groups_short.append(read_string(in, strings));
+  }
+
+  const int num_cands = read_count(in, body.size());
+  for (int i = 0; i < num_cands && in.status() == QDataStream::Ok; i++)
+  {
+    qint32 group = -1;
+    metadata.btl_names.append(read_string(in, strings));
+    metadata.btl_names_short.append(read_string(in, strings));
+    in >> group;
+
+    if (group < 0 || group >= num_groups)
+    {
+      in.setStatus(QDataStream::ReadCorruptData);
+    }
+
+    metadata.group_from_candidate.append(group);
+  }
+
+  const int num_divisions = read_count(in, body.size());
+  for (int i = 0; i < num_divisions && in.status() == QDataStream::Ok; i++)
+  {
+    qint32 votes;
+    Bounding_box bbox;
+
+    metadata.divisions.append(read_string(in, strings));
+    in >> votes >> bbox.min_longitude >> bbox.max_longitude >> bbox.min_latitude >> bbox.max_latitude;
+    metadata.division_formal_votes.append(votes);
+    metadata.division_bboxes.append(bbox);
+  }
+
+  const int num_booths = read_count(in, body.size());
+  metadata.booths.reserve(num_booths);
+
+  for (int i = 0; i < num_booths && in.status() == QDataStream::Ok; i++)
+  {
+    Booth this_booth;
+    qint32 division_id;
+    qint32 votes;
+    quint8 type; // Only needed for the bounding boxes, which are done.
+
+    this_booth.booth = read_string(in, strings);
+    in >> division_id >> this_booth.longitude >> this_booth.latitude >> votes >> type;
+
+    if (division_id < 0 || division_id >= metadata.divisions.length())
+    {
+      in.setStatus(QDataStream::ReadCorruptData);
+      break;
+    }
+
+    this_booth.id           = i;
+    this_booth.division_id  = division_id;
+    this_booth.division     = metadata.divisions.at(division_id);
+    this_booth.formal_votes = votes;
+    metadata.booths.append(this_booth);
+  }
+
+  return in.status() == QDataStream::Ok;
+}
+
+bool Worker_load_database::_read_tables(QSqlQuery& query, Database_metadata& metadata, QString& error_msg)
+{
+  // Without a blob, everything is read from its own table.
+  metadata.atl_groups.clear();
+  metadata.atl_groups_short.clear();
+  metadata.btl_names.clear();
+  metadata.btl_names_short.clear();
+  metadata.group_from_candidate.clear();
+  metadata.divisions.clear();
+  metadata.division_formal_votes.clear();
+  metadata.division_bboxes.clear();
+  metadata.booths.clear();
+
+  if (!query.exec("SELECT state, state_full, year, formal_votes, atl_votes, btl_votes FROM basic_info"))
+  {
+    error_msg = "Couldn't read basic information from database";
+    return false;
+  }
+
+  query.next();
+  metadata.state_short        = query.value(0).toString();
+  metadata.state_full         = query.value(1).toString();
+  metadata.year               = query.value(2).toInt();
+  metadata.total_formal_votes = query.value(3).toInt();
+  metadata.total_atl_votes    = query.value(4).toInt();
+  metadata.total_btl_votes    = query.value(5).toInt();
+
+  if (!query.exec("SELECT party, party_ab FROM groups ORDER BY id"))
+  {
+    error_msg = "Couldn't read party names";
+    return false;
+  }
+
+  while (query.next())
+  {
+    metadata.atl_groups.append(query.value(0).toString());
+    metadata.atl_groups_short.append(query.value(1).toString());
+  }
+
+  if (!query.exec("SELECT party_ab, group_letter, group_pos, candidate FROM candidates ORDER BY id"))
+  {
+    error_msg = "Couldn't read candidate names";
+    return false;
+  }
+
+  int group = -1;
+
+  while (query.next())
+  {
+    QString this_party(query.value(0).toString());
+    if (query.value(1).toString() == "UG")
+    {
+      this_party = "UG";
+    }
+
+    QString full_name   = query.value(3).toString();
+    const int comma_pos = full_name.indexOf(",");
+    if (comma_pos >= 0)
+    {
+      int n = 1;
+      if (comma_pos == full_name.indexOf(", "))
+      {
+        n = 2;
+      }
+      full_name.replace(comma_pos, n, ",\n");
+    }
+
+    const QVariant group_pos = query.value(2);
+    if (group_pos.toInt() == 1)
+    {
+      group++;
+    }
+    metadata.btl_names.append(full_name);
+    metadata.btl_names_short.append(this_party + "_" + group_pos.toString());
+    metadata.group_from_candidate.append(group);
+  }
+
+  if (!query.exec("SELECT seat, formal_votes FROM seats ORDER BY id"))
+  {
+    error_msg = "Couldn't read divisions";
+    return false;
+  }
+
+  // The bounding box for each division will be set based
+  // on its election-day booths; initialise the bounds so
+  // that they'll be updated from the first read of a booth
+  // coordinate:
+  Bounding_box bbox;
+  bbox.min_latitude  = 0.;
+  bbox.max_latitude  = -80;
+  bbox.min_longitude = 180.;
+  bbox.max_longitude = 0.;
+
+  while (query.next())
+  {
+    metadata.divisions.append(query.value(0).toString());
+    metadata.division_formal_votes.append(query.value(1).toInt());
+    metadata.division_bboxes.append(bbox);
+  }
+
+  if (!query.exec("SELECT id, seat, booth, lon, lat, formal_votes FROM booths ORDER BY id"))
+  {
+    error_msg = "Couldn't read booths";
+    return false;
+  }
+
+  int i = 0;
+
+  while (query.next())
+  {
+    Booth this_booth;
+    this_booth.id       = query.value(0).toInt();
+    this_booth.division = query.value(1).toString();
+
+    // I was worried that 3000 indexOf's would be slow, but it's fine:
+    this_booth.division_id = metadata.divisions.indexOf(this_booth.division);
+
+    this_booth.booth        = query.value(2).toString();
+    this_booth.longitude    = query.value(3).toDouble();
+    this_booth.latitude     = query.value(4).toDouble();
+    this_booth.formal_votes = query.value(5).toInt();
+
+    if (i != this_booth.id)
+    {
+      error_msg = "Booth ID's not as expected";
+      return false;
+    }
+
+    if (this_booth.division_id < 0)
+    {
+      error_msg = QString("Error reading booths; couldn't find %1 in %2").arg(this_booth.booth, this_booth.division);
+      return false;
+    }
+
+    // Update bounding box based on election-day booths with non-zero lon/lat:
+    if (!this_booth.booth.contains("PPVC") && !this_booth.booth.contains("PREPOLL", Qt::CaseInsensitive) &&
+        !this_booth.booth.contains("Sydney (") && !this_booth.booth.contains("Adelaide (") && !this_booth.booth.contains("Perth (") &&
+        !this_booth.booth.contains("Brisbane City (") && !this_booth.booth.contains("Hobart (") && !this_booth.booth.contains("Melbourne ("))
+    {
+      if (this_booth.latitude < -1. && this_booth.longitude > 1. && this_booth.formal_votes > 0)
+      {
+        Bounding_box& box = metadata.division_bboxes[this_booth.division_id];
+        box.max_latitude  = qMax(box.max_latitude, this_booth.latitude);
+        box.min_latitude  = qMin(box.min_latitude, this_booth.latitude);
+        box.max_longitude = qMax(box.max_longitude, this_booth.longitude);
+        box.min_longitude = qMin(box.min_longitude, this_booth.longitude);
+      }
+    }
+
+    i++;
+    metadata.booths.append(this_booth);
+  }
+
+  return true;
+}
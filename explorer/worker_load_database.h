@@ -0,0 +1,90 @@
+#ifndef WORKER_LOAD_DATABASE_H
+#define WORKER_LOAD_DATABASE_H
+
+// Reads everything the explorer needs from a file when it's opened, other
+// than the ballots, on its own thread.  Files from create_sqlite with
+// schema version 2 have it all in one blob (see metadata_blob.h there);
+// older ones are read table by table, as they always were.  For an
+// election in an archive (election_archive.h), it comes from the archive,
+// unless the file has changed since the archive was written.
+
+#include "booth_model.h"
+#include "election_archive.h"
+
+#include <QHash>
+#include <QMetaType>
+#include <QObject>
+#include <QPair>
+#include <QStringList>
+#include <QVector>
+
+class QSqlQuery;
+
+struct Bounding_box
+{
+  double min_longitude;
+  double max_longitude;
+  double min_latitude;
+  double max_latitude;
+};
+
+struct Database_metadata
+{
+  QString db_file;
+  QString state_short;
+  QString state_full;
+  int year                  = 0;
+  int total_formal_votes    = 0;
+  int total_atl_votes       = 0;
+  int total_btl_votes       = 0;
+  int schema_version        = 1;
+  bool from_archive         = false; // The metadata, and store, are the archive's
+  bool has_booth_aggregates = false;
+  QHash<QString, QVector<QStringList>> db_indexes;
+  QHash<QString, int> unique_table_rows;
+  QHash<QString, QHash<int, QPair<int, int>>> seat_id_ranges;
+  QStringList atl_groups;
+  QStringList atl_groups_short;
+  QStringList btl_names;
+  QStringList btl_names_short;
+  QVector<int> group_from_candidate;
+  QStringList divisions;
+  QVector<int> division_formal_votes;
+  QVector<Bounding_box> division_bboxes;
+  QVector<Booth> booths;
+};
+
+Q_DECLARE_METATYPE(Database_metadata)
+
+class Worker_load_database : public QObject
+{
+  Q_OBJECT
+
+public:
+  // archive, if given, has to stay open until the worker has finished.
+  explicit Worker_load_database(const QString& db_file, const Election_archive* archive = nullptr, int election = -1);
+  ~Worker_load_database();
+
+  // Must match Metadata_blob::VERSION in create_sqlite.
+  static const int METADATA_BLOB_VERSION = 1;
+
+public slots:
+  void do_load();
+
+signals:
+  void finished_load(const Database_metadata& metadata);
+  void error(QString err);
+
+private:
+  void _read_schema(QSqlQuery& query, const QStringList& tables, Database_metadata& metadata);
+  bool _archive_matches(QSqlQuery& query) const;
+  bool _read_blob(QSqlQuery& query, Database_metadata& metadata);
+  bool _read_tables(QSqlQuery& query, Database_metadata& metadata, QString& error_msg);
+  static bool _decode_body(const QByteArray& body, const QStringList& strings, Database_metadata& metadata);
+
+  QString _db_file;
+  const Election_archive* _archive;
+  int _election;
+};
+
+#endif // WORKER_LOAD_DATABASE_H
@@ -1,4 +1,5 @@
 #include "worker_sql_cross_table.h"
+#include "pair_counter.h"
 #include "table_type_constants.h"
 #include <QSqlDatabase>
 #include <QSqlDriver>
@@ -56,6 +57,7 @@ void Worker_sql_cross_table::do_query()
       while (query.next())
       {
         // SELECT P1, P2, COUNT(id) FROM atl [WHERE...] GROUP BY P1, P2
+        // (SUM(weight) FROM atl_unique)
         const int i = qMin(query.value(0).toInt(), _num_rows - 1);
         const int j = qMin(query.value(1).toInt(), _num_rows - 1);
 
@@ -81,37 +83,25 @@ void Worker_sql_cross_table::do_query()
         ignore_groups.append(_args.at(i));
       }
 
+      Pair_counter pairs(_num_rows, ignore_groups);
+
       while (query.next())
       {
-        // SELECT P1, P2, ..., Pn, num_prefs FROM atl [WHERE...]
+        // SELECT P1, P2, ..., Pn, num_prefs, weight FROM atl [WHERE...]
 
         const int num_prefs  = query.value(n).toInt();
+        const int weight     = query.value(n + 1).toInt();
         const int max_search = qMin(num_prefs, n);
 
         for (int i = 0; i < max_search; i++)
         {
-          const int p_i = query.value(i).toInt();
-          if (ignore_groups.indexOf(p_i) < 0)
-          {
-            for (int j = i + 1; j < max_search; j++)
-            {
-              const int p_j = query.value(j).toInt();
-
-              if (ignore_groups.indexOf(p_j) < 0)
-              {
-                table_results[p_i][p_j] += 1;
-                table_results[p_j][p_i] += 1;
-              }
-            }
-
-            if (num_prefs < n)
-            {
-              table_results[_num_rows - 1][p_i] += 1;
-              table_results[p_i][_num_rows - 1] += 1;
-            }
-          }
+          pairs.insert(query.value(i).toInt());
         }
+
+        pairs.add_ballot(weight, num_prefs < n);
       }
+
+      pairs.add_to(table_results);
     }
     else if (_table_type == Table_types::LATER_PREFS)
     {
@@ -138,11 +128,14 @@ void Worker_sql_cross_table::do_query()
       const bool fixed_row = row_fixed_pref <= fixed;
       const bool fixed_col = col_fixed_pref <= fixed;
 
+      Pair_counter pairs(_num_rows, ignore_groups);
+
       while (query.next())
       {
-        // SELECT P1, P2, ..., Pn, num_prefs FROM atl [WHERE...]
+        // SELECT P1, P2, ..., Pn, num_prefs, weight FROM atl [WHERE...]
 
         int p_i, p_j;
+        const int weight = query.value(up_to + 1).toInt();
 
         if (fixed_row)
         {
@@ -156,12 +149,12 @@ void Worker_sql_cross_table::do_query()
 
               if (p_j < _num_rows - 1 && ignore_groups.indexOf(p_j) < 0)
               {
-                table_results[p_i][p_j] += 1;
+                table_results[p_i][p_j] += weight;
               }
 
               if (p_j >= _num_rows)
               {
-                table_results[p_i][_num_rows - 1] += 1;
+                table_results[p_i][_num_rows - 1] += weight;
               }
             }
             else
@@ -174,13 +167,13 @@ void Worker_sql_cross_table::do_query()
                 p_j = query.value(i).toInt();
                 if (ignore_groups.indexOf(p_j) < 0)
                 {
-                  table_results[p_i][p_j] += 1;
+                  table_results[p_i][p_j] += weight;
                 }
               }
 
               if (num_prefs < up_to)
               {
-                table_results[p_i][_num_rows - 1] += 1;
+                table_results[p_i][_num_rows - 1] += weight;
               }
             }
           }
@@ -193,29 +186,14 @@ void Worker_sql_cross_table::do_query()
 
           for (int i = 0; i < max_search; i++)
           {
-            const int p_i = query.value(i).toInt();
-            if (ignore_groups.indexOf(p_i) < 0)
-            {
-              for (int j = i + 1; j < max_search; j++)
-              {
-                const int p_j = query.value(j).toInt();
-
-                if (ignore_groups.indexOf(p_j) < 0)
-                {
-                  table_results[p_i][p_j] += 1;
-                  table_results[p_j][p_i] += 1;
-                }
-              }
-
-              if (num_prefs < up_to)
-              {
-                table_results[_num_rows - 1][p_i] += 1;
-                table_results[p_i][_num_rows - 1] += 1;
-              }
-            }
+            pairs.insert(query.value(i).toInt());
           }
+
+          pairs.add_ballot(weight, num_prefs < up_to);
         }
       }
+
+      pairs.add_to(table_results);
     }
     else if (_table_type == Table_types::PREF_SOURCES)
     {
@@ -235,21 +213,22 @@ void Worker_sql_cross_table::do_query()
 
       while (query.next())
       {
-        // SELECT P1, P4, P5, P6, num_prefs FROM atl [WHERE...]
+        // SELECT P1, P4, P5, P6, num_prefs, weight FROM atl [WHERE...]
 
         const int p_j        = query.value(0).toInt();
         const int num_prefs  = query.value(n).toInt();
+        const int weight     = query.value(n + 1).toInt();
         const int max_search = qMin(num_prefs, pref_max) - pref_min + 1;
 
         for (int i = 0; i < max_search; i++)
         {
           const int p_i = query.value(i + 1).toInt();
-          table_results[p_i][p_j] += 1;
+          table_results[p_i][p_j] += weight;
         }
 
         if ((num_prefs >= pref_min - 1) && (num_prefs < pref_max))
         {
-          table_results[_num_rows - 1][p_j] += 1;
+          table_results[_num_rows - 1][p_j] += weight;
         }
       }
     }
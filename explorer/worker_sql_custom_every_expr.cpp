@@ -26,11 +26,18 @@ Worker_sql_custom_every_expr::Worker_sql_custom_every_expr(const QString& db_fil
   , _have_aggregated(_aggregated_indices.size() > 0)
   , _filter_operations(filter_operations)
   , _cell_operations(cell_operations)
+  , _store_table(nullptr)
 {
 }
 
 Worker_sql_custom_every_expr::~Worker_sql_custom_every_expr() {}
 
+void Worker_sql_custom_every_expr::set_ballot_store(const Ballot_store_table* table, const QVector<Ballot_store_range>& ranges)
+{
+  _store_table  = table;
+  _store_ranges = ranges;
+}
+
 void Worker_sql_custom_every_expr::do_query_operations()
 {
   // The integer stack will not contain any axis numbers -- the all(expr)
@@ -40,21 +47,30 @@ void Worker_sql_custom_every_expr::do_query_operations()
   // index 2*n + 2.
 
   QString connection_name = QString("db_conn_all_%1").arg(_thread_num);
+  const bool use_store    = _store_table != nullptr;
 
   {
-    // *** Should add error handling ***
-    QSqlDatabase _db = QSqlDatabase::addDatabase("QSQLITE", connection_name);
-    _db.setDatabaseName(_db_file);
-    _db.open();
+    // With a ballot store, the rows come from the mapped file and the
+    // database isn't opened at all.
+    QSqlDatabase _db;
+    QSqlQuery query;
 
-    QSqlQuery query(_db);
-
-    if (!query.exec(_q))
+    if (!use_store)
     {
-      emit error(QString("Error: failed to execute query:\n%1").arg(_q));
-      _db.close();
-      QSqlDatabase::removeDatabase(connection_name);
-      return;
+      // *** Should add error handling ***
+      _db = QSqlDatabase::addDatabase("QSQLITE", connection_name);
+      _db.setDatabaseName(_db_file);
+      _db.open();
+
+      query = QSqlQuery(_db);
+
+      if (!query.exec(_q))
+      {
+        emit error(QString("Error: failed to execute query:\n%1").arg(_q));
+        _db.close();
+        QSqlDatabase::removeDatabase(connection_name);
+        return;
+      }
     }
 
     QHash<int, uint8_t> unique_values;
@@ -109,15 +125,39 @@ void Worker_sql_custom_every_expr::do_query_operations()
 
     auto& process_vote = _have_aggregated ? process_vote_with_aggregation : process_vote_without_aggregation;
 
-    while (query.next())
+    // SELECT Pfor0, Pfor1, ..., Pfor(N-1), num_prefs, num_prefs, P1, P2, ..., PN FROM atl
+    // Stack: Pfor0, Pfor1, ..., Pfor(N-1), Exh, num_prefs, P1, P2, ..., PN
+    Ballot_store_cursor cursor(_store_ranges);
+    Ballot_store_block_reader reader(_store_table);
+
+    auto next_ballot = [&]() -> bool
     {
-      // SELECT Pfor0, Pfor1, ..., Pfor(N-1), num_prefs, num_prefs, P1, P2, ..., PN FROM atl
-      // Stack: Pfor0, Pfor1, ..., Pfor(N-1), Exh, num_prefs, P1, P2, ..., PN
+      if (use_store)
+      {
+        if (!cursor.next())
+        {
+          return false;
+        }
+
+        reader.read_ballot(cursor.row(), &stack_integer[0], &stack_integer[_num_groups], &stack_integer[_num_groups + 2]);
+        stack_integer[_num_groups + 1] = stack_integer[_num_groups];
+        return true;
+      }
+
+      if (!query.next())
+      {
+        return false;
+      }
+
       for (int iv = 0; iv < 2 * _num_groups + 2; ++iv)
       {
         stack_integer[iv] = query.value(iv).toInt();
       }
+      return true;
+    };
 
+    while (next_ballot())
+    {
       // "Preference number" for exhaust:
       if (stack_integer[_num_groups] == _num_groups)
       {
@@ -152,7 +192,10 @@ void Worker_sql_custom_every_expr::do_query_operations()
     emit finished_query(_axis, values);
   }
 
-  QSqlDatabase::removeDatabase(connection_name);
+  if (!use_store)
+  {
+    QSqlDatabase::removeDatabase(connection_name);
+  }
 }
 
 void Worker_sql_custom_every_expr::do_query_pure_sql()
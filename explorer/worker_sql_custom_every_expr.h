@@ -1,6 +1,7 @@
 #ifndef WORKER_SQL_CUSTOM_EVERY_EXPR_H
 #define WORKER_SQL_CUSTOM_EVERY_EXPR_H
 
+#include "ballot_store.h"
 #include <QObject>
 
 struct Custom_operation;
@@ -20,6 +21,10 @@ public:
                                         std::vector<Custom_operation>& cell_operations);
   ~Worker_sql_custom_every_expr();
 
+  // For do_query_operations(): scan these rows of the ballot store rather
+  // than running the query.
+  void set_ballot_store(const Ballot_store_table* table, const QVector<Ballot_store_range>& ranges);
+
 public slots:
   void do_query_operations();
   void do_query_pure_sql();
@@ -39,6 +44,8 @@ private:
   bool _have_aggregated;
   std::vector<Custom_operation> _filter_operations;
   std::vector<Custom_operation> _cell_operations;
+  const Ballot_store_table* _store_table;
+  QVector<Ballot_store_range> _store_ranges;
 };
 
 #endif // WORKER_SQL_CUSTOM_EVERY_EXPR_H
@@ -36,6 +36,7 @@ Worker_sql_custom_table::Worker_sql_custom_table(int thread_num,
   , _row_operations(row_operations)
   , _col_operations(col_operations)
   , _cell_operations(cell_operations)
+  , _store_table(nullptr)
 {
   // These routines were originally written for two-axis tables, and a dummy
   // row or column is added if necessary.
@@ -58,25 +59,40 @@ Worker_sql_custom_table::Worker_sql_custom_table(int thread_num,
 
 Worker_sql_custom_table::~Worker_sql_custom_table() {}
 
+void Worker_sql_custom_table::set_ballot_store(const Ballot_store_table* table, const QVector<Ballot_store_range>& ranges)
+{
+  _store_table  = table;
+  _store_ranges = ranges;
+}
+
 void Worker_sql_custom_table::do_query()
 {
   QString connection_name = QString("db_conn_%1").arg(_thread_num);
+  const bool use_store    = _store_table != nullptr;
 
   {
-    // *** Should add error handling ***
-    QSqlDatabase _db = QSqlDatabase::addDatabase("QSQLITE", connection_name);
-    _db.setDatabaseName(_db_file);
-    _db.open();
-
-    QSqlQuery query(_db);
-    query.setForwardOnly(true);
+    // With a ballot store, the rows come from the mapped file and the
+    // database isn't opened at all.
+    QSqlDatabase _db;
+    QSqlQuery query;
 
-    if (!query.exec(_q))
+    if (!use_store)
     {
-      emit error(QString("Error: failed to execute query:\n%1").arg(_q));
-      _db.close();
-      QSqlDatabase::removeDatabase(connection_name);
-      return;
+      // *** Should add error handling ***
+      _db = QSqlDatabase::addDatabase("QSQLITE", connection_name);
+      _db.setDatabaseName(_db_file);
+      _db.open();
+
+      query = QSqlQuery(_db);
+      query.setForwardOnly(true);
+
+      if (!query.exec(_q))
+      {
+        emit error(QString("Error: failed to execute query:\n%1").arg(_q));
+        _db.close();
+        QSqlDatabase::removeDatabase(connection_name);
+        return;
+      }
     }
 
     QVector<QVector<int>> table_results;
@@ -236,15 +252,48 @@ void Worker_sql_custom_table::do_query()
     auto& process_vote     = _have_aggregated ? process_vote_with_aggregation : process_vote_without_aggregation;
     auto& axis_table_index = _have_aggregated ? axis_table_index_with_aggregation : axis_table_index_without_aggregation;
 
-    while (query.next())
+    // SELECT booth_id, Pfor0, Pfor1, ..., Pfor(N-1), num_prefs, num_prefs, P1, P2, ..., PN, weight FROM atl
+    // Stack:           Pfor0, Pfor1, ..., Pfor(N-1), Exh,       num_prefs, P1, P2, ..., PN
+    //
+    // weight is the number of identical ballots the row stands for (just 1
+    // when the table has no weights).
+    Ballot_store_cursor cursor(_store_ranges);
+    Ballot_store_block_reader reader(_store_table);
+    int booth_id = 0;
+    int weight   = 1;
+
+    auto next_ballot = [&]() -> bool
     {
-      // SELECT booth_id, Pfor0, Pfor1, ..., Pfor(N-1), num_prefs, num_prefs, P1, P2, ..., PN FROM atl
-      // Stack:           Pfor0, Pfor1, ..., Pfor(N-1), Exh,       num_prefs, P1, P2, ..., PN
+      if (use_store)
+      {
+        if (!cursor.next())
+        {
+          return false;
+        }
+
+        booth_id = cursor.booth_id();
+        weight   = _store_table->weight(cursor.row());
+        reader.read_ballot(cursor.row(), &stack_integer[0], &stack_integer[_num_groups], &stack_integer[_num_groups + 2]);
+        stack_integer[_num_groups + 1] = stack_integer[_num_groups];
+        return true;
+      }
+
+      if (!query.next())
+      {
+        return false;
+      }
+
+      booth_id = query.value(0).toInt();
       for (int iv = 0; iv < 2 * _num_groups + 2; ++iv)
       {
         stack_integer[iv] = query.value(iv + 1).toInt();
       }
+      weight = query.value(2 * _num_groups + 3).toInt();
+      return true;
+    };
 
+    while (next_ballot())
+    {
       // "Preference number" for exhaust:
       if (stack_integer[_num_groups] == _num_groups)
       {
@@ -264,7 +313,7 @@ void Worker_sql_custom_table::do_query()
         continue;
       }
 
-      total_base++;
+      total_base += weight;
 
       if (have_row && have_col)
       {
@@ -280,8 +329,8 @@ void Worker_sql_custom_table::do_query()
           continue;
         }
 
-        row_bases[i_loop]++;
-        table_results[i_loop][j_loop]++;
+        row_bases[i_loop] += weight;
+        table_results[i_loop][j_loop] += weight;
       }
       else if (have_row && !have_col)
       {
@@ -299,13 +348,13 @@ void Worker_sql_custom_table::do_query()
           process_vote(ptr_indices_cell, _cell_operations, n_cell_operations);
           if (stack_boolean[0])
           {
-            table_results[i_loop][j_loop]++;
+            table_results[i_loop][j_loop] += weight;
             include_in_row_base = true;
           }
         }
         if (include_in_row_base)
         {
-          row_bases[i_loop]++;
+          row_bases[i_loop] += weight;
         }
       }
       else if (!have_row && have_col)
@@ -323,8 +372,8 @@ void Worker_sql_custom_table::do_query()
           process_vote(ptr_indices_cell, _cell_operations, n_cell_operations);
           if (stack_boolean[0])
           {
-            row_bases[i_loop]++;
-            table_results[i_loop][j_loop]++;
+            row_bases[i_loop] += weight;
+            table_results[i_loop][j_loop] += weight;
           }
         }
       }
@@ -342,13 +391,13 @@ void Worker_sql_custom_table::do_query()
             process_vote(ptr_indices_cell, _cell_operations, n_cell_operations);
             if (stack_boolean[0])
             {
-              table_results[i_loop][j_loop]++;
+              table_results[i_loop][j_loop] += weight;
               include_in_row_base = true;
             }
           }
           if (include_in_row_base)
           {
-            row_bases[i_loop]++;
+            row_bases[i_loop] += weight;
           }
         }
       }
@@ -358,28 +407,40 @@ void Worker_sql_custom_table::do_query()
     emit finished_query(total_base, row_bases, table_results);
   }
 
-  QSqlDatabase::removeDatabase(connection_name);
+  if (!use_store)
+  {
+    QSqlDatabase::removeDatabase(connection_name);
+  }
 }
 
 void Worker_sql_custom_table::do_query_by_booth()
 {
   QString connection_name = QString("db_conn_%1").arg(_thread_num);
+  const bool use_store    = _store_table != nullptr;
 
   {
-    // *** Should add error handling ***
-    QSqlDatabase _db = QSqlDatabase::addDatabase("QSQLITE", connection_name);
-    _db.setDatabaseName(_db_file);
-    _db.open();
+    // With a ballot store, the rows come from the mapped file and the
+    // database isn't opened at all.
+    QSqlDatabase _db;
+    QSqlQuery query;
 
-    QSqlQuery query(_db);
-    query.setForwardOnly(true);
-
-    if (!query.exec(_q))
+    if (!use_store)
     {
-      emit error(QString("Error: failed to execute query:\n%1").arg(_q));
-      _db.close();
-      QSqlDatabase::removeDatabase(connection_name);
-      return;
+      // *** Should add error handling ***
+      _db = QSqlDatabase::addDatabase("QSQLITE", connection_name);
+      _db.setDatabaseName(_db_file);
+      _db.open();
+
+      query = QSqlQuery(_db);
+      query.setForwardOnly(true);
+
+      if (!query.exec(_q))
+      {
+        emit error(QString("Error: failed to execute query:\n%1").arg(_q));
+        _db.close();
+        QSqlDatabase::removeDatabase(connection_name);
+        return;
+      }
     }
 
     QVector<QVector<QVector<int>>> table_results;
@@ -553,16 +614,100 @@ void Worker_sql_custom_table::do_query_by_booth()
     auto& process_vote     = _have_aggregated ? process_vote_with_aggregation : process_vote_without_aggregation;
     auto& axis_table_index = _have_aggregated ? axis_table_index_with_aggregation : axis_table_index_without_aggregation;
 
-    while (query.next())
+    // SELECT booth_id, Pfor0, Pfor1, ..., Pfor(N-1), num_prefs, num_prefs, P1, P2, ..., PN, weight FROM atl
+    // Stack:           Pfor0, Pfor1, ..., Pfor(N-1), Exh,       num_prefs, P1, P2, ..., PN
+    //
+    // weight is the number of identical ballots the row stands for (just 1
+    // when the table has no weights).
+    Ballot_store_cursor cursor(_store_ranges);
+    Ballot_store_block_reader reader(_store_table);
+    int booth_id = 0;
+    int weight   = 1;
+
+    // The votes are tallied for one booth at a time, and added to the
+    // per-booth tables when the booth changes, so the loop below only
+    // touches a small buffer.  The store (and a table written with
+    // --cluster-booths) gives each booth's ballots together, so that's
+    // once per booth; otherwise it's still right, just more often.
+    // touched lists the cells in use, so a flush doesn't go over all of
+    // them.
+    std::vector<int> booth_cells(num_rows * num_cols, 0);
+    std::vector<int> booth_row_bases(num_rows, 0);
+    std::vector<int> touched;
+    int booth_total   = 0;
+    int current_booth = -1;
+
+    auto add_cell = [&](int i_loop, int j_loop)
     {
-      // SELECT booth_id, Pfor0, Pfor1, ..., Pfor(N-1), num_prefs, num_prefs, P1, P2, ..., PN FROM atl
-      // Stack:           Pfor0, Pfor1, ..., Pfor(N-1), Exh,       num_prefs, P1, P2, ..., PN
-      const int booth_id = query.value(0).toInt();
+      const int cell = i_loop * num_cols + j_loop;
+      if (booth_cells[cell] == 0)
+      {
+        touched.push_back(cell);
+      }
+      booth_cells[cell] += weight;
+    };
 
+    auto flush_booth = [&]()
+    {
+      if (current_booth < 0)
+      {
+        return;
+      }
+
+      total_base[current_booth] += booth_total;
+      booth_total = 0;
+
+      for (int i_loop = 0; i_loop < num_rows; ++i_loop)
+      {
+        row_bases[i_loop][current_booth] += booth_row_bases[i_loop];
+        booth_row_bases[i_loop] = 0;
+      }
+
+      for (int cell : touched)
+      {
+        table_results[cell / num_cols][cell % num_cols][current_booth] += booth_cells[cell];
+        booth_cells[cell] = 0;
+      }
+      touched.clear();
+    };
+
+    auto next_ballot = [&]() -> bool
+    {
+      if (use_store)
+      {
+        if (!cursor.next())
+        {
+          return false;
+        }
+
+        booth_id = cursor.booth_id();
+        weight   = _store_table->weight(cursor.row());
+        reader.read_ballot(cursor.row(), &stack_integer[0], &stack_integer[_num_groups], &stack_integer[_num_groups + 2]);
+        stack_integer[_num_groups + 1] = stack_integer[_num_groups];
+        return true;
+      }
+
+      if (!query.next())
+      {
+        return false;
+      }
+
+      booth_id = query.value(0).toInt();
       for (int iv = 0; iv < 2 * _num_groups + 2; ++iv)
       {
         stack_integer[iv] = query.value(iv + 1).toInt();
       }
+      weight = query.value(2 * _num_groups + 3).toInt();
+      return true;
+    };
+
+    while (next_ballot())
+    {
+      if (booth_id != current_booth)
+      {
+        flush_booth();
+        current_booth = booth_id;
+      }
 
       // "Preference number" for exhaust:
       if (stack_integer[_num_groups] == _num_groups)
@@ -583,7 +728,7 @@ void Worker_sql_custom_table::do_query_by_booth()
         continue;
       }
 
-      total_base[booth_id]++;
+      booth_total += weight;
 
       if (have_row && have_col)
       {
@@ -599,8 +744,8 @@ void Worker_sql_custom_table::do_query_by_booth()
           continue;
         }
 
-        row_bases[i_loop][booth_id]++;
-        table_results[i_loop][j_loop][booth_id]++;
+        booth_row_bases[i_loop] += weight;
+        add_cell(i_loop, j_loop);
       }
       else if (have_row && !have_col)
       {
@@ -618,13 +763,13 @@ void Worker_sql_custom_table::do_query_by_booth()
           process_vote(ptr_indices_cell, _cell_operations, n_cell_operations);
           if (stack_boolean[0])
           {
-            table_results[i_loop][j_loop][booth_id]++;
+            add_cell(i_loop, j_loop);
             include_in_row_base = true;
           }
         }
         if (include_in_row_base)
         {
-          row_bases[i_loop][booth_id]++;
+          booth_row_bases[i_loop] += weight;
         }
       }
       else if (!have_row && have_col)
@@ -642,8 +787,8 @@ void Worker_sql_custom_table::do_query_by_booth()
           process_vote(ptr_indices_cell, _cell_operations, n_cell_operations);
           if (stack_boolean[0])
           {
-            row_bases[i_loop][booth_id]++;
-            table_results[i_loop][j_loop][booth_id]++;
+            booth_row_bases[i_loop] += weight;
+            add_cell(i_loop, j_loop);
           }
         }
       }
@@ -661,21 +806,26 @@ void Worker_sql_custom_table::do_query_by_booth()
             process_vote(ptr_indices_cell, _cell_operations, n_cell_operations);
             if (stack_boolean[0])
             {
-              table_results[i_loop][j_loop][booth_id]++;
+              add_cell(i_loop, j_loop);
               include_in_row_base = true;
             }
           }
           if (include_in_row_base)
           {
-            row_bases[i_loop][booth_id]++;
+            booth_row_bases[i_loop] += weight;
           }
         }
       }
     }
 
+    flush_booth();
+
     _db.close();
     emit finished_query_by_booth(total_base, row_bases, table_results);
   }
 
-  QSqlDatabase::removeDatabase(connection_name);
+  if (!use_store)
+  {
+    QSqlDatabase::removeDatabase(connection_name);
+  }
 }
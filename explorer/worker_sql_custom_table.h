@@ -1,6 +1,7 @@
 #ifndef WORKER_SQL_CUSTOM_TABLE_H
 #define WORKER_SQL_CUSTOM_TABLE_H
 
+#include "ballot_store.h"
 #include <QObject>
 
 struct Custom_operation;
@@ -25,6 +26,9 @@ public:
                             std::vector<Custom_operation>& cell_operations);
     ~Worker_sql_custom_table();
 
+    // Scan these rows of the ballot store rather than running the query.
+    void set_ballot_store(const Ballot_store_table* table, const QVector<Ballot_store_range>& ranges);
+
 public slots:
     void do_query();
     void do_query_by_booth();
@@ -52,6 +56,8 @@ private:
     std::vector<Custom_operation> _row_operations;
     std::vector<Custom_operation> _col_operations;
     std::vector<Custom_operation> _cell_operations;
+    const Ballot_store_table* _store_table;
+    QVector<Ballot_store_range> _store_ranges;
 };
 
 #endif // WORKER_SQL_CUSTOM_TABLE_H
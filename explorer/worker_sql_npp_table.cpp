@@ -1,4 +1,5 @@
 #include "worker_sql_npp_table.h"
+#include "step_forward_engine.h"
 #include <QSqlDatabase>
 #include <QSqlDriver>
 #include <QSqlError>
@@ -13,6 +14,17 @@ Worker_sql_npp_table::Worker_sql_npp_table(
   , _num_groups(num_groups)
   , _clicked_n_parties(clicked_n_parties)
   , _num_booths(num_booths)
+  , _engine(nullptr)
+{
+}
+
+Worker_sql_npp_table::Worker_sql_npp_table(
+  int thread_num, Step_forward_engine* engine, int num_groups, int num_booths, QVector<int>& clicked_n_parties)
+  : _thread_num(thread_num)
+  , _num_groups(num_groups)
+  , _clicked_n_parties(clicked_n_parties)
+  , _num_booths(num_booths)
+  , _engine(engine)
 {
 }
 
@@ -20,6 +32,12 @@ Worker_sql_npp_table::~Worker_sql_npp_table() {}
 
 void Worker_sql_npp_table::do_query()
 {
+  if (_engine != nullptr)
+  {
+    _engine_query();
+    return;
+  }
+
   // Need to open the database from each thread separately.
 
   QString connection_name = QString("db_conn_%1").arg(_thread_num);
@@ -100,3 +118,20 @@ void Worker_sql_npp_table::do_query()
 
   QSqlDatabase::removeDatabase(connection_name);
 }
+
+void Worker_sql_npp_table::_engine_query()
+{
+  QString load_error;
+  if (!_engine->load(_engine->prefs_for_npp(), _thread_num, load_error))
+  {
+    emit error(load_error);
+    return;
+  }
+
+  const int n = _clicked_n_parties.length();
+
+  QVector<QVector<QVector<int>>> table_results(n + 1, QVector<QVector<int>>(_num_groups, QVector<int>(_num_booths, 0)));
+  _engine->npp_counts(_clicked_n_parties, table_results);
+
+  emit finished_query(table_results);
+}
@@ -3,12 +3,19 @@
 
 #include <QObject>
 
+class Step_forward_engine;
+
 class Worker_sql_npp_table : public QObject
 {
   Q_OBJECT
 
 public:
   Worker_sql_npp_table(int thread_num, const QString& db_file, const QString& q, int num_groups, int num_booths, QVector<int>& clicked_n_parties);
+
+  // Counts the table from a Step_forward_engine instead of SQL, reading
+  // every P column first if the engine doesn't have them yet.  The engine
+  // belongs to the main widget, whose interface is locked while this runs.
+  Worker_sql_npp_table(int thread_num, Step_forward_engine* engine, int num_groups, int num_booths, QVector<int>& clicked_n_parties);
   ~Worker_sql_npp_table();
 
 public slots:
@@ -19,12 +26,15 @@ signals:
   void error(QString err);
 
 private:
+  void _engine_query();
+
   int _thread_num;
   QString _db_file;
   QString _q;
   int _num_groups;
   QVector<int> _clicked_n_parties;
   int _num_booths;
+  Step_forward_engine* _engine;
 };
 
 #endif // WORKER_SQL_NPP_TABLE_H
@@ -0,0 +1,46 @@
+#include "worker_step_forward.h"
+#include "step_forward_engine.h"
+
+Worker_step_forward::Worker_step_forward(int thread_num,
+                                         Step_forward_engine* engine,
+                                         int num_prefs,
+                                         const QVector<int>& prefix,
+                                         const QVector<int>& within,
+                                         int by_pref,
+                                         int num_rows,
+                                         int num_booths)
+  : _thread_num(thread_num)
+  , _engine(engine)
+  , _num_prefs(num_prefs)
+  , _prefix(prefix)
+  , _within(within)
+  , _by_pref(by_pref)
+  , _num_rows(num_rows)
+  , _num_booths(num_booths)
+{
+}
+
+Worker_step_forward::~Worker_step_forward() {}
+
+void Worker_step_forward::do_query()
+{
+  QString load_error;
+  if (!_engine->load(_num_prefs, _thread_num, load_error))
+  {
+    emit error(load_error);
+    return;
+  }
+
+  QVector<QVector<int>> column_results(_num_rows, QVector<int>(_num_booths, 0));
+
+  if (_by_pref > 0)
+  {
+    _engine->first_n_counts(_prefix, _within, _by_pref, column_results);
+  }
+  else
+  {
+    _engine->next_pref_counts(_prefix, column_results);
+  }
+
+  emit finished_query(column_results);
+}
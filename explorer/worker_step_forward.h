@@ -0,0 +1,46 @@
+#ifndef WORKER_STEP_FORWARD_H
+#define WORKER_STEP_FORWARD_H
+
+#include <QObject>
+#include <QVector>
+
+class Step_forward_engine;
+
+// Fills in a Step-forward column from a Step_forward_engine, or a First-n
+// column if by_pref > 0, reading P1, ..., P<num_prefs> first if the engine
+// doesn't have them yet.  The engine belongs to the main widget, whose
+// interface is locked while this runs.
+class Worker_step_forward : public QObject
+{
+  Q_OBJECT
+
+public:
+  Worker_step_forward(int thread_num,
+                      Step_forward_engine* engine,
+                      int num_prefs,
+                      const QVector<int>& prefix,
+                      const QVector<int>& within,
+                      int by_pref,
+                      int num_rows,
+                      int num_booths);
+  ~Worker_step_forward();
+
+public slots:
+  void do_query();
+
+signals:
+  void finished_query(const QVector<QVector<int>>& partial_table);
+  void error(QString err);
+
+private:
+  int _thread_num;
+  Step_forward_engine* _engine;
+  int _num_prefs;
+  QVector<int> _prefix;
+  QVector<int> _within;
+  int _by_pref;
+  int _num_rows;
+  int _num_booths;
+};
+
+#endif // WORKER_STEP_FORWARD_H